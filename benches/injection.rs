@@ -0,0 +1,413 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Throughput benchmarks of the injection's hot paths against the CUPTI stubs.
+//!
+//! Run with `cargo bench --features stubs`. The `CUPTI_STUB_*` variables
+//! understood by the stubs apply, e.g. `CUPTI_STUB_EVALUATE_LATENCY_US` to
+//! model a slower evaluator; `CUPTI_STUB_RANGES` defaults to `RANGES` here.
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use cupti_profiler::bindings::*;
+use cupti_profiler::{MetricEvaluator, MetricSet, RangeValues};
+use perfetto_cupti_gpu_compute::{
+    callbacks::{buffer_completed, buffer_requested, profiler_callback_handler},
+    config::Config,
+    device::{DeviceProperties, FuncAttributes},
+    emission::{emit_kernels, flush_aggregates},
+    metrics::DEFAULT_METRICS,
+    state::{CompletedKernel, CtxProfilerData, KernelActivity, KernelLaunch, GLOBAL_STATE},
+    tracing::{get_data_source, get_data_source_name},
+};
+use perfetto_sdk::{
+    producer::{Backends, Producer, ProducerInitArgsBuilder},
+    tracing_session::TracingSession,
+};
+use std::{
+    ffi::{c_void, CString},
+    hint::black_box,
+    ptr,
+    sync::{Arc, Once},
+    thread,
+    time::Instant,
+};
+
+/// The stubs report this id for every context.
+const CTX_ID: u32 = 1;
+
+const LAUNCH_COUNTS: &[usize] = &[1, 64, 1024];
+const METRIC_COUNTS: &[usize] = &[1, 8, 24];
+const THREAD_COUNTS: &[usize] = &[1, 4, 8];
+
+/// Ranges the stubs report per decoded counter data image.
+const RANGES: usize = 32;
+
+/// Size in KiB of the trace buffer of the benchmark session. It is a ring
+/// buffer, so long runs overwrite old packets rather than stop writing.
+const TRACE_BUFFER_KB: u64 = 64 * 1024;
+
+static INIT: Once = Once::new();
+
+fn init() {
+    INIT.call_once(|| {
+        // The stubs read their configuration once, on first use.
+        if std::env::var_os("CUPTI_STUB_RANGES").is_none() {
+            std::env::set_var("CUPTI_STUB_RANGES", RANGES.to_string());
+        }
+        Producer::init(
+            ProducerInitArgsBuilder::new()
+                .backends(Backends::IN_PROCESS)
+                .build(),
+        );
+        let _ = get_data_source();
+        // Launches are only intercepted and packets only written while a
+        // session is running; this one lasts for the whole run.
+        Box::leak(Box::new(start_session(TRACE_BUFFER_KB)));
+    });
+}
+
+/// Starts an in-process tracing session of the GPU counters data source.
+fn start_session(buffer_kb: u64) -> TracingSession {
+    // TraceConfig { buffers { size_kb fill_policy: RING_BUFFER }
+    //               data_sources { config { name } } }
+    let mut buffer = Vec::new();
+    proto_uint(&mut buffer, 1, buffer_kb);
+    proto_uint(&mut buffer, 4, 1);
+    let mut data_source_config = Vec::new();
+    proto_bytes(
+        &mut data_source_config,
+        1,
+        get_data_source_name().as_bytes(),
+    );
+    let mut data_source = Vec::new();
+    proto_bytes(&mut data_source, 1, &data_source_config);
+    let mut trace_config = Vec::new();
+    proto_bytes(&mut trace_config, 1, &buffer);
+    proto_bytes(&mut trace_config, 2, &data_source);
+
+    let mut session = TracingSession::in_process().expect("failed to create tracing session");
+    session.setup(&trace_config);
+    session.start_blocking();
+    session
+}
+
+fn proto_varint(out: &mut Vec<u8>, mut v: u64) {
+    while v >= 0x80 {
+        out.push(v as u8 | 0x80);
+        v >>= 7;
+    }
+    out.push(v as u8);
+}
+
+fn proto_uint(out: &mut Vec<u8>, field: u32, v: u64) {
+    proto_varint(out, (field as u64) << 3);
+    proto_varint(out, v);
+}
+
+fn proto_bytes(out: &mut Vec<u8>, field: u32, v: &[u8]) {
+    proto_varint(out, (field as u64) << 3 | 2);
+    proto_varint(out, v.len() as u64);
+    out.extend_from_slice(v);
+}
+
+fn metric_set(count: usize) -> Arc<MetricSet> {
+    let names: Vec<String> = DEFAULT_METRICS
+        .iter()
+        .cycle()
+        .take(count)
+        .map(|s| s.to_string())
+        .collect();
+    Arc::new(MetricSet::new(&names))
+}
+
+/// Installs `config` and a fresh context for it.
+fn reset_state(config: Config) -> Config {
+    init();
+    GLOBAL_STATE.set_config(config.clone());
+    GLOBAL_STATE.insert_context(
+        CTX_ID,
+        CtxProfilerData::new(DeviceProperties::default(), &config),
+    );
+    config
+}
+
+fn fake_ctx() -> CUcontext {
+    ptr::NonNull::dangling().as_ptr()
+}
+
+fn activity(correlation_id: u32) -> KernelActivity {
+    KernelActivity {
+        correlation_id,
+        kernel_name: format!("_Z6kernelILi{}EEvv", correlation_id % 16),
+        grid_size: (128, 1, 1),
+        block_size: (256, 1, 1),
+        registers_per_thread: 32,
+        dynamic_shared_memory: 0,
+        static_shared_memory: 1024,
+        shared_memory_executed: 102400,
+        cache_config: 0,
+        launch_type: 0,
+        graph_id: 0,
+        graph_node_id: 0,
+        start: 1_000 * correlation_id as u64,
+        end: 1_000 * correlation_id as u64 + 800,
+    }
+}
+
+/// The activity record CUPTI writes for `activity(correlation_id)`.
+fn kernel_record(correlation_id: u32) -> CUpti_ActivityKernel5 {
+    let mut record: CUpti_ActivityKernel5 = unsafe { std::mem::zeroed() };
+    record.kind = CUpti_ActivityKind_CUPTI_ACTIVITY_KIND_KERNEL;
+    record.contextId = CTX_ID;
+    record.correlationId = correlation_id;
+    record.name = c"_Z6vecAddPKfS0_Pfi".as_ptr();
+    (record.gridX, record.gridY, record.gridZ) = (128, 1, 1);
+    (record.blockX, record.blockY, record.blockZ) = (256, 1, 1);
+    record.registersPerThread = 32;
+    record.staticSharedMemory = 1024;
+    record.start = 1_000 * correlation_id as u64;
+    record.end = record.start + 800;
+    record
+}
+
+fn launch(correlation_id: u32, sampled: bool) -> KernelLaunch {
+    KernelLaunch {
+        correlation_id,
+        function: ptr::null_mut(),
+        timestamp: 1_000 * correlation_id as u64,
+        attributes: FuncAttributes::default(),
+        sampled,
+    }
+}
+
+fn completed_kernels(launches: usize, metrics: &Arc<MetricSet>) -> Vec<CompletedKernel> {
+    let device = Arc::new(DeviceProperties::default());
+    let values = (0..launches * metrics.len()).map(|i| i as f64).collect();
+    let ranges = RangeValues::new(metrics.clone(), values).into_ranges();
+    (0..launches as u32)
+        .zip(ranges)
+        .map(|(id, range)| CompletedKernel {
+            device: device.clone(),
+            launch: launch(id, true),
+            activity: activity(id),
+            range: Some(range),
+        })
+        .collect()
+}
+
+/// Calls the launch callback as CUPTI does for one `cuLaunchKernel`.
+///
+/// The launch is reported as failed on exit so that it is discarded again and
+/// the state does not grow across iterations.
+fn launch_kernel(correlation_id: u32, symbol: &CString) {
+    let cbid = CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernel;
+    let mut params: cuLaunchKernel_params = unsafe { std::mem::zeroed() };
+    params.gridDimX = 128;
+    params.gridDimY = 1;
+    params.gridDimZ = 1;
+    params.blockDimX = 256;
+    params.blockDimY = 1;
+    params.blockDimZ = 1;
+    let mut result: CUresult = cudaError_enum_CUDA_ERROR_LAUNCH_FAILED;
+    let mut cb_data: CUpti_CallbackData = unsafe { std::mem::zeroed() };
+    cb_data.callbackSite = CUpti_ApiCallbackSite_CUPTI_API_ENTER;
+    cb_data.functionParams = &params as *const _ as *const c_void;
+    cb_data.functionReturnValue = &mut result as *mut _ as *mut c_void;
+    cb_data.symbolName = symbol.as_ptr();
+    cb_data.context = fake_ctx();
+    cb_data.correlationId = correlation_id;
+    let domain = CUpti_CallbackDomain_CUPTI_CB_DOMAIN_DRIVER_API;
+    let cbdata = &cb_data as *const _ as *const c_void;
+    unsafe { profiler_callback_handler(ptr::null_mut(), domain, cbid, cbdata) };
+    cb_data.callbackSite = CUpti_ApiCallbackSite_CUPTI_API_EXIT;
+    unsafe { profiler_callback_handler(ptr::null_mut(), domain, cbid, cbdata) };
+}
+
+/// Launch callbacks issued from several threads at once.
+fn bench_launch_callback(c: &mut Criterion) {
+    let mut group = c.benchmark_group("launch_callback");
+    group.throughput(Throughput::Elements(1));
+    for &threads in THREAD_COUNTS {
+        reset_state(Config::default());
+        group.bench_with_input(
+            BenchmarkId::from_parameter(threads),
+            &threads,
+            |b, &threads| {
+                // The iterations are split across the threads, so the reported
+                // time per launch drops as long as the launch path scales.
+                b.iter_custom(|iters| {
+                    let start = Instant::now();
+                    thread::scope(|scope| {
+                        for t in 0..threads as u64 {
+                            scope.spawn(move || {
+                                let symbol = CString::new("_Z6kernelv").unwrap();
+                                for i in (t..iters).step_by(threads) {
+                                    launch_kernel(i as u32, &symbol);
+                                }
+                            });
+                        }
+                    });
+                    start.elapsed()
+                });
+            },
+        );
+    }
+    group.finish();
+}
+
+/// Joining launches with their activity records.
+fn bench_join(c: &mut Criterion) {
+    let mut group = c.benchmark_group("join");
+    let config = Config::default();
+    for &launches in LAUNCH_COUNTS {
+        group.throughput(Throughput::Elements(launches as u64));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(launches),
+            &launches,
+            |b, &launches| {
+                b.iter_batched(
+                    || {
+                        let mut data = CtxProfilerData::new(DeviceProperties::default(), &config);
+                        for id in 0..launches as u32 {
+                            data.add_launch(launch(id, false));
+                        }
+                        let activities: Vec<_> = (0..launches as u32).map(activity).collect();
+                        (data, activities)
+                    },
+                    |(mut data, activities)| black_box(data.add_activities(activities)),
+                    BatchSize::SmallInput,
+                );
+            },
+        );
+    }
+    group.finish();
+}
+
+/// Handing activity buffers full of kernel records back to the injection.
+///
+/// Runs in activity-only mode, so every record completes and is emitted.
+fn bench_buffer_completed(c: &mut Criterion) {
+    reset_state(Config {
+        activity_only: true,
+        ..Default::default()
+    });
+    let max_launches = LAUNCH_COUNTS.iter().copied().max().unwrap_or(1);
+    let record_size = std::mem::size_of::<CUpti_ActivityKernel5>();
+    perfetto_cupti_gpu_compute::buffer_pool::init(max_launches * record_size, 2);
+    let mut group = c.benchmark_group("buffer_completed");
+    for &launches in LAUNCH_COUNTS {
+        group.throughput(Throughput::Elements(launches as u64));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(launches),
+            &launches,
+            |b, &launches| {
+                b.iter(|| unsafe {
+                    let mut buffer = ptr::null_mut();
+                    let mut size = 0;
+                    let mut max_records = 0;
+                    buffer_requested(&mut buffer, &mut size, &mut max_records);
+                    let records = buffer as *mut CUpti_ActivityKernel5;
+                    for id in 0..launches {
+                        records.add(id).write(kernel_record(id as u32));
+                    }
+                    buffer_completed(ptr::null_mut(), 0, buffer, size, launches * record_size);
+                });
+            },
+        );
+    }
+    group.finish();
+}
+
+/// Turning a decoded counter data image into metric values.
+fn bench_evaluate(c: &mut Criterion) {
+    init();
+    let evaluator = match unsafe { MetricEvaluator::new(fake_ctx()) } {
+        Ok(evaluator) => evaluator,
+        Err(e) => {
+            eprintln!("Skipping evaluate: {:?}", e);
+            return;
+        }
+    };
+    let counter_data_image = vec![0u8; 64 * 1024];
+    let mut group = c.benchmark_group("evaluate_all_ranges");
+    for &metrics in METRIC_COUNTS {
+        let metrics = metric_set(metrics);
+        group.throughput(Throughput::Elements((RANGES * metrics.len()) as u64));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(metrics.len()),
+            &metrics,
+            |b, metrics| {
+                b.iter(|| black_box(evaluator.evaluate_all_ranges(&counter_data_image, metrics)));
+            },
+        );
+    }
+    group.finish();
+}
+
+/// Writing completed kernels to the trace, per launch and aggregated, as done
+/// by the activity callback and at exit.
+fn bench_emission(c: &mut Criterion) {
+    for (name, aggregate_interval_ms) in [("emit_kernels", 0), ("emit_aggregated", 1)] {
+        let config = reset_state(Config {
+            aggregate_interval_ms,
+            ..Default::default()
+        });
+        // One iteration into a session of its own must write the kernels, or
+        // the benchmark would time a writer that writes nothing.
+        let mut check = start_session(1024);
+        emit_kernels(&completed_kernels(16, &metric_set(8)), &config);
+        flush_aggregates(&config);
+        check.stop_blocking();
+        let mut trace = Vec::new();
+        check.read_trace_blocking(|data: &[u8], _has_more: bool| trace.extend_from_slice(data));
+        assert!(
+            trace.windows(12).any(|w| w == b"_Z6kernelILi"),
+            "{}: no kernel packets were written",
+            name
+        );
+
+        let mut group = c.benchmark_group(name);
+        for &launches in LAUNCH_COUNTS {
+            for &metrics in METRIC_COUNTS {
+                let metric_set = metric_set(metrics);
+                group.throughput(Throughput::Elements(launches as u64));
+                group.bench_with_input(
+                    BenchmarkId::new(format!("{}_metrics", metrics), launches),
+                    &launches,
+                    |b, &launches| {
+                        b.iter_batched(
+                            || completed_kernels(launches, &metric_set),
+                            |kernels| {
+                                emit_kernels(&kernels, &config);
+                                flush_aggregates(&config);
+                            },
+                            BatchSize::SmallInput,
+                        );
+                    },
+                );
+            }
+        }
+        group.finish();
+    }
+}
+
+criterion_group!(
+    benches,
+    bench_launch_callback,
+    bench_join,
+    bench_buffer_completed,
+    bench_evaluate,
+    bench_emission
+);
+criterion_main!(benches);
@@ -118254,3 +118254,1001 @@ fn bindgen_test_layout_CUpti_Device_GetChipName_Params() {
 extern "C" {
     pub fn cuptiDeviceGetChipName(pParams: *mut CUpti_Device_GetChipName_Params) -> CUptiResult;
 }
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_Object {
+    _unused: [u8; 0],
+}
+pub const CUpti_PmSampling_TriggerMode_CUPTI_PM_SAMPLING_TRIGGER_MODE_GPU_SYSCLK_INTERVAL:
+    CUpti_PmSampling_TriggerMode = 0;
+pub const CUpti_PmSampling_TriggerMode_CUPTI_PM_SAMPLING_TRIGGER_MODE_GPU_TIME_INTERVAL:
+    CUpti_PmSampling_TriggerMode = 1;
+pub const CUpti_PmSampling_TriggerMode_CUPTI_PM_SAMPLING_TRIGGER_MODE_COUNT:
+    CUpti_PmSampling_TriggerMode = 2;
+pub type CUpti_PmSampling_TriggerMode = ::std::os::raw::c_uint;
+pub const CUpti_PmSampling_DecodeStopReason_CUPTI_PM_SAMPLING_DECODE_STOP_REASON_OTHER:
+    CUpti_PmSampling_DecodeStopReason = 0;
+pub const CUpti_PmSampling_DecodeStopReason_CUPTI_PM_SAMPLING_DECODE_STOP_REASON_COUNTER_DATA_FULL: CUpti_PmSampling_DecodeStopReason = 1;
+pub const CUpti_PmSampling_DecodeStopReason_CUPTI_PM_SAMPLING_DECODE_STOP_REASON_END_OF_RECORDS:
+    CUpti_PmSampling_DecodeStopReason = 2;
+pub const CUpti_PmSampling_DecodeStopReason_CUPTI_PM_SAMPLING_DECODE_STOP_REASON_COUNT:
+    CUpti_PmSampling_DecodeStopReason = 3;
+pub type CUpti_PmSampling_DecodeStopReason = ::std::os::raw::c_uint;
+pub const CUpti_PmSampling_HardwareBuffer_AppendMode_CUPTI_PM_SAMPLING_HARDWARE_BUFFER_APPEND_MODE_KEEP_OLDEST: CUpti_PmSampling_HardwareBuffer_AppendMode = 0;
+pub const CUpti_PmSampling_HardwareBuffer_AppendMode_CUPTI_PM_SAMPLING_HARDWARE_BUFFER_APPEND_MODE_KEEP_LATEST: CUpti_PmSampling_HardwareBuffer_AppendMode = 1;
+pub type CUpti_PmSampling_HardwareBuffer_AppendMode = ::std::os::raw::c_uint;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_SetConfig_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+    pub configSize: usize,
+    pub pConfig: *const u8,
+    pub hardwareBufferSize: usize,
+    pub samplingInterval: u64,
+    pub triggerMode: CUpti_PmSampling_TriggerMode,
+    pub hwBufferAppendMode: CUpti_PmSampling_HardwareBuffer_AppendMode,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_SetConfig_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_SetConfig_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_SetConfig_Params>(),
+        64usize,
+        concat!("Size of: ", stringify!(CUpti_PmSampling_SetConfig_Params))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_SetConfig_Params>(),
+        8usize,
+        concat!(
+            "Alignment of ",
+            stringify!(CUpti_PmSampling_SetConfig_Params)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).configSize) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(configSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pConfig) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(pConfig)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).hardwareBufferSize) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(hardwareBufferSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).samplingInterval) as usize - ptr as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(samplingInterval)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).triggerMode) as usize - ptr as usize },
+        56usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(triggerMode)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).hwBufferAppendMode) as usize - ptr as usize },
+        60usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_SetConfig_Params),
+            "::",
+            stringify!(hwBufferAppendMode)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingSetConfig(pParams: *mut CUpti_PmSampling_SetConfig_Params)
+        -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_Enable_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub deviceIndex: usize,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_Enable_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_Enable_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_Enable_Params>(),
+        32usize,
+        concat!("Size of: ", stringify!(CUpti_PmSampling_Enable_Params))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_Enable_Params>(),
+        8usize,
+        concat!("Alignment of ", stringify!(CUpti_PmSampling_Enable_Params))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Enable_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Enable_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).deviceIndex) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Enable_Params),
+            "::",
+            stringify!(deviceIndex)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Enable_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingEnable(pParams: *mut CUpti_PmSampling_Enable_Params) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_Disable_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_Disable_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_Disable_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_Disable_Params>(),
+        24usize,
+        concat!("Size of: ", stringify!(CUpti_PmSampling_Disable_Params))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_Disable_Params>(),
+        8usize,
+        concat!("Alignment of ", stringify!(CUpti_PmSampling_Disable_Params))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Disable_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Disable_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Disable_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingDisable(pParams: *mut CUpti_PmSampling_Disable_Params) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_Start_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_Start_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_Start_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_Start_Params>(),
+        24usize,
+        concat!("Size of: ", stringify!(CUpti_PmSampling_Start_Params))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_Start_Params>(),
+        8usize,
+        concat!("Alignment of ", stringify!(CUpti_PmSampling_Start_Params))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Start_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Start_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Start_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingStart(pParams: *mut CUpti_PmSampling_Start_Params) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_Stop_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_Stop_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_Stop_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_Stop_Params>(),
+        24usize,
+        concat!("Size of: ", stringify!(CUpti_PmSampling_Stop_Params))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_Stop_Params>(),
+        8usize,
+        concat!("Alignment of ", stringify!(CUpti_PmSampling_Stop_Params))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Stop_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Stop_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_Stop_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingStop(pParams: *mut CUpti_PmSampling_Stop_Params) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_DecodeData_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+    pub pCounterDataImage: *mut u8,
+    pub counterDataImageSize: usize,
+    pub decodeStopReason: CUpti_PmSampling_DecodeStopReason,
+    pub overflow: u8,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_DecodeData_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_DecodeData_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_DecodeData_Params>(),
+        48usize,
+        concat!("Size of: ", stringify!(CUpti_PmSampling_DecodeData_Params))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_DecodeData_Params>(),
+        8usize,
+        concat!(
+            "Alignment of ",
+            stringify!(CUpti_PmSampling_DecodeData_Params)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_DecodeData_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_DecodeData_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_DecodeData_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pCounterDataImage) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_DecodeData_Params),
+            "::",
+            stringify!(pCounterDataImage)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).counterDataImageSize) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_DecodeData_Params),
+            "::",
+            stringify!(counterDataImageSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).decodeStopReason) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_DecodeData_Params),
+            "::",
+            stringify!(decodeStopReason)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).overflow) as usize - ptr as usize },
+        44usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_DecodeData_Params),
+            "::",
+            stringify!(overflow)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingDecodeData(
+        pParams: *mut CUpti_PmSampling_DecodeData_Params,
+    ) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_GetCounterAvailability_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub deviceIndex: usize,
+    pub counterAvailabilityImageSize: usize,
+    pub pCounterAvailabilityImage: *mut u8,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_GetCounterAvailability_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_GetCounterAvailability_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_GetCounterAvailability_Params>(),
+        40usize,
+        concat!(
+            "Size of: ",
+            stringify!(CUpti_PmSampling_GetCounterAvailability_Params)
+        )
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_GetCounterAvailability_Params>(),
+        8usize,
+        concat!(
+            "Alignment of ",
+            stringify!(CUpti_PmSampling_GetCounterAvailability_Params)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterAvailability_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterAvailability_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).deviceIndex) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterAvailability_Params),
+            "::",
+            stringify!(deviceIndex)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            ::std::ptr::addr_of!((*ptr).counterAvailabilityImageSize) as usize - ptr as usize
+        },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterAvailability_Params),
+            "::",
+            stringify!(counterAvailabilityImageSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pCounterAvailabilityImage) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterAvailability_Params),
+            "::",
+            stringify!(pCounterAvailabilityImage)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingGetCounterAvailability(
+        pParams: *mut CUpti_PmSampling_GetCounterAvailability_Params,
+    ) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_GetCounterDataSize_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+    pub pMetricNames: *mut *const ::std::os::raw::c_char,
+    pub numMetrics: usize,
+    pub maxSamples: u64,
+    pub counterDataSize: usize,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_GetCounterDataSize_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_GetCounterDataSize_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_GetCounterDataSize_Params>(),
+        56usize,
+        concat!(
+            "Size of: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params)
+        )
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_GetCounterDataSize_Params>(),
+        8usize,
+        concat!(
+            "Alignment of ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pMetricNames) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params),
+            "::",
+            stringify!(pMetricNames)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).numMetrics) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params),
+            "::",
+            stringify!(numMetrics)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).maxSamples) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params),
+            "::",
+            stringify!(maxSamples)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).counterDataSize) as usize - ptr as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataSize_Params),
+            "::",
+            stringify!(counterDataSize)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingGetCounterDataSize(
+        pParams: *mut CUpti_PmSampling_GetCounterDataSize_Params,
+    ) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_CounterDataImage_Initialize_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+    pub counterDataSize: usize,
+    pub pCounterData: *mut u8,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_CounterDataImage_Initialize_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_CounterDataImage_Initialize_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_CounterDataImage_Initialize_Params>(),
+        40usize,
+        concat!(
+            "Size of: ",
+            stringify!(CUpti_PmSampling_CounterDataImage_Initialize_Params)
+        )
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_CounterDataImage_Initialize_Params>(),
+        8usize,
+        concat!(
+            "Alignment of ",
+            stringify!(CUpti_PmSampling_CounterDataImage_Initialize_Params)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterDataImage_Initialize_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterDataImage_Initialize_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterDataImage_Initialize_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).counterDataSize) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterDataImage_Initialize_Params),
+            "::",
+            stringify!(counterDataSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pCounterData) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterDataImage_Initialize_Params),
+            "::",
+            stringify!(pCounterData)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingCounterDataImageInitialize(
+        pParams: *mut CUpti_PmSampling_CounterDataImage_Initialize_Params,
+    ) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_GetCounterDataInfo_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pCounterDataImage: *const u8,
+    pub counterDataImageSize: usize,
+    pub numTotalSamples: usize,
+    pub numPopulatedSamples: usize,
+    pub numCompletedSamples: usize,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_GetCounterDataInfo_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_GetCounterDataInfo_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_GetCounterDataInfo_Params>(),
+        56usize,
+        concat!(
+            "Size of: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params)
+        )
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_GetCounterDataInfo_Params>(),
+        8usize,
+        concat!(
+            "Alignment of ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pCounterDataImage) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params),
+            "::",
+            stringify!(pCounterDataImage)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).counterDataImageSize) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params),
+            "::",
+            stringify!(counterDataImageSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).numTotalSamples) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params),
+            "::",
+            stringify!(numTotalSamples)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).numPopulatedSamples) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params),
+            "::",
+            stringify!(numPopulatedSamples)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).numCompletedSamples) as usize - ptr as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_GetCounterDataInfo_Params),
+            "::",
+            stringify!(numCompletedSamples)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingGetCounterDataInfo(
+        pParams: *mut CUpti_PmSampling_GetCounterDataInfo_Params,
+    ) -> CUptiResult;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct CUpti_PmSampling_CounterData_GetSampleInfo_Params {
+    pub structSize: usize,
+    pub pPriv: *mut ::std::os::raw::c_void,
+    pub pPmSamplingObject: *mut CUpti_PmSampling_Object,
+    pub pCounterDataImage: *const u8,
+    pub counterDataImageSize: usize,
+    pub sampleIndex: usize,
+    pub startTimestamp: u64,
+    pub endTimestamp: u64,
+}
+#[test]
+fn bindgen_test_layout_CUpti_PmSampling_CounterData_GetSampleInfo_Params() {
+    const UNINIT: ::std::mem::MaybeUninit<CUpti_PmSampling_CounterData_GetSampleInfo_Params> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<CUpti_PmSampling_CounterData_GetSampleInfo_Params>(),
+        64usize,
+        concat!(
+            "Size of: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params)
+        )
+    );
+    assert_eq!(
+        ::std::mem::align_of::<CUpti_PmSampling_CounterData_GetSampleInfo_Params>(),
+        8usize,
+        concat!(
+            "Alignment of ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).structSize) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(structSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPriv) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(pPriv)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pPmSamplingObject) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(pPmSamplingObject)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).pCounterDataImage) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(pCounterDataImage)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).counterDataImageSize) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(counterDataImageSize)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).sampleIndex) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(sampleIndex)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).startTimestamp) as usize - ptr as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(startTimestamp)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).endTimestamp) as usize - ptr as usize },
+        56usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(CUpti_PmSampling_CounterData_GetSampleInfo_Params),
+            "::",
+            stringify!(endTimestamp)
+        )
+    );
+}
+extern "C" {
+    pub fn cuptiPmSamplingCounterDataGetSampleInfo(
+        pParams: *mut CUpti_PmSampling_CounterData_GetSampleInfo_Params,
+    ) -> CUptiResult;
+}
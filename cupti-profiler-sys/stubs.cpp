@@ -12,14 +12,31 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// The stubs double as a small CUPTI simulator for load testing on hosts
+// without a GPU. It is configured with environment variables, all of which
+// default to zero:
+//
+// - CUPTI_STUB_KERNEL_RATE: kernel activity records generated per second of
+//   wall clock time while kernel activity is enabled, delivered through the
+//   registered buffer callbacks on every activity flush.
+// - CUPTI_STUB_RANGES: ranges reported in every decoded counter data image.
+// - CUPTI_STUB_DECODE_LATENCY_US: time spent in each counter data decode.
+// - CUPTI_STUB_EVALUATE_LATENCY_US: time spent evaluating each range.
+
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <chrono>
+#include <mutex>
+#include <thread>
+
 // Dummy types for stubs to avoid CUDA header dependency
 typedef int CUresult;
 typedef int CUptiResult;
 typedef int CUdevice;
-typedef int CUcontext;
+typedef struct CUctx_st *CUcontext;
 typedef int CUfunction;
 typedef int CUdevice_attribute;
 typedef int CUfunction_attribute;
@@ -29,20 +46,173 @@ typedef int CUpti_CallbackId;
 
 #define CUDA_SUCCESS 0
 #define CUPTI_SUCCESS 0
+#define CUPTI_ERROR_MAX_LIMIT_REACHED 12
+#define CUPTI_ACTIVITY_KIND_KERNEL 3
+#define CUPTI_PM_SAMPLING_DECODE_STOP_REASON_END_OF_RECORDS 2
 
+// The structs below that the stubs read or write follow the CUPTI layout.
 typedef struct {
-  void *pCounterAvailabilityImage;
+  size_t structSize;
+  void *pPriv;
+  CUcontext ctx;
   size_t counterAvailabilityImageSize;
+  uint8_t *pCounterAvailabilityImage;
+  bool bAllowDeviceLevelCounters;
 } CUpti_Profiler_GetCounterAvailability_Params;
 
 typedef struct {
+  size_t structSize;
+  void *pPriv;
+  void *pHostObject;
   size_t configImageSize;
 } CUpti_Profiler_Host_GetConfigImageSize_Params;
 
 typedef struct {
+  size_t structSize;
+  void *pPriv;
+  void *pRangeProfilerObject;
+  const char **pMetricNames;
+  size_t numMetrics;
+  size_t maxNumOfRanges;
+  uint32_t maxNumRangeTreeNodes;
   size_t counterDataSize;
 } CUpti_RangeProfiler_GetCounterDataSize_Params;
 
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  size_t deviceIndex;
+  const char *pChipName;
+} CUpti_Device_GetChipName_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  void *pRangeProfilerObject;
+  size_t numOfRangeDropped;
+} CUpti_RangeProfiler_DecodeData_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  const uint8_t *pCounterDataImage;
+  size_t counterDataImageSize;
+  size_t numTotalRanges;
+} CUpti_RangeProfiler_GetCounterDataInfo_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  const uint8_t *pCounterDataImage;
+  size_t counterDataImageSize;
+  size_t rangeIndex;
+  const char *rangeDelimiter;
+  const char *rangeName;
+} CUpti_RangeProfiler_CounterData_GetRangeInfo_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  void *pHostObject;
+  const uint8_t *pCounterDataImage;
+  size_t counterDataImageSize;
+  size_t rangeIndex;
+  const char **ppMetricNames;
+  size_t numMetrics;
+  double *pMetricValues;
+} CUpti_Profiler_Host_EvaluateToGpuValues_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  size_t deviceIndex;
+  size_t counterAvailabilityImageSize;
+  uint8_t *pCounterAvailabilityImage;
+} CUpti_PmSampling_GetCounterAvailability_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  void *pPmSamplingObject;
+  const char **pMetricNames;
+  size_t numMetrics;
+  uint64_t maxSamples;
+  size_t counterDataSize;
+} CUpti_PmSampling_GetCounterDataSize_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  void *pPmSamplingObject;
+  uint8_t *pCounterDataImage;
+  size_t counterDataImageSize;
+  uint32_t decodeStopReason;
+  uint8_t overflow;
+} CUpti_PmSampling_DecodeData_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  const uint8_t *pCounterDataImage;
+  size_t counterDataImageSize;
+  size_t numTotalSamples;
+  size_t numPopulatedSamples;
+  size_t numCompletedSamples;
+} CUpti_PmSampling_GetCounterDataInfo_Params;
+
+typedef struct {
+  size_t structSize;
+  void *pPriv;
+  void *pPmSamplingObject;
+  const uint8_t *pCounterDataImage;
+  size_t counterDataImageSize;
+  size_t sampleIndex;
+  uint64_t startTimestamp;
+  uint64_t endTimestamp;
+} CUpti_PmSampling_CounterData_GetSampleInfo_Params;
+
+// CUpti_ActivityKernel5, the record version the injection parses.
+typedef struct {
+  uint32_t kind;
+  uint8_t cacheConfig;
+  uint8_t sharedMemoryConfig;
+  uint16_t registersPerThread;
+  uint32_t partitionedGlobalCacheRequested;
+  uint32_t partitionedGlobalCacheExecuted;
+  uint64_t start;
+  uint64_t end;
+  uint64_t completed;
+  uint32_t deviceId;
+  uint32_t contextId;
+  uint32_t streamId;
+  int32_t gridX;
+  int32_t gridY;
+  int32_t gridZ;
+  int32_t blockX;
+  int32_t blockY;
+  int32_t blockZ;
+  int32_t staticSharedMemory;
+  int32_t dynamicSharedMemory;
+  uint32_t localMemoryPerThread;
+  uint32_t localMemoryTotal;
+  uint32_t correlationId;
+  int64_t gridId;
+  const char *name;
+  void *reserved0;
+  uint64_t queued;
+  uint64_t submitted;
+  uint8_t launchType;
+  uint8_t isSharedMemoryCarveoutRequested;
+  uint8_t sharedMemoryCarveoutRequested;
+  uint8_t padding;
+  uint32_t sharedMemoryExecuted;
+  uint64_t graphNodeId;
+  uint32_t shmemLimitConfig;
+  uint32_t graphId;
+} CUpti_ActivityKernel5;
+static_assert(sizeof(CUpti_ActivityKernel5) == 160,
+              "CUpti_ActivityKernel5 layout");
+
 // Opaque pointers for other structs
 typedef void CUpti_Profiler_Initialize_Params;
 typedef void CUpti_Profiler_DeInitialize_Params;
@@ -50,32 +220,193 @@ typedef void CUpti_Profiler_Host_Initialize_Params;
 typedef void CUpti_Profiler_Host_Deinitialize_Params;
 typedef void CUpti_Profiler_Host_ConfigAddMetrics_Params;
 typedef void CUpti_Profiler_Host_GetConfigImage_Params;
-typedef void CUpti_Profiler_Host_EvaluateToGpuValues_Params;
-typedef void CUpti_Device_GetChipName_Params;
+typedef void CUpti_Profiler_Host_GetNumOfPasses_Params;
 typedef void CUpti_RangeProfiler_Enable_Params;
 typedef void CUpti_RangeProfiler_Disable_Params;
 typedef void CUpti_RangeProfiler_Start_Params;
 typedef void CUpti_RangeProfiler_Stop_Params;
 typedef void CUpti_RangeProfiler_SetConfig_Params;
+typedef void CUpti_RangeProfiler_PushRange_Params;
+typedef void CUpti_RangeProfiler_PopRange_Params;
 typedef void CUpti_RangeProfiler_CounterDataImage_Initialize_Params;
-typedef void CUpti_RangeProfiler_DecodeData_Params;
-typedef void CUpti_RangeProfiler_GetCounterDataInfo_Params;
-typedef void CUpti_RangeProfiler_CounterData_GetRangeInfo_Params;
+typedef void CUpti_PmSampling_Enable_Params;
+typedef void CUpti_PmSampling_Disable_Params;
+typedef void CUpti_PmSampling_Start_Params;
+typedef void CUpti_PmSampling_Stop_Params;
+typedef void CUpti_PmSampling_SetConfig_Params;
+typedef void CUpti_PmSampling_CounterDataImage_Initialize_Params;
 typedef void *CUpti_SubscriberHandle;
 typedef void (*CUpti_CallbackFunc)(void *userdata, CUpti_CallbackDomain domain,
                                    CUpti_CallbackId cbid, const void *cbdata);
 typedef void (*CUpti_BuffersCallbackRequestFunc)(uint8_t **buffer, size_t *size,
                                                  size_t *maxNumRecords);
-typedef void (*CUpti_BuffersCallbackCompleteFunc)(uint8_t *buffer, size_t size,
+typedef void (*CUpti_BuffersCallbackCompleteFunc)(CUcontext context,
+                                                  uint32_t streamId,
+                                                  uint8_t *buffer, size_t size,
                                                   size_t validSize);
 typedef void CUpti_Activity;
 
+namespace {
+
+struct SimulatorConfig {
+  uint64_t kernel_rate;
+  uint64_t ranges;
+  uint64_t decode_latency_us;
+  uint64_t evaluate_latency_us;
+};
+
+uint64_t EnvU64(const char *name) {
+  const char *value = getenv(name);
+  return value ? strtoull(value, NULL, 10) : 0;
+}
+
+const SimulatorConfig &Config() {
+  static const SimulatorConfig config = {
+      EnvU64("CUPTI_STUB_KERNEL_RATE"),
+      EnvU64("CUPTI_STUB_RANGES"),
+      EnvU64("CUPTI_STUB_DECODE_LATENCY_US"),
+      EnvU64("CUPTI_STUB_EVALUATE_LATENCY_US"),
+  };
+  return config;
+}
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Spins rather than sleeps, as decode and evaluate are CPU bound in CUPTI.
+void SpinFor(uint64_t us) {
+  uint64_t end = NowNs() + us * 1000;
+  while (NowNs() < end) {
+  }
+}
+
+// Cheap deterministic hash used for synthetic kernel and metric values.
+uint64_t Mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+const char *const kKernelNames[] = {
+    "_Z6vecAddPKfS0_Pfi",
+    "_Z9reductionILi256EEvPKfPfi",
+    "_Z10transposeTPfPKfii",
+    "_Z4gemmILi128ELi128ELi8EEvPKfS1_Pfiii",
+};
+const int kNumKernelNames = sizeof(kKernelNames) / sizeof(kKernelNames[0]);
+
+// Cap on the records generated by one flush, so a long gap between flushes
+// does not stall the caller.
+const uint64_t kMaxRecordsPerFlush = 1 << 20;
+
+struct ActivitySimulator {
+  std::mutex mutex;
+  CUpti_BuffersCallbackRequestFunc request = NULL;
+  CUpti_BuffersCallbackCompleteFunc complete = NULL;
+  uint64_t generated_until_ns = 0;
+  uint32_t next_correlation_id = 1;
+  bool kernels_enabled = false;
+  bool flush_thread_started = false;
+
+  void FillRecord(CUpti_ActivityKernel5 *r, uint64_t start_ns,
+                  uint64_t duration_ns) {
+    uint32_t correlation_id = next_correlation_id++;
+    uint64_t hash = Mix(correlation_id);
+    memset(r, 0, sizeof(*r));
+    r->kind = CUPTI_ACTIVITY_KIND_KERNEL;
+    r->registersPerThread = 16 + 8 * (hash % 8);
+    r->start = start_ns;
+    r->end = start_ns + duration_ns;
+    r->completed = r->end;
+    r->contextId = 1;
+    r->streamId = 7;
+    r->gridX = 1 << (hash % 12);
+    r->gridY = 1;
+    r->gridZ = 1;
+    r->blockX = 32 << ((hash >> 8) % 6);
+    r->blockY = 1;
+    r->blockZ = 1;
+    r->staticSharedMemory = 1024 * ((hash >> 16) % 16);
+    r->sharedMemoryExecuted = 100 * 1024;
+    r->correlationId = correlation_id;
+    r->gridId = correlation_id;
+    r->name = kKernelNames[(hash >> 24) % kNumKernelNames];
+    r->queued = start_ns;
+    r->submitted = start_ns;
+  }
+
+  // Delivers the records due since the previous flush at the configured rate,
+  // spread evenly over that interval.
+  void Flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t rate = Config().kernel_rate;
+    uint64_t now = NowNs();
+    if (rate == 0 || !kernels_enabled || request == NULL || complete == NULL) {
+      generated_until_ns = now;
+      return;
+    }
+    if (generated_until_ns == 0) generated_until_ns = now;
+    uint64_t interval_ns = 1000000000ull / rate;
+    if (interval_ns == 0) interval_ns = 1;
+    uint64_t due = (now - generated_until_ns) / interval_ns;
+    if (due > kMaxRecordsPerFlush) {
+      due = kMaxRecordsPerFlush;
+      generated_until_ns = now - due * interval_ns;
+    }
+    while (due > 0) {
+      uint8_t *buffer = NULL;
+      size_t size = 0;
+      size_t max_num_records = 0;
+      request(&buffer, &size, &max_num_records);
+      size_t capacity = size / sizeof(CUpti_ActivityKernel5);
+      if (buffer == NULL || capacity == 0) break;
+      size_t count = due < capacity ? due : capacity;
+      CUpti_ActivityKernel5 *records =
+          reinterpret_cast<CUpti_ActivityKernel5 *>(buffer);
+      for (size_t i = 0; i < count; i++) {
+        FillRecord(&records[i], generated_until_ns, interval_ns * 3 / 4);
+        generated_until_ns += interval_ns;
+      }
+      due -= count;
+      complete(NULL, 0, buffer, size, count * sizeof(CUpti_ActivityKernel5));
+    }
+  }
+
+  void StartFlushThread(uint32_t period_ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (flush_thread_started || period_ms == 0) return;
+    flush_thread_started = true;
+    std::thread([this, period_ms] {
+      for (;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(period_ms));
+        Flush();
+      }
+    }).detach();
+  }
+};
+
+ActivitySimulator &Activity() {
+  // Never destroyed, so the flush thread can outlive static destructors.
+  static ActivitySimulator *simulator = new ActivitySimulator();
+  return *simulator;
+}
+
+}  // namespace
+
 // Define stubs for CUDA/CUPTI functions used in Rust
 
 extern "C" {
 
+CUresult cuCtxGetCurrent(CUcontext *pctx) {
+  *pctx = NULL;
+  return CUDA_SUCCESS;
+}
 CUresult cuCtxGetDevice(CUdevice *device) {
-  (void)device;
+  *device = 0;
   return CUDA_SUCCESS;
 }
 CUresult cuDeviceGetAttribute(int *pi, CUdevice_attribute attrib,
@@ -138,21 +469,30 @@ CUptiResult cuptiProfilerHostGetConfigImage(
   (void)pParams;
   return CUPTI_SUCCESS;
 }
+CUptiResult cuptiProfilerHostGetNumOfPasses(
+    CUpti_Profiler_Host_GetNumOfPasses_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
 CUptiResult cuptiProfilerHostEvaluateToGpuValues(
     CUpti_Profiler_Host_EvaluateToGpuValues_Params *pParams) {
-  (void)pParams;
+  SpinFor(Config().evaluate_latency_us);
+  for (size_t i = 0; i < pParams->numMetrics; i++) {
+    uint64_t hash = Mix(pParams->rangeIndex * 1024 + i);
+    pParams->pMetricValues[i] = static_cast<double>(hash % 100000) / 1000.0;
+  }
   return CUPTI_SUCCESS;
 }
 
 CUptiResult cuptiDeviceGetChipName(CUpti_Device_GetChipName_Params *pParams) {
   // Mock chip name
-  (void)pParams;
+  pParams->pChipName = "stub";
   return CUPTI_SUCCESS;
 }
 
 CUptiResult cuptiProfilerGetCounterAvailability(
     CUpti_Profiler_GetCounterAvailability_Params *pParams) {
-  if (pParams->pCounterAvailabilityImage == 0) {
+  if (pParams->pCounterAvailabilityImage == NULL) {
     pParams->counterAvailabilityImageSize = 100;
   }
   return CUPTI_SUCCESS;
@@ -176,6 +516,16 @@ CUptiResult cuptiRangeProfilerStop(CUpti_RangeProfiler_Stop_Params *pParams) {
   (void)pParams;
   return CUPTI_SUCCESS;
 }
+CUptiResult cuptiRangeProfilerPushRange(
+    CUpti_RangeProfiler_PushRange_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiRangeProfilerPopRange(
+    CUpti_RangeProfiler_PopRange_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
 CUptiResult cuptiRangeProfilerSetConfig(
     CUpti_RangeProfiler_SetConfig_Params *pParams) {
   (void)pParams;
@@ -193,19 +543,84 @@ CUptiResult cuptiRangeProfilerCounterDataImageInitialize(
 }
 CUptiResult cuptiRangeProfilerDecodeData(
     CUpti_RangeProfiler_DecodeData_Params *pParams) {
-  (void)pParams;
+  SpinFor(Config().decode_latency_us);
+  pParams->numOfRangeDropped = 0;
   return CUPTI_SUCCESS;
 }
 CUptiResult cuptiRangeProfilerGetCounterDataInfo(
     CUpti_RangeProfiler_GetCounterDataInfo_Params *pParams) {
-  (void)pParams;
+  pParams->numTotalRanges = Config().ranges;
   return CUPTI_SUCCESS;
 }
 CUptiResult cuptiRangeProfilerCounterDataGetRangeInfo(
     CUpti_RangeProfiler_CounterData_GetRangeInfo_Params *pParams) {
+  // Valid until the next call on this thread.
+  static thread_local char name[32];
+  snprintf(name, sizeof(name), "range%zu", pParams->rangeIndex);
+  pParams->rangeName = name;
+  return CUPTI_SUCCESS;
+}
+
+CUptiResult cuptiPmSamplingGetCounterAvailability(
+    CUpti_PmSampling_GetCounterAvailability_Params *pParams) {
+  if (pParams->pCounterAvailabilityImage == NULL) {
+    pParams->counterAvailabilityImageSize = 100;
+  }
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingEnable(CUpti_PmSampling_Enable_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingDisable(CUpti_PmSampling_Disable_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingStart(CUpti_PmSampling_Start_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingStop(CUpti_PmSampling_Stop_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingSetConfig(
+    CUpti_PmSampling_SetConfig_Params *pParams) {
+  (void)pParams;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingGetCounterDataSize(
+    CUpti_PmSampling_GetCounterDataSize_Params *pParams) {
+  pParams->counterDataSize = 100;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingCounterDataImageInitialize(
+    CUpti_PmSampling_CounterDataImage_Initialize_Params *pParams) {
   (void)pParams;
   return CUPTI_SUCCESS;
 }
+CUptiResult cuptiPmSamplingDecodeData(
+    CUpti_PmSampling_DecodeData_Params *pParams) {
+  SpinFor(Config().decode_latency_us);
+  pParams->decodeStopReason =
+      CUPTI_PM_SAMPLING_DECODE_STOP_REASON_END_OF_RECORDS;
+  pParams->overflow = 0;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingGetCounterDataInfo(
+    CUpti_PmSampling_GetCounterDataInfo_Params *pParams) {
+  // The simulator never produces samples.
+  pParams->numTotalSamples = 0;
+  pParams->numPopulatedSamples = 0;
+  pParams->numCompletedSamples = 0;
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiPmSamplingCounterDataGetSampleInfo(
+    CUpti_PmSampling_CounterData_GetSampleInfo_Params *pParams) {
+  pParams->startTimestamp = pParams->sampleIndex * 1000;
+  pParams->endTimestamp = pParams->startTimestamp + 1000;
+  return CUPTI_SUCCESS;
+}
 
 CUptiResult cuptiGetContextId(CUcontext context, uint32_t *contextId) {
   (void)context;
@@ -246,26 +661,56 @@ CUptiResult cuptiEnableDomain(uint32_t enable,
 }
 
 CUptiResult cuptiActivityEnable(CUpti_ActivityKind kind) {
-  (void)kind;
+  if (kind == CUPTI_ACTIVITY_KIND_KERNEL) {
+    std::lock_guard<std::mutex> lock(Activity().mutex);
+    Activity().kernels_enabled = true;
+    Activity().generated_until_ns = NowNs();
+  }
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiActivityDisable(CUpti_ActivityKind kind) {
+  if (kind == CUPTI_ACTIVITY_KIND_KERNEL) {
+    std::lock_guard<std::mutex> lock(Activity().mutex);
+    Activity().kernels_enabled = false;
+  }
   return CUPTI_SUCCESS;
 }
 CUptiResult cuptiActivityRegisterCallbacks(
     CUpti_BuffersCallbackRequestFunc funcBufferRequested,
     CUpti_BuffersCallbackCompleteFunc funcBufferCompleted) {
-  (void)funcBufferRequested;
-  (void)funcBufferCompleted;
+  std::lock_guard<std::mutex> lock(Activity().mutex);
+  Activity().request = funcBufferRequested;
+  Activity().complete = funcBufferCompleted;
+  Activity().generated_until_ns = NowNs();
   return CUPTI_SUCCESS;
 }
 CUptiResult cuptiActivityFlushAll(uint32_t flag) {
   (void)flag;
+  Activity().Flush();
   return CUPTI_SUCCESS;
 }
+CUptiResult cuptiActivityFlushPeriod(uint32_t time) {
+  Activity().StartFlushThread(time);
+  return CUPTI_SUCCESS;
+}
+CUptiResult cuptiGetTimestamp(uint64_t *timestamp) {
+  if (timestamp) *timestamp = NowNs();
+  return CUPTI_SUCCESS;
+}
+// Buffers hold only kernel records, packed back to back.
 CUptiResult cuptiActivityGetNextRecord(uint8_t *buffer,
                                        size_t validBufferSizeBytes,
                                        CUpti_Activity **record) {
-  (void)buffer;
-  (void)validBufferSizeBytes;
-  (void)record;
+  uint8_t *next = buffer;
+  if (*record != NULL) {
+    next = static_cast<uint8_t *>(*record) + sizeof(CUpti_ActivityKernel5);
+  }
+  if (buffer == NULL ||
+      next + sizeof(CUpti_ActivityKernel5) > buffer + validBufferSizeBytes) {
+    *record = NULL;
+    return CUPTI_ERROR_MAX_LIMIT_REACHED;
+  }
+  *record = next;
   return CUPTI_SUCCESS;
 }
 }
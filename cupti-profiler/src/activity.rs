@@ -20,6 +20,12 @@ pub fn activity_enable(kind: CUpti_ActivityKind) -> Result<(), CUptiResult> {
     Ok(())
 }
 
+/// Disables a CUPTI activity kind.
+pub fn activity_disable(kind: CUpti_ActivityKind) -> Result<(), CUptiResult> {
+    check_cupti!(unsafe { cuptiActivityDisable(kind) });
+    Ok(())
+}
+
 /// Registers callbacks for CUPTI activity buffering.
 /// # Safety
 ///
@@ -38,6 +44,22 @@ pub fn activity_flush_all(flag: u32) -> Result<(), CUptiResult> {
     Ok(())
 }
 
+/// Sets the period, in milliseconds, at which CUPTI flushes completed activity buffers.
+///
+/// A period of zero disables periodic flushing.
+pub fn activity_flush_period(period_ms: u32) -> Result<(), CUptiResult> {
+    check_cupti!(unsafe { cuptiActivityFlushPeriod(period_ms) });
+    Ok(())
+}
+
+/// Returns the current CUPTI timestamp in nanoseconds, on the clock used by
+/// activity records.
+pub fn get_timestamp() -> Result<u64, CUptiResult> {
+    let mut timestamp: u64 = 0;
+    check_cupti!(unsafe { cuptiGetTimestamp(&mut timestamp) });
+    Ok(timestamp)
+}
+
 /// Retrieves the next activity record from a buffer.
 /// # Safety
 ///
@@ -53,3 +75,30 @@ pub unsafe fn activity_get_next_record(
     }
     Ok(())
 }
+
+#[cfg(all(test, feature = "stubs"))]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_get_next_record_walks_kernel_records() {
+        let mut records: Vec<CUpti_ActivityKernel5> = (0..3)
+            .map(|i| {
+                let mut record: CUpti_ActivityKernel5 = unsafe { std::mem::zeroed() };
+                record.kind = CUpti_ActivityKind_CUPTI_ACTIVITY_KIND_KERNEL;
+                record.correlationId = i;
+                record
+            })
+            .collect();
+        let buffer = records.as_mut_ptr() as *mut u8;
+        let valid_size = std::mem::size_of_val(records.as_slice());
+        let mut record: *mut CUpti_Activity = std::ptr::null_mut();
+        let mut correlation_ids = Vec::new();
+        while unsafe { activity_get_next_record(buffer, valid_size, &mut record) }.is_ok() {
+            let kernel = unsafe { &*(record as *const CUpti_ActivityKernel5) };
+            correlation_ids.push(kernel.correlationId);
+        }
+        assert_eq!(correlation_ids, vec![0, 1, 2]);
+        assert!(record.is_null());
+    }
+}
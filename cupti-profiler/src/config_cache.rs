@@ -0,0 +1,211 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::bindings::*;
+use crate::metric_evaluator::SharedEvaluator;
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::sync::{Arc, Mutex, OnceLock};
+
+/// Identifies a config image: the chip it targets and the metrics it collects.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+pub struct ConfigKey {
+    pub chip_name: String,
+    pub metric_names: Vec<String>,
+}
+
+impl ConfigKey {
+    pub fn new(chip_name: &str, metric_names: &[String]) -> Self {
+        Self {
+            chip_name: chip_name.to_string(),
+            metric_names: metric_names.to_vec(),
+        }
+    }
+}
+
+/// Process-wide cache of profiler setup results.
+///
+/// Building a config image requires a `ProfilerHost` and the counter availability
+/// image of the device, which is expensive. The result only depends on the chip
+/// and the metric list, so it is shared by every range profiler that needs it.
+#[derive(Default)]
+pub struct ConfigCache {
+    chip_names: Mutex<HashMap<usize, String>>,
+    config_images: Mutex<HashMap<ConfigKey, Arc<Vec<u8>>>>,
+    counter_data_sizes: Mutex<HashMap<(ConfigKey, usize), usize>>,
+    metric_groups: Mutex<HashMap<(ConfigKey, Vec<String>), Arc<Vec<Vec<String>>>>>,
+    evaluators: Mutex<HashMap<String, Arc<SharedEvaluator>>>,
+}
+
+impl ConfigCache {
+    /// Returns the process-wide cache.
+    pub fn global() -> &'static ConfigCache {
+        static CACHE: OnceLock<ConfigCache> = OnceLock::new();
+        CACHE.get_or_init(ConfigCache::default)
+    }
+
+    /// Returns the chip name of `device_index`, calling `query` on first use.
+    pub fn chip_name(
+        &self,
+        device_index: usize,
+        query: impl FnOnce() -> Result<String, CUptiResult>,
+    ) -> Result<String, CUptiResult> {
+        get_or_try_insert(&self.chip_names, device_index, query)
+    }
+
+    /// Returns the config image for `key`, calling `build` on first use.
+    pub fn config_image(
+        &self,
+        key: &ConfigKey,
+        build: impl FnOnce() -> Result<Vec<u8>, CUptiResult>,
+    ) -> Result<Arc<Vec<u8>>, CUptiResult> {
+        get_or_try_insert(&self.config_images, key.clone(), || build().map(Arc::new))
+    }
+
+    /// Returns the counter data image size for `key` and `max_num_ranges`,
+    /// calling `query` on first use.
+    pub fn counter_data_size(
+        &self,
+        key: &ConfigKey,
+        max_num_ranges: usize,
+        query: impl FnOnce() -> Result<usize, CUptiResult>,
+    ) -> Result<usize, CUptiResult> {
+        get_or_try_insert(
+            &self.counter_data_sizes,
+            (key.clone(), max_num_ranges),
+            query,
+        )
+    }
+
+    /// Returns the single-pass metric groups for `key` with the `pinned` metrics
+    /// in every group, calling `split` on first use.
+    pub fn metric_groups(
+        &self,
+        key: &ConfigKey,
+        pinned: &[String],
+        split: impl FnOnce() -> Result<Vec<Vec<String>>, CUptiResult>,
+    ) -> Result<Arc<Vec<Vec<String>>>, CUptiResult> {
+        get_or_try_insert(&self.metric_groups, (key.clone(), pinned.to_vec()), || {
+            split().map(Arc::new)
+        })
+    }
+
+    /// Returns the evaluator shared by the contexts on `chip_name`, calling
+    /// `counter_availability` for the image its host is set up with on first use.
+    pub fn evaluator(
+        &self,
+        chip_name: &str,
+        counter_availability: impl FnOnce() -> Result<Vec<u8>, CUptiResult>,
+    ) -> Result<Arc<SharedEvaluator>, CUptiResult> {
+        get_or_try_insert(&self.evaluators, chip_name.to_string(), || {
+            let image = counter_availability()?;
+            Ok(Arc::new(SharedEvaluator::new(chip_name.to_string(), image)))
+        })
+    }
+}
+
+/// Looks up `key`, inserting the result of `create` if it is missing.
+///
+/// The lock is not held while `create` runs, so a slow CUPTI call does not block
+/// lookups of other keys. Errors are not cached.
+fn get_or_try_insert<K: Eq + Hash, V: Clone>(
+    map: &Mutex<HashMap<K, V>>,
+    key: K,
+    create: impl FnOnce() -> Result<V, CUptiResult>,
+) -> Result<V, CUptiResult> {
+    if let Some(value) = map.lock().ok().and_then(|map| map.get(&key).cloned()) {
+        return Ok(value);
+    }
+    let value = create()?;
+    if let Ok(mut map) = map.lock() {
+        return Ok(map.entry(key).or_insert(value).clone());
+    }
+    Ok(value)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_config_image_built_once_per_key() {
+        let cache = ConfigCache::default();
+        let metrics = vec!["gpu__time_duration.sum".to_string()];
+        let key = ConfigKey::new("GA100", &metrics);
+        let mut builds = 0;
+        for _ in 0..3 {
+            let image = cache
+                .config_image(&key, || {
+                    builds += 1;
+                    Ok(vec![1, 2, 3])
+                })
+                .unwrap();
+            assert_eq!(*image, vec![1, 2, 3]);
+        }
+        assert_eq!(builds, 1);
+
+        let other = ConfigKey::new("AD102", &metrics);
+        let image = cache.config_image(&other, || Ok(vec![4])).unwrap();
+        assert_eq!(*image, vec![4]);
+    }
+
+    #[test]
+    fn test_errors_are_not_cached() {
+        let cache = ConfigCache::default();
+        let key = ConfigKey::new("GA100", &[]);
+        assert!(cache
+            .counter_data_size(&key, 32, || Err(CUptiResult_CUPTI_ERROR_UNKNOWN))
+            .is_err());
+        assert_eq!(cache.counter_data_size(&key, 32, || Ok(1024)), Ok(1024));
+        assert_eq!(cache.counter_data_size(&key, 32, || Ok(0)), Ok(1024));
+        assert_eq!(cache.counter_data_size(&key, 64, || Ok(2048)), Ok(2048));
+        // Groups split with other pinned metrics are separate entries.
+        let groups = |pinned: &[String], group: &str| {
+            cache.metric_groups(&key, pinned, || Ok(vec![vec![group.to_string()]]))
+        };
+        assert_eq!(*groups(&[], "a").unwrap(), vec![vec!["a".to_string()]]);
+        let pinned = ["t".to_string()];
+        assert_eq!(*groups(&pinned, "t").unwrap(), vec![vec!["t".to_string()]]);
+        assert_eq!(*groups(&[], "b").unwrap(), vec![vec!["a".to_string()]]);
+    }
+
+    #[test]
+    fn test_evaluator_shared_per_chip() {
+        let cache = ConfigCache::default();
+        let first = cache.evaluator("GA100", || Ok(vec![1])).unwrap();
+        let second = cache
+            .evaluator("GA100", || panic!("queried twice"))
+            .unwrap();
+        assert!(Arc::ptr_eq(&first, &second));
+        let other = cache.evaluator("AD102", || Ok(vec![2])).unwrap();
+        assert!(!Arc::ptr_eq(&first, &other));
+        assert_eq!(other.counter_availability_image(), &[2]);
+        first.setup_in_background();
+        first.setup_in_background();
+        assert!(first.get().is_ok());
+        assert!(std::ptr::eq(first.get().unwrap(), second.get().unwrap()));
+        let metrics = vec!["gpu__time_duration.sum".to_string()];
+        let groups = loop {
+            match first.metric_groups(&metrics) {
+                Some(groups) => break groups.unwrap(),
+                None => std::thread::yield_now(),
+            }
+        };
+        assert_eq!(*groups, vec![metrics.clone()]);
+        assert!(Arc::ptr_eq(
+            &first.metric_groups(&metrics).unwrap().unwrap(),
+            &groups
+        ));
+    }
+}
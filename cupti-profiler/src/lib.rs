@@ -32,8 +32,20 @@ pub use subscriber::*;
 pub mod profiler;
 pub use profiler::*;
 
+pub mod config_cache;
+pub use config_cache::*;
+
+pub mod pass_groups;
+pub use pass_groups::*;
+
 pub mod range_profiler;
 pub use range_profiler::*;
 
+pub mod pm_sampler;
+pub use pm_sampler::*;
+
 pub mod metric_evaluator;
 pub use metric_evaluator::*;
+
+pub mod metric_set;
+pub use metric_set::*;
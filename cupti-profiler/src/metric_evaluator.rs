@@ -13,21 +13,18 @@
 // limitations under the License.
 
 use crate::bindings::*;
+use crate::config_cache::ConfigCache;
+use crate::metric_set::{MetricSet, RangeValues};
+use crate::pass_groups::chip_metric_groups;
 use crate::profiler::{get_chip_name, get_counter_availability_image, Profiler, ProfilerHost};
+use std::collections::HashMap;
 use std::ffi::{CStr, CString};
 use std::os::raw::c_char;
-
-/// Represents a single metric value.
-pub struct MetricValuePair {
-    pub metric_name: String,
-    pub value: f64,
-}
-
-/// Contains profiling results for a specific range.
-pub struct RangeInfo {
-    pub range_name: String,
-    pub metric_and_values: Vec<MetricValuePair>,
-}
+use std::sync::{
+    atomic::{AtomicBool, Ordering},
+    Arc, Mutex, OnceLock,
+};
+use std::thread;
 
 /// High-level evaluator to extract metrics from counter data.
 pub struct MetricEvaluator {
@@ -89,55 +86,173 @@ impl MetricEvaluator {
         Ok(c_str.to_string_lossy().into_owned())
     }
 
+    /// Evaluates the metrics of one range into `values`, indexed by metric id.
     pub fn evaluate_metrics_for_range(
         &self,
         counter_data_image: &[u8],
-        metric_names: &[String],
+        metrics: &MetricSet,
         range_index: usize,
-    ) -> Result<Vec<f64>, CUptiResult> {
-        let c_metric_names: Vec<CString> = metric_names
-            .iter()
-            .map(|s| CString::new(s.as_str()).unwrap())
-            .collect();
-        let mut c_metric_ptrs: Vec<*const c_char> =
-            c_metric_names.iter().map(|s| s.as_ptr()).collect();
-        let mut metric_values = vec![0.0f64; metric_names.len()];
+        values: &mut [f64],
+    ) -> Result<(), CUptiResult> {
+        assert_eq!(values.len(), metrics.len());
         let mut params: CUpti_Profiler_Host_EvaluateToGpuValues_Params =
             unsafe { std::mem::zeroed() };
         params.structSize = struct_size_up_to!(CUpti_Profiler_Host_EvaluateToGpuValues_Params, pMetricValues: *mut f64);
         params.pHostObject = self.host.host_object;
         params.pCounterDataImage = counter_data_image.as_ptr();
         params.counterDataImageSize = counter_data_image.len();
-        params.ppMetricNames = c_metric_ptrs.as_mut_ptr();
-        params.numMetrics = metric_names.len();
+        params.ppMetricNames = metrics.c_names();
+        params.numMetrics = metrics.len();
         params.rangeIndex = range_index;
-        params.pMetricValues = metric_values.as_mut_ptr();
+        params.pMetricValues = values.as_mut_ptr();
         check_cupti!(unsafe { cuptiProfilerHostEvaluateToGpuValues(&mut params) });
-        Ok(metric_values)
+        Ok(())
     }
 
+    /// Evaluates every range in the image into a single flat batch.
     pub fn evaluate_all_ranges(
         &self,
         counter_data_image: &[u8],
-        metric_names: &[String],
-    ) -> Result<Vec<RangeInfo>, CUptiResult> {
+        metrics: &Arc<MetricSet>,
+    ) -> Result<RangeValues, CUptiResult> {
         let num_ranges = self.get_num_of_ranges(counter_data_image)?;
-        let mut range_infos = Vec::new();
-        for i in 0..num_ranges {
-            let range_name = self.get_range_name(i, counter_data_image)?;
-            let values = self.evaluate_metrics_for_range(counter_data_image, metric_names, i)?;
-            let mut metric_pairs = Vec::new();
-            for (j, val) in values.iter().enumerate() {
-                metric_pairs.push(MetricValuePair {
-                    metric_name: metric_names[j].clone(),
-                    value: *val,
-                });
+        let mut values = vec![0.0f64; num_ranges * metrics.len()];
+        if !metrics.is_empty() {
+            for (i, range) in values.chunks_exact_mut(metrics.len()).enumerate() {
+                self.evaluate_metrics_for_range(counter_data_image, metrics, i, range)?;
             }
-            range_infos.push(RangeInfo {
-                range_name,
-                metric_and_values: metric_pairs,
+        }
+        Ok(RangeValues::new(metrics.clone(), values))
+    }
+}
+
+/// Single-pass metric groups, as split by `single_pass_metric_groups`.
+pub type MetricGroups = Result<Arc<Vec<Vec<String>>>, CUptiResult>;
+
+/// A `MetricEvaluator` shared by every context on one chip.
+///
+/// Setting up the host is slow, so it is done once per chip, on a background
+/// thread started with `setup_in_background` or by the first `get`, whichever
+/// comes first. Evaluation waits for it; collecting ranges does not. Splitting
+/// metrics into single-pass groups is slower still and is done in the
+/// background as well.
+pub struct SharedEvaluator {
+    chip_name: String,
+    counter_availability_image: Vec<u8>,
+    evaluator: OnceLock<Result<MetricEvaluator, CUptiResult>>,
+    setup_started: AtomicBool,
+    metric_groups: Mutex<HashMap<Vec<String>, Arc<OnceLock<MetricGroups>>>>,
+}
+
+impl SharedEvaluator {
+    pub fn new(chip_name: String, counter_availability_image: Vec<u8>) -> Self {
+        Self {
+            chip_name,
+            counter_availability_image,
+            evaluator: OnceLock::new(),
+            setup_started: AtomicBool::new(false),
+            metric_groups: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Returns the evaluator of the chip of `device`, creating it on the first
+    /// context created on that chip.
+    ///
+    /// # Safety
+    ///
+    /// The `ctx` pointer must be a valid CUDA context on `device`.
+    pub unsafe fn for_context(ctx: CUcontext, device: CUdevice) -> Result<Arc<Self>, CUptiResult> {
+        let cache = ConfigCache::global();
+        let chip_name = cache.chip_name(device as usize, || get_chip_name(device as usize))?;
+        cache.evaluator(&chip_name, || unsafe {
+            get_counter_availability_image(ctx)
+        })
+    }
+
+    pub fn chip_name(&self) -> &str {
+        &self.chip_name
+    }
+
+    pub fn counter_availability_image(&self) -> &[u8] {
+        &self.counter_availability_image
+    }
+
+    /// Returns the evaluator, setting up its host unless that is done or under
+    /// way on another thread, in which case this waits for it.
+    pub fn get(&self) -> Result<&MetricEvaluator, CUptiResult> {
+        self.evaluator
+            .get_or_init(|| {
+                let mut host = ProfilerHost::new();
+                host.setup(
+                    &self.chip_name,
+                    self.counter_availability_image.clone(),
+                    CUpti_ProfilerType_CUPTI_PROFILER_TYPE_RANGE_PROFILER,
+                )?;
+                Ok(MetricEvaluator { host })
+            })
+            .as_ref()
+            .map_err(|e| *e)
+    }
+
+    /// Sets up the host on a new thread, unless that was started before.
+    pub fn setup_in_background(self: &Arc<Self>) {
+        if self.setup_started.swap(true, Ordering::Relaxed) {
+            return;
+        }
+        let evaluator = self.clone();
+        let spawned = thread::Builder::new()
+            .name("cupti-host-setup".to_string())
+            .spawn(move || {
+                if let Err(e) = evaluator.get() {
+                    eprintln!(
+                        "Failed to set up metric evaluator for {}: {:?}",
+                        evaluator.chip_name, e
+                    );
+                }
             });
+        // The first evaluation sets it up instead.
+        if spawned.is_err() {
+            self.setup_started.store(false, Ordering::Relaxed);
         }
-        Ok(range_infos)
+    }
+
+    /// Returns the single-pass groups of `metric_names` on this chip, or `None`
+    /// while they are being split on a background thread, which the first call
+    /// for a metric list starts.
+    pub fn metric_groups(self: &Arc<Self>, metric_names: &[String]) -> Option<MetricGroups> {
+        let (groups, started) = {
+            let mut splits = self.metric_groups.lock().ok()?;
+            match splits.get(metric_names) {
+                Some(groups) => (groups.clone(), true),
+                None => {
+                    let groups = Arc::new(OnceLock::new());
+                    splits.insert(metric_names.to_vec(), groups.clone());
+                    (groups, false)
+                }
+            }
+        };
+        if let Some(groups) = groups.get() {
+            return Some(groups.clone());
+        }
+        if !started {
+            let evaluator = self.clone();
+            let names = metric_names.to_vec();
+            let pending = groups.clone();
+            let spawned = thread::Builder::new()
+                .name("cupti-pass-split".to_string())
+                .spawn(move || {
+                    pending.get_or_init(|| evaluator.split(&names));
+                });
+            if spawned.is_err() {
+                return Some(groups.get_or_init(|| self.split(metric_names)).clone());
+            }
+        }
+        None
+    }
+
+    fn split(&self, metric_names: &[String]) -> MetricGroups {
+        chip_metric_groups(&self.chip_name, metric_names, &[], || {
+            Ok(self.counter_availability_image.clone())
+        })
     }
 }
@@ -0,0 +1,204 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use std::ffi::CString;
+use std::os::raw::c_char;
+use std::sync::Arc;
+
+/// A list of metrics compiled once for evaluation.
+///
+/// Owns the C strings and the pointer array handed to CUPTI, so evaluating a
+/// range needs no conversion. Ranges refer to metrics by their index, the
+/// metric id.
+pub struct MetricSet {
+    names: Vec<String>,
+    // Referenced by `c_name_ptrs`; never modified after construction.
+    _c_names: Vec<CString>,
+    c_name_ptrs: Vec<*const c_char>,
+}
+
+unsafe impl Send for MetricSet {}
+unsafe impl Sync for MetricSet {}
+
+impl MetricSet {
+    /// Compiles `names`; a name with an interior NUL evaluates as an empty name.
+    pub fn new(names: &[String]) -> Self {
+        let c_names: Vec<CString> = names
+            .iter()
+            .map(|name| CString::new(name.as_str()).unwrap_or_default())
+            .collect();
+        let c_name_ptrs = c_names.iter().map(|name| name.as_ptr()).collect();
+        Self {
+            names: names.to_vec(),
+            _c_names: c_names,
+            c_name_ptrs,
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.names.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.names.is_empty()
+    }
+
+    pub fn names(&self) -> &[String] {
+        &self.names
+    }
+
+    pub fn name(&self, id: usize) -> &str {
+        &self.names[id]
+    }
+
+    /// Returns the id of the metric called `name`.
+    pub fn id(&self, name: &str) -> Option<usize> {
+        self.names.iter().position(|n| n == name)
+    }
+
+    /// The metric names as the C string array expected by CUPTI.
+    pub(crate) fn c_names(&self) -> *mut *const c_char {
+        // CUPTI only reads the array.
+        self.c_name_ptrs.as_ptr() as *mut *const c_char
+    }
+}
+
+impl std::fmt::Debug for MetricSet {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_list().entries(&self.names).finish()
+    }
+}
+
+/// Metric values of a batch of ranges, stored as one flat array.
+///
+/// Range `i` holds `values[i * n..(i + 1) * n]` for the `n` metrics of the set,
+/// indexed by metric id. A `NaN` value marks a metric that was not collected.
+pub struct RangeValues {
+    metrics: Arc<MetricSet>,
+    values: Vec<f64>,
+}
+
+impl RangeValues {
+    /// Wraps `values`, whose length must be a multiple of the number of metrics.
+    pub fn new(metrics: Arc<MetricSet>, values: Vec<f64>) -> Self {
+        assert!(values.len() % metrics.len().max(1) == 0);
+        Self { metrics, values }
+    }
+
+    pub fn metrics(&self) -> &Arc<MetricSet> {
+        &self.metrics
+    }
+
+    pub fn num_ranges(&self) -> usize {
+        match self.metrics.len() {
+            0 => 0,
+            n => self.values.len() / n,
+        }
+    }
+
+    /// Values of the range at `index`, indexed by metric id.
+    pub fn range(&self, index: usize) -> &[f64] {
+        let n = self.metrics.len();
+        &self.values[index * n..(index + 1) * n]
+    }
+
+    /// Splits the batch into per-range views sharing its storage.
+    pub fn into_ranges(self) -> impl Iterator<Item = RangeInfo> {
+        let num_ranges = self.num_ranges();
+        let batch = Arc::new(self);
+        (0..num_ranges).map(move |index| RangeInfo {
+            batch: batch.clone(),
+            index,
+        })
+    }
+}
+
+/// Metric values of a single range.
+///
+/// A view into a shared `RangeValues` batch, so it costs no allocation.
+#[derive(Clone)]
+pub struct RangeInfo {
+    batch: Arc<RangeValues>,
+    index: usize,
+}
+
+impl RangeInfo {
+    /// A range that owns its values, indexed by metric id in `metrics`.
+    pub fn from_values(metrics: Arc<MetricSet>, values: Vec<f64>) -> Self {
+        assert_eq!(values.len(), metrics.len());
+        Self {
+            batch: Arc::new(RangeValues::new(metrics, values)),
+            index: 0,
+        }
+    }
+
+    pub fn metrics(&self) -> &Arc<MetricSet> {
+        &self.batch.metrics
+    }
+
+    /// Values indexed by metric id, `NaN` where not collected.
+    pub fn values(&self) -> &[f64] {
+        self.batch.range(self.index)
+    }
+
+    /// The collected metrics as `(metric id, value)`.
+    pub fn iter(&self) -> impl Iterator<Item = (usize, f64)> + '_ {
+        self.values()
+            .iter()
+            .copied()
+            .enumerate()
+            .filter(|(_, value)| !value.is_nan())
+    }
+
+    /// Returns the value of the metric called `name`, if collected.
+    pub fn get(&self, name: &str) -> Option<f64> {
+        self.metrics()
+            .id(name)
+            .map(|id| self.values()[id])
+            .filter(|value| !value.is_nan())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn metric_set(names: &[&str]) -> Arc<MetricSet> {
+        let names: Vec<String> = names.iter().map(|s| s.to_string()).collect();
+        Arc::new(MetricSet::new(&names))
+    }
+
+    #[test]
+    fn test_metric_set_c_names() {
+        let metrics = metric_set(&["a", "bc"]);
+        assert_eq!(metrics.id("bc"), Some(1));
+        assert_eq!(metrics.id("d"), None);
+        let c_names = unsafe { std::slice::from_raw_parts(metrics.c_names(), metrics.len()) };
+        let name = unsafe { std::ffi::CStr::from_ptr(c_names[1]) };
+        assert_eq!(name.to_str(), Ok("bc"));
+    }
+
+    #[test]
+    fn test_ranges_share_batch() {
+        let metrics = metric_set(&["a", "b"]);
+        let batch = RangeValues::new(metrics.clone(), vec![1.0, f64::NAN, 3.0, 4.0]);
+        assert_eq!(batch.num_ranges(), 2);
+        let ranges: Vec<RangeInfo> = batch.into_ranges().collect();
+        assert_eq!(ranges[0].iter().collect::<Vec<_>>(), [(0, 1.0)]);
+        assert_eq!(ranges[1].values(), [3.0, 4.0]);
+        assert_eq!(ranges[1].get("b"), Some(4.0));
+        assert_eq!(ranges[0].get("b"), None);
+        assert!(Arc::ptr_eq(ranges[0].metrics(), &metrics));
+    }
+}
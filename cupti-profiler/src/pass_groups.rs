@@ -0,0 +1,143 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::bindings::*;
+use crate::config_cache::{ConfigCache, ConfigKey};
+use crate::profiler::{get_chip_name, get_counter_availability_image, ProfilerHost};
+use std::sync::Arc;
+
+/// Splits `metric_names` into groups that can each be collected in one pass.
+///
+/// Duplicate metrics are dropped. Metrics in `pinned` are added to every group,
+/// so that each range carries them. Groups are built greedily in the given order
+/// using `num_passes` to count the passes a candidate group needs; a metric that
+/// needs several passes on its own gets a group of its own.
+pub fn split_metric_groups(
+    metric_names: &[String],
+    pinned: &[String],
+    mut num_passes: impl FnMut(&[String]) -> Result<usize, CUptiResult>,
+) -> Result<Vec<Vec<String>>, CUptiResult> {
+    let mut groups = Vec::new();
+    let mut current = pinned.to_vec();
+    let mut seen: Vec<&String> = pinned.iter().collect();
+    for metric in metric_names {
+        if seen.contains(&metric) {
+            continue;
+        }
+        seen.push(metric);
+        let mut candidate = current.clone();
+        candidate.push(metric.clone());
+        if num_passes(&candidate)? <= 1 {
+            current = candidate;
+            continue;
+        }
+        let mut alone = pinned.to_vec();
+        alone.push(metric.clone());
+        if current.len() == pinned.len() || num_passes(&alone)? > 1 {
+            groups.push(alone);
+        } else {
+            groups.push(std::mem::replace(&mut current, alone));
+        }
+    }
+    if current.len() > pinned.len() || groups.is_empty() {
+        groups.push(current);
+    }
+    Ok(groups)
+}
+
+/// Returns the single-pass metric groups for the device of `ctx`.
+///
+/// The split only depends on the chip, the metric list and the pinned metrics, so
+/// it is computed once per process and shared through `ConfigCache`.
+///
+/// # Safety
+///
+/// The `ctx` pointer must be a valid CUDA context that is current on this thread.
+pub unsafe fn single_pass_metric_groups(
+    ctx: CUcontext,
+    metric_names: &[String],
+    pinned: &[String],
+) -> Result<Arc<Vec<Vec<String>>>, CUptiResult> {
+    let mut device: CUdevice = 0;
+    unsafe {
+        cuCtxGetDevice(&mut device);
+    }
+    let chip_name =
+        ConfigCache::global().chip_name(device as usize, || get_chip_name(device as usize))?;
+    chip_metric_groups(&chip_name, metric_names, pinned, || unsafe {
+        get_counter_availability_image(ctx)
+    })
+}
+
+/// Returns the single-pass metric groups on `chip_name`, calling
+/// `counter_availability` for the image the hosts are set up with on first use.
+///
+/// Needs no context, so it can run off the thread that owns one. Each candidate
+/// group costs a host setup and a config image.
+pub fn chip_metric_groups(
+    chip_name: &str,
+    metric_names: &[String],
+    pinned: &[String],
+    counter_availability: impl FnOnce() -> Result<Vec<u8>, CUptiResult>,
+) -> Result<Arc<Vec<Vec<String>>>, CUptiResult> {
+    let key = ConfigKey::new(chip_name, metric_names);
+    ConfigCache::global().metric_groups(&key, pinned, || {
+        let counter_avail = counter_availability()?;
+        split_metric_groups(metric_names, pinned, |candidate| {
+            // Metrics accumulate in a host object, so each candidate needs a fresh one.
+            let mut host = ProfilerHost::new();
+            host.setup(
+                chip_name,
+                counter_avail.clone(),
+                CUpti_ProfilerType_CUPTI_PROFILER_TYPE_RANGE_PROFILER,
+            )?;
+            let config_image = host.create_config_image(candidate)?;
+            host.get_num_of_passes(&config_image)
+        })
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn names(names: &[&str]) -> Vec<String> {
+        names.iter().map(|s| s.to_string()).collect()
+    }
+
+    #[test]
+    fn test_split_metric_groups() {
+        // Every metric except the pinned one costs one pass; three fit in a pass.
+        let passes = |group: &[String]| Ok((group.len() - 1).div_ceil(3).max(1));
+        let metrics = names(&["t", "a", "b", "a", "c", "d", "e", "t"]);
+        let groups = split_metric_groups(&metrics, &names(&["t"]), passes).unwrap();
+        assert_eq!(
+            groups,
+            vec![names(&["t", "a", "b", "c"]), names(&["t", "d", "e"])]
+        );
+    }
+
+    #[test]
+    fn test_split_metric_groups_multi_pass_metric() {
+        let passes = |group: &[String]| {
+            Ok(if group.iter().any(|m| m == "big") {
+                2
+            } else {
+                group.len().div_ceil(2)
+            })
+        };
+        let groups = split_metric_groups(&names(&["a", "big", "b"]), &[], passes).unwrap();
+        assert_eq!(groups, vec![names(&["big"]), names(&["a", "b"])]);
+    }
+}
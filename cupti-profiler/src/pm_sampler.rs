@@ -0,0 +1,274 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::bindings::*;
+use crate::config_cache::ConfigCache;
+use crate::metric_evaluator::MetricEvaluator;
+use crate::profiler::{get_chip_name, Profiler, ProfilerHost};
+use std::ffi::CString;
+use std::os::raw::c_char;
+use std::ptr;
+
+/// Why a decode of the PM sampling hardware buffer stopped.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct DecodeStatus {
+    /// The counter data image is full and has to be drained before the next decode.
+    pub counter_data_full: bool,
+    /// The hardware buffer wrapped and samples were lost.
+    pub overflow: bool,
+}
+
+/// Samples the performance monitors of a device at a fixed interval.
+///
+/// Unlike the range profiler, kernels are neither replayed nor serialized;
+/// samples cover whatever the device was doing during each interval.
+pub struct PmSampler {
+    device_index: usize,
+    pm_sampling_object: *mut CUpti_PmSampling_Object,
+    chip_name: String,
+    pub config_image: Vec<u8>,
+}
+
+unsafe impl Send for PmSampler {}
+unsafe impl Sync for PmSampler {}
+
+impl PmSampler {
+    /// Creates a new `PmSampler` for the device at `device_index`.
+    pub fn new(device_index: usize) -> Self {
+        Self {
+            device_index,
+            pm_sampling_object: ptr::null_mut(),
+            chip_name: String::new(),
+            config_image: Vec::new(),
+        }
+    }
+
+    /// Enables PM sampling on the device.
+    pub fn enable(&mut self) -> Result<(), CUptiResult> {
+        Profiler::initialize()?;
+        let device_index = self.device_index;
+        self.chip_name =
+            ConfigCache::global().chip_name(device_index, || get_chip_name(device_index))?;
+        let mut params: CUpti_PmSampling_Enable_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_Enable_Params, pPmSamplingObject: *mut CUpti_PmSampling_Object);
+        params.deviceIndex = self.device_index;
+        check_cupti!(unsafe { cuptiPmSamplingEnable(&mut params) });
+        self.pm_sampling_object = params.pPmSamplingObject;
+        Ok(())
+    }
+
+    /// Disables PM sampling.
+    pub fn disable(&mut self) -> Result<(), CUptiResult> {
+        if self.pm_sampling_object.is_null() {
+            return Ok(());
+        }
+        let mut params: CUpti_PmSampling_Disable_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_Disable_Params, pPmSamplingObject: *mut CUpti_PmSampling_Object);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        check_cupti!(unsafe { cuptiPmSamplingDisable(&mut params) });
+        self.pm_sampling_object = ptr::null_mut();
+        Ok(())
+    }
+
+    /// Returns a profiler host for PM sampling on this device's chip, which
+    /// evaluates the samples of a counter data image.
+    pub fn create_host(&self) -> Result<ProfilerHost, CUptiResult> {
+        let counter_avail = get_counter_availability_image(self.device_index)?;
+        let mut host = ProfilerHost::new();
+        host.setup(
+            &self.chip_name,
+            counter_avail,
+            CUpti_ProfilerType_CUPTI_PROFILER_TYPE_PM_SAMPLING,
+        )?;
+        Ok(host)
+    }
+
+    /// Returns an evaluator for the samples of a counter data image.
+    pub fn create_evaluator(&self) -> Result<MetricEvaluator, CUptiResult> {
+        Ok(MetricEvaluator {
+            host: self.create_host()?,
+        })
+    }
+
+    /// Configures the metrics to sample every `interval_ns` nanoseconds into a
+    /// hardware buffer of `hardware_buffer_size` bytes.
+    ///
+    /// The buffer keeps the latest samples when it wraps.
+    pub fn set_config(
+        &mut self,
+        metric_names: &[String],
+        hardware_buffer_size: usize,
+        interval_ns: u64,
+    ) -> Result<(), CUptiResult> {
+        // The range profiler's config images are keyed the same way, so PM
+        // sampling configs are not cached.
+        self.config_image = self.create_host()?.create_config_image(metric_names)?;
+        let mut params: CUpti_PmSampling_SetConfig_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_SetConfig_Params, hwBufferAppendMode: CUpti_PmSampling_HardwareBuffer_AppendMode);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        params.configSize = self.config_image.len();
+        params.pConfig = self.config_image.as_ptr();
+        params.hardwareBufferSize = hardware_buffer_size;
+        params.samplingInterval = interval_ns;
+        params.triggerMode =
+            CUpti_PmSampling_TriggerMode_CUPTI_PM_SAMPLING_TRIGGER_MODE_GPU_TIME_INTERVAL;
+        params.hwBufferAppendMode = CUpti_PmSampling_HardwareBuffer_AppendMode_CUPTI_PM_SAMPLING_HARDWARE_BUFFER_APPEND_MODE_KEEP_LATEST;
+        check_cupti!(unsafe { cuptiPmSamplingSetConfig(&mut params) });
+        Ok(())
+    }
+
+    /// Starts sampling.
+    pub fn start(&self) -> Result<(), CUptiResult> {
+        let mut params: CUpti_PmSampling_Start_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_Start_Params, pPmSamplingObject: *mut CUpti_PmSampling_Object);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        check_cupti!(unsafe { cuptiPmSamplingStart(&mut params) });
+        Ok(())
+    }
+
+    /// Stops sampling. Samples left in the hardware buffer can still be decoded.
+    pub fn stop(&self) -> Result<(), CUptiResult> {
+        let mut params: CUpti_PmSampling_Stop_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_Stop_Params, pPmSamplingObject: *mut CUpti_PmSampling_Object);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        check_cupti!(unsafe { cuptiPmSamplingStop(&mut params) });
+        Ok(())
+    }
+
+    /// Sizes and initializes `counter_data_image` to hold `max_samples` samples
+    /// of the given metrics.
+    pub fn create_counter_data_image(
+        &self,
+        metric_names: &[String],
+        max_samples: usize,
+        counter_data_image: &mut Vec<u8>,
+    ) -> Result<(), CUptiResult> {
+        let c_metric_names: Vec<CString> = metric_names
+            .iter()
+            .map(|s| CString::new(s.as_str()).unwrap())
+            .collect();
+        let mut c_metric_ptrs: Vec<*const c_char> =
+            c_metric_names.iter().map(|s| s.as_ptr()).collect();
+        let mut params: CUpti_PmSampling_GetCounterDataSize_Params = unsafe { std::mem::zeroed() };
+        params.structSize =
+            struct_size_up_to!(CUpti_PmSampling_GetCounterDataSize_Params, counterDataSize: usize);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        params.pMetricNames = c_metric_ptrs.as_mut_ptr();
+        params.numMetrics = metric_names.len();
+        params.maxSamples = max_samples as u64;
+        check_cupti!(unsafe { cuptiPmSamplingGetCounterDataSize(&mut params) });
+        counter_data_image.clear();
+        counter_data_image.resize(params.counterDataSize, 0);
+        self.initialize_counter_data_image(counter_data_image)
+    }
+
+    /// Resets `counter_data_image` so it can be decoded into again.
+    pub fn initialize_counter_data_image(
+        &self,
+        counter_data_image: &mut [u8],
+    ) -> Result<(), CUptiResult> {
+        let mut params: CUpti_PmSampling_CounterDataImage_Initialize_Params =
+            unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_CounterDataImage_Initialize_Params, pCounterData: *mut u8);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        params.counterDataSize = counter_data_image.len();
+        params.pCounterData = counter_data_image.as_mut_ptr();
+        check_cupti!(unsafe { cuptiPmSamplingCounterDataImageInitialize(&mut params) });
+        Ok(())
+    }
+
+    /// Moves the samples collected so far from the hardware buffer into
+    /// `counter_data_image`.
+    pub fn decode(&self, counter_data_image: &mut [u8]) -> Result<DecodeStatus, CUptiResult> {
+        let mut params: CUpti_PmSampling_DecodeData_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_DecodeData_Params, overflow: u8);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        params.pCounterDataImage = counter_data_image.as_mut_ptr();
+        params.counterDataImageSize = counter_data_image.len();
+        check_cupti!(unsafe { cuptiPmSamplingDecodeData(&mut params) });
+        Ok(DecodeStatus {
+            counter_data_full: params.decodeStopReason
+                == CUpti_PmSampling_DecodeStopReason_CUPTI_PM_SAMPLING_DECODE_STOP_REASON_COUNTER_DATA_FULL,
+            overflow: params.overflow != 0,
+        })
+    }
+
+    /// Returns the number of complete samples in `counter_data_image`.
+    pub fn num_completed_samples(&self, counter_data_image: &[u8]) -> Result<usize, CUptiResult> {
+        let mut params: CUpti_PmSampling_GetCounterDataInfo_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_GetCounterDataInfo_Params, numCompletedSamples: usize);
+        params.pCounterDataImage = counter_data_image.as_ptr();
+        params.counterDataImageSize = counter_data_image.len();
+        check_cupti!(unsafe { cuptiPmSamplingGetCounterDataInfo(&mut params) });
+        Ok(params.numCompletedSamples)
+    }
+
+    /// Returns the GPU start and end timestamps of a sample.
+    pub fn sample_time(
+        &self,
+        counter_data_image: &[u8],
+        sample_index: usize,
+    ) -> Result<(u64, u64), CUptiResult> {
+        let mut params: CUpti_PmSampling_CounterData_GetSampleInfo_Params =
+            unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_PmSampling_CounterData_GetSampleInfo_Params, endTimestamp: u64);
+        params.pPmSamplingObject = self.pm_sampling_object;
+        params.pCounterDataImage = counter_data_image.as_ptr();
+        params.counterDataImageSize = counter_data_image.len();
+        params.sampleIndex = sample_index;
+        check_cupti!(unsafe { cuptiPmSamplingCounterDataGetSampleInfo(&mut params) });
+        Ok((params.startTimestamp, params.endTimestamp))
+    }
+}
+
+impl Drop for PmSampler {
+    fn drop(&mut self) {
+        let _ = self.disable();
+    }
+}
+
+/// Gets the PM sampling counter availability image of a device.
+fn get_counter_availability_image(device_index: usize) -> Result<Vec<u8>, CUptiResult> {
+    let mut params: CUpti_PmSampling_GetCounterAvailability_Params = unsafe { std::mem::zeroed() };
+    params.structSize = struct_size_up_to!(CUpti_PmSampling_GetCounterAvailability_Params, pCounterAvailabilityImage: *mut u8);
+    params.deviceIndex = device_index;
+    check_cupti!(unsafe { cuptiPmSamplingGetCounterAvailability(&mut params) });
+    let mut image = vec![0u8; params.counterAvailabilityImageSize];
+    params.pCounterAvailabilityImage = image.as_mut_ptr();
+    check_cupti!(unsafe { cuptiPmSamplingGetCounterAvailability(&mut params) });
+    Ok(image)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_decode_into_counter_data_image() {
+        let mut sampler = PmSampler::new(0);
+        sampler.enable().unwrap();
+        let metrics = vec!["sm__throughput.avg.pct_of_peak_sustained_elapsed".to_string()];
+        sampler.set_config(&metrics, 1 << 20, 100_000).unwrap();
+        let mut image = Vec::new();
+        sampler
+            .create_counter_data_image(&metrics, 16, &mut image)
+            .unwrap();
+        assert!(!image.is_empty());
+        let status = sampler.decode(&mut image).unwrap();
+        assert!(!status.counter_data_full);
+        assert!(!status.overflow);
+        assert_eq!(sampler.num_completed_samples(&image).unwrap(), 0);
+        sampler.disable().unwrap();
+    }
+}
@@ -83,6 +83,16 @@ impl ProfilerHost {
         Ok(())
     }
 
+    /// Returns the chip name the host was set up with.
+    pub fn chip_name(&self) -> &str {
+        &self.chip_name
+    }
+
+    /// Returns the counter availability image the host was set up with.
+    pub fn counter_availability_image(&self) -> &[u8] {
+        &self.counter_availability_image
+    }
+
     pub fn teardown(&mut self) -> Result<(), CUptiResult> {
         if self.host_object.is_null() {
             return Ok(());
@@ -128,6 +138,17 @@ impl ProfilerHost {
         check_cupti!(unsafe { cuptiProfilerHostGetConfigImage(&mut params_img) });
         Ok(config_image)
     }
+
+    /// Returns the number of replay passes needed to collect `config_image`.
+    pub fn get_num_of_passes(&self, config_image: &[u8]) -> Result<usize, CUptiResult> {
+        let mut params: CUpti_Profiler_Host_GetNumOfPasses_Params = unsafe { std::mem::zeroed() };
+        params.structSize =
+            struct_size_up_to!(CUpti_Profiler_Host_GetNumOfPasses_Params, numOfPasses: usize);
+        params.pConfigImage = config_image.as_ptr() as *mut u8;
+        params.configImageSize = config_image.len();
+        check_cupti!(unsafe { cuptiProfilerHostGetNumOfPasses(&mut params) });
+        Ok(params.numOfPasses)
+    }
 }
 
 impl Drop for ProfilerHost {
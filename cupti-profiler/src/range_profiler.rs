@@ -13,16 +13,22 @@
 // limitations under the License.
 
 use crate::bindings::*;
+use crate::config_cache::{ConfigCache, ConfigKey};
 use crate::profiler::{get_chip_name, get_counter_availability_image, ProfilerHost};
-use std::ffi::CString;
+use std::ffi::{CStr, CString};
 use std::os::raw::c_char;
 use std::ptr;
+use std::sync::Arc;
 
 /// Manages on-device range profiling sessions.
 pub struct RangeProfiler {
     context: CUcontext,
     range_profiler_object: *mut CUpti_RangeProfiler_Object,
-    pub config_image: Vec<u8>,
+    pub config_image: Arc<Vec<u8>>,
+    /// Settings of the last `set_config`, reused by `set_counter_data_image`.
+    range: CUpti_ProfilerRange,
+    replay_mode: CUpti_ProfilerReplayMode,
+    max_num_ranges: usize,
     pub pass_index: usize,
     pub target_nesting_level: usize,
     pub is_all_pass_submitted: bool,
@@ -37,7 +43,10 @@ impl RangeProfiler {
         Self {
             context: ctx,
             range_profiler_object: ptr::null_mut(),
-            config_image: Vec::new(),
+            config_image: Arc::new(Vec::new()),
+            range: CUpti_ProfilerRange_CUPTI_AutoRange,
+            replay_mode: CUpti_ProfilerReplayMode_CUPTI_KernelReplay,
+            max_num_ranges: 0,
             pass_index: 0,
             target_nesting_level: 0,
             is_all_pass_submitted: false,
@@ -89,30 +98,74 @@ impl RangeProfiler {
         Ok(())
     }
 
+    /// Opens a user range called `name`; only valid with `CUPTI_UserRange`.
+    pub fn push_range(&self, name: &CStr) -> Result<(), CUptiResult> {
+        let mut params: CUpti_RangeProfiler_PushRange_Params = unsafe { std::mem::zeroed() };
+        params.structSize =
+            struct_size_up_to!(CUpti_RangeProfiler_PushRange_Params, pRangeName: *const c_char);
+        params.pRangeProfilerObject = self.range_profiler_object;
+        params.pRangeName = name.as_ptr();
+        check_cupti!(unsafe { cuptiRangeProfilerPushRange(&mut params) });
+        Ok(())
+    }
+
+    /// Closes the user range opened last.
+    pub fn pop_range(&self) -> Result<(), CUptiResult> {
+        let mut params: CUpti_RangeProfiler_PopRange_Params = unsafe { std::mem::zeroed() };
+        params.structSize = struct_size_up_to!(CUpti_RangeProfiler_PopRange_Params, pRangeProfilerObject: *mut CUpti_RangeProfiler_Object);
+        params.pRangeProfilerObject = self.range_profiler_object;
+        check_cupti!(unsafe { cuptiRangeProfilerPopRange(&mut params) });
+        Ok(())
+    }
+
     /// Sets the configuration for the range profiler, including metrics to collect.
+    ///
+    /// `range` selects between a range per kernel (`CUPTI_AutoRange`) and ranges
+    /// opened with `push_range` (`CUPTI_UserRange`).
     pub fn set_config(
         &mut self,
         metric_names: &[String],
         counter_data_image: &mut Vec<u8>,
         max_num_ranges: usize,
+        range: CUpti_ProfilerRange,
         replay_mode: CUpti_ProfilerReplayMode,
     ) -> Result<(), CUptiResult> {
-        let mut host = ProfilerHost::new();
         let mut device: CUdevice = 0;
         unsafe {
             cuCtxGetDevice(&mut device);
         }
-        let chip_name = get_chip_name(device as usize)?;
-        let counter_avail = unsafe { get_counter_availability_image(self.context)? };
-        host.setup(
-            &chip_name,
-            counter_avail,
-            CUpti_ProfilerType_CUPTI_PROFILER_TYPE_RANGE_PROFILER,
-        )?;
-        self.config_image = host.create_config_image(metric_names)?;
+        let cache = ConfigCache::global();
+        let chip_name = cache.chip_name(device as usize, || get_chip_name(device as usize))?;
+        let key = ConfigKey::new(&chip_name, metric_names);
+        self.config_image = cache.config_image(&key, || {
+            let counter_avail = unsafe { get_counter_availability_image(self.context)? };
+            let mut host = ProfilerHost::new();
+            host.setup(
+                &chip_name,
+                counter_avail,
+                CUpti_ProfilerType_CUPTI_PROFILER_TYPE_RANGE_PROFILER,
+            )?;
+            host.create_config_image(metric_names)
+        })?;
         if counter_data_image.is_empty() {
-            self.create_counter_data_image(max_num_ranges, metric_names, counter_data_image)?;
+            let size = cache.counter_data_size(&key, max_num_ranges, || {
+                self.get_counter_data_size(max_num_ranges, metric_names)
+            })?;
+            counter_data_image.resize(size, 0);
+            self.initialize_counter_data_image(counter_data_image)?;
         }
+        self.range = range;
+        self.replay_mode = replay_mode;
+        self.max_num_ranges = max_num_ranges;
+        self.set_counter_data_image(counter_data_image)
+    }
+
+    /// Makes the profiler collect into `counter_data_image`, an initialized image
+    /// of the layout of the last `set_config`. The session must be stopped.
+    pub fn set_counter_data_image(
+        &mut self,
+        counter_data_image: &mut [u8],
+    ) -> Result<(), CUptiResult> {
         let mut params: CUpti_RangeProfiler_SetConfig_Params = unsafe { std::mem::zeroed() };
         params.structSize =
             struct_size_up_to!(CUpti_RangeProfiler_SetConfig_Params, targetNestingLevel: u16);
@@ -121,9 +174,9 @@ impl RangeProfiler {
         params.configSize = self.config_image.len();
         params.pCounterDataImage = counter_data_image.as_mut_ptr();
         params.counterDataImageSize = counter_data_image.len();
-        params.range = CUpti_ProfilerRange_CUPTI_AutoRange;
-        params.replayMode = replay_mode;
-        params.maxRangesPerPass = max_num_ranges;
+        params.range = self.range;
+        params.replayMode = self.replay_mode;
+        params.maxRangesPerPass = self.max_num_ranges;
         params.numNestingLevels = 1;
         params.minNestingLevel = 1;
         params.passIndex = self.pass_index;
@@ -132,12 +185,13 @@ impl RangeProfiler {
         Ok(())
     }
 
-    pub fn create_counter_data_image(
+    /// Returns the counter data image size needed for `max_num_ranges` ranges of
+    /// the given metrics.
+    pub fn get_counter_data_size(
         &self,
         max_num_ranges: usize,
         metric_names: &[String],
-        counter_data_image: &mut Vec<u8>,
-    ) -> Result<(), CUptiResult> {
+    ) -> Result<usize, CUptiResult> {
         let c_metric_names: Vec<CString> = metric_names
             .iter()
             .map(|s| CString::new(s.as_str()).unwrap())
@@ -153,24 +207,31 @@ impl RangeProfiler {
         params.maxNumOfRanges = max_num_ranges;
         params.maxNumRangeTreeNodes = max_num_ranges as u32;
         check_cupti!(unsafe { cuptiRangeProfilerGetCounterDataSize(&mut params) });
-        counter_data_image.resize(params.counterDataSize, 0);
-        let mut init_params: CUpti_RangeProfiler_CounterDataImage_Initialize_Params =
-            unsafe { std::mem::zeroed() };
-        init_params.structSize = struct_size_up_to!(CUpti_RangeProfiler_CounterDataImage_Initialize_Params, pCounterData: *mut u8);
-        init_params.pRangeProfilerObject = self.range_profiler_object;
-        init_params.pCounterData = counter_data_image.as_mut_ptr();
-        init_params.counterDataSize = counter_data_image.len();
-        check_cupti!(unsafe { cuptiRangeProfilerCounterDataImageInitialize(&mut init_params) });
-        Ok(())
+        Ok(params.counterDataSize)
     }
 
-    pub fn decode_counter_data(&self) -> Result<(), CUptiResult> {
+    pub fn create_counter_data_image(
+        &self,
+        max_num_ranges: usize,
+        metric_names: &[String],
+        counter_data_image: &mut Vec<u8>,
+    ) -> Result<(), CUptiResult> {
+        let size = self.get_counter_data_size(max_num_ranges, metric_names)?;
+        counter_data_image.resize(size, 0);
+        self.initialize_counter_data_image(counter_data_image)
+    }
+
+    /// Decodes the collected ranges into the counter data image.
+    ///
+    /// Returns the number of ranges that were dropped because the counter data
+    /// image had no room left for them.
+    pub fn decode_counter_data(&self) -> Result<usize, CUptiResult> {
         let mut params: CUpti_RangeProfiler_DecodeData_Params = unsafe { std::mem::zeroed() };
         params.structSize =
             struct_size_up_to!(CUpti_RangeProfiler_DecodeData_Params, numOfRangeDropped: usize);
         params.pRangeProfilerObject = self.range_profiler_object;
         check_cupti!(unsafe { cuptiRangeProfilerDecodeData(&mut params) });
-        Ok(())
+        Ok(params.numOfRangeDropped)
     }
 
     pub fn initialize_counter_data_image(
@@ -0,0 +1,293 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::state::CompletedKernel;
+use cupti_profiler::RangeInfo;
+use once_cell::sync::Lazy;
+use std::{collections::HashMap, sync::Mutex};
+
+/// Mantissa bits used to split each power of two into linear sub-buckets.
+const SUB_BUCKET_BITS: u32 = 3;
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+/// Smallest and one past the largest binary exponent with buckets of their own;
+/// values outside are clamped into the first or last power of two.
+const MIN_EXPONENT: i32 = -16;
+const MAX_EXPONENT: i32 = 48;
+/// One bucket for zero and negative values, then the log-linear buckets.
+const NUM_BUCKETS: usize = 1 + (MAX_EXPONENT - MIN_EXPONENT) as usize * SUB_BUCKETS;
+
+/// Fixed-size streaming summary of a series of values.
+///
+/// Keeps exact count, sum, min and max, and a log-linear histogram with eight
+/// buckets per power of two, so quantiles are within about 6% of the true value
+/// and memory does not depend on the number of values recorded.
+#[derive(Clone)]
+pub struct Summary {
+    count: u64,
+    sum: f64,
+    min: f64,
+    max: f64,
+    buckets: Box<[u32]>,
+}
+
+impl Default for Summary {
+    fn default() -> Self {
+        Self {
+            count: 0,
+            sum: 0.0,
+            min: f64::INFINITY,
+            max: f64::NEG_INFINITY,
+            buckets: vec![0; NUM_BUCKETS].into_boxed_slice(),
+        }
+    }
+}
+
+impl Summary {
+    /// Adds a value. Non-finite values are ignored.
+    pub fn record(&mut self, value: f64) {
+        if !value.is_finite() {
+            return;
+        }
+        self.count += 1;
+        self.sum += value;
+        self.min = self.min.min(value);
+        self.max = self.max.max(value);
+        let bucket = &mut self.buckets[bucket_index(value)];
+        *bucket = bucket.saturating_add(1);
+    }
+
+    /// Number of values recorded.
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    /// Sum of the values recorded.
+    pub fn sum(&self) -> f64 {
+        self.sum
+    }
+
+    pub fn mean(&self) -> f64 {
+        if self.count > 0 {
+            self.sum / self.count as f64
+        } else {
+            0.0
+        }
+    }
+
+    pub fn min(&self) -> f64 {
+        if self.count > 0 {
+            self.min
+        } else {
+            0.0
+        }
+    }
+
+    pub fn max(&self) -> f64 {
+        if self.count > 0 {
+            self.max
+        } else {
+            0.0
+        }
+    }
+
+    /// Approximate value below which a fraction `q` of the values fall.
+    pub fn quantile(&self, q: f64) -> f64 {
+        if self.count == 0 {
+            return 0.0;
+        }
+        let rank = ((q.clamp(0.0, 1.0) * self.count as f64).ceil() as u64).max(1);
+        let mut seen = 0u64;
+        for (index, &count) in self.buckets.iter().enumerate() {
+            seen += count as u64;
+            if seen >= rank {
+                return bucket_midpoint(index).clamp(self.min, self.max);
+            }
+        }
+        self.max
+    }
+}
+
+fn bucket_index(value: f64) -> usize {
+    if value <= 0.0 {
+        return 0;
+    }
+    let bits = value.to_bits();
+    let exponent = ((bits >> 52) & 0x7ff) as i32 - 1023;
+    if exponent < MIN_EXPONENT {
+        return 1;
+    }
+    if exponent >= MAX_EXPONENT {
+        return NUM_BUCKETS - 1;
+    }
+    let sub_bucket = ((bits >> (52 - SUB_BUCKET_BITS)) as usize) & (SUB_BUCKETS - 1);
+    1 + (exponent - MIN_EXPONENT) as usize * SUB_BUCKETS + sub_bucket
+}
+
+fn bucket_midpoint(index: usize) -> f64 {
+    if index == 0 {
+        return 0.0;
+    }
+    let exponent = ((index - 1) / SUB_BUCKETS) as i32 + MIN_EXPONENT;
+    let sub_bucket = ((index - 1) % SUB_BUCKETS) as f64;
+    2f64.powi(exponent) * (1.0 + (sub_bucket + 0.5) / SUB_BUCKETS as f64)
+}
+
+/// Kernels are aggregated per name and launch configuration.
+#[derive(Debug, Clone, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct KernelKey {
+    pub kernel_name: String,
+    pub grid_size: (i32, i32, i32),
+    pub block_size: (i32, i32, i32),
+}
+
+/// Aggregated launches of one kernel configuration.
+#[derive(Default)]
+pub struct KernelStats {
+    /// Duration of the launches in nanoseconds.
+    pub duration: Summary,
+    /// Summaries of every metric collected, in the order first seen.
+    pub metrics: Vec<(String, Summary)>,
+}
+
+impl KernelStats {
+    fn add_range(&mut self, range: &RangeInfo) {
+        for (id, value) in range.iter() {
+            let metric_name = range.metrics().name(id);
+            let summary = match self
+                .metrics
+                .iter()
+                .position(|(name, _)| name == metric_name)
+            {
+                Some(index) => &mut self.metrics[index].1,
+                None => {
+                    self.metrics
+                        .push((metric_name.to_string(), Summary::default()));
+                    &mut self.metrics.last_mut().expect("just pushed").1
+                }
+            };
+            summary.record(value);
+        }
+    }
+}
+
+/// Summaries of all kernels launched within a time window.
+pub struct AggregateWindow {
+    pub start: u64,
+    pub end: u64,
+    /// Per-kernel statistics, ordered by key.
+    pub kernels: Vec<(KernelKey, KernelStats)>,
+}
+
+/// Folds completed kernels into per-kernel summaries over rolling windows.
+///
+/// Memory is bounded by the number of distinct kernel configurations launched
+/// within a window; each window starts empty.
+pub struct Aggregator {
+    window_start: u64,
+    kernels: HashMap<KernelKey, KernelStats>,
+}
+
+impl Aggregator {
+    pub fn new(now: u64) -> Self {
+        Self {
+            window_start: now,
+            kernels: HashMap::new(),
+        }
+    }
+
+    /// Adds a completed kernel to the current window.
+    pub fn add(&mut self, kernel: &CompletedKernel) {
+        let activity = &kernel.activity;
+        let key = KernelKey {
+            kernel_name: activity.kernel_name.clone(),
+            grid_size: activity.grid_size,
+            block_size: activity.block_size,
+        };
+        let stats = self.kernels.entry(key).or_default();
+        stats
+            .duration
+            .record(activity.end.saturating_sub(activity.start) as f64);
+        if let Some(range) = &kernel.range {
+            stats.add_range(range);
+        }
+    }
+
+    /// Closes the current window if it is at least `interval_ns` old, returning
+    /// its summaries.
+    pub fn take_if_due(&mut self, now: u64, interval_ns: u64) -> Option<AggregateWindow> {
+        if now.saturating_sub(self.window_start) < interval_ns {
+            return None;
+        }
+        self.take(now)
+    }
+
+    /// Closes the current window, returning its summaries unless it is empty.
+    pub fn take(&mut self, now: u64) -> Option<AggregateWindow> {
+        let start = std::mem::replace(&mut self.window_start, now);
+        if self.kernels.is_empty() {
+            return None;
+        }
+        let mut kernels: Vec<(KernelKey, KernelStats)> = self.kernels.drain().collect();
+        kernels.sort_by(|a, b| a.0.cmp(&b.0));
+        Some(AggregateWindow {
+            start,
+            end: now,
+            kernels,
+        })
+    }
+}
+
+/// The process-wide aggregator used when aggregation is enabled.
+pub static AGGREGATOR: Lazy<Mutex<Aggregator>> =
+    Lazy::new(|| Mutex::new(Aggregator::new(crate::tracing::trace_time_ns())));
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_summary_quantiles() {
+        let mut summary = Summary::default();
+        for value in 1..=1000 {
+            summary.record(value as f64);
+        }
+        assert_eq!(summary.count(), 1000);
+        assert_eq!(summary.min(), 1.0);
+        assert_eq!(summary.max(), 1000.0);
+        assert_eq!(summary.sum(), 500500.0);
+        assert_eq!(summary.mean(), 500.5);
+        for (q, expected) in [(0.5, 500.0), (0.99, 990.0)] {
+            let value = summary.quantile(q);
+            assert!(
+                (value - expected).abs() / expected < 0.07,
+                "{} {}",
+                q,
+                value
+            );
+        }
+        summary.record(0.0);
+        assert_eq!(summary.quantile(0.0), 0.0);
+    }
+
+    #[test]
+    fn test_bucket_index_bounds() {
+        assert_eq!(bucket_index(-1.0), 0);
+        assert_eq!(bucket_index(1e-30), 1);
+        assert_eq!(bucket_index(1e30), NUM_BUCKETS - 1);
+        // Every bucket's midpoint maps back to that bucket.
+        for index in 1..NUM_BUCKETS {
+            assert_eq!(bucket_index(bucket_midpoint(index)), index);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/// Decides when the ranges buffered in a counter data image should be decoded.
+///
+/// Decoding happens when the image is full, when the configured time budget since
+/// the last decode has elapsed, or when the caller reaches a synchronization point.
+/// This spreads decode and evaluation cost over many kernels.
+pub struct RangeBatch {
+    capacity: usize,
+    interval_ns: u64,
+    pending: usize,
+    last_decode_ns: u64,
+    ranges_dropped: usize,
+}
+
+impl RangeBatch {
+    /// Creates a batch that holds up to `capacity` ranges.
+    ///
+    /// An `interval_ns` of zero disables time-based decoding.
+    pub fn new(capacity: usize, interval_ns: u64, now_ns: u64) -> Self {
+        Self {
+            capacity: capacity.max(1),
+            interval_ns,
+            pending: 0,
+            last_decode_ns: now_ns,
+            ranges_dropped: 0,
+        }
+    }
+
+    /// Maximum number of ranges the counter data image can hold.
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    /// Number of ranges recorded since the last decode.
+    pub fn pending(&self) -> usize {
+        self.pending
+    }
+
+    /// Total number of ranges CUPTI reported as dropped.
+    pub fn ranges_dropped(&self) -> usize {
+        self.ranges_dropped
+    }
+
+    /// Records a range that is about to be written into the counter data image.
+    pub fn record_range(&mut self) {
+        self.pending += 1;
+    }
+
+    /// Returns whether pending ranges must be decoded before recording another one.
+    pub fn should_decode(&self, now_ns: u64) -> bool {
+        if self.pending == 0 {
+            return false;
+        }
+        if self.pending >= self.capacity {
+            return true;
+        }
+        self.interval_ns > 0 && now_ns.saturating_sub(self.last_decode_ns) >= self.interval_ns
+    }
+
+    /// Marks pending ranges as decoded, accounting for ranges CUPTI dropped.
+    pub fn decoded(&mut self, now_ns: u64, ranges_dropped: usize) {
+        self.pending = 0;
+        self.last_decode_ns = now_ns;
+        self.ranges_dropped += ranges_dropped;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_decode_when_full() {
+        let mut batch = RangeBatch::new(3, 0, 0);
+        assert!(!batch.should_decode(0));
+        batch.record_range();
+        batch.record_range();
+        assert!(!batch.should_decode(0));
+        batch.record_range();
+        assert!(batch.should_decode(0));
+        batch.decoded(0, 0);
+        assert_eq!(batch.pending(), 0);
+        assert!(!batch.should_decode(0));
+    }
+
+    #[test]
+    fn test_decode_on_time_budget() {
+        let mut batch = RangeBatch::new(100, 1_000, 0);
+        assert!(!batch.should_decode(5_000));
+        batch.record_range();
+        assert!(!batch.should_decode(999));
+        assert!(batch.should_decode(1_000));
+        batch.decoded(1_000, 0);
+        batch.record_range();
+        assert!(!batch.should_decode(1_500));
+    }
+
+    #[test]
+    fn test_ranges_dropped_accumulate() {
+        let mut batch = RangeBatch::new(0, 0, 0);
+        assert_eq!(batch.capacity(), 1);
+        batch.decoded(0, 2);
+        batch.decoded(0, 3);
+        assert_eq!(batch.ranges_dropped(), 5);
+    }
+}
@@ -0,0 +1,349 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Evaluates a spill file written with `INJECTION_SPILL_PATH` into a Perfetto
+//! trace, in parallel across cores.
+//!
+//! Usage: `cupti-spill-eval <spill file> <trace file> [threads]`
+//!
+//! The trace holds the counters of every spilled range at the GPU times of its
+//! kernel, like the injection writes them when it evaluates in process. It can
+//! be opened next to the session's trace, or appended to it:
+//! `cat session.pftrace counters.pftrace > merged.pftrace`.
+
+use cupti_profiler::bindings::*;
+use cupti_profiler::{MetricEvaluator, MetricSet, ProfilerHost};
+use perfetto_cupti_gpu_compute::spill::{Record, SpillFile};
+use std::{
+    collections::HashMap,
+    env, fs, io, process,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+    thread,
+};
+
+const USAGE: &str = "usage: cupti-spill-eval <spill file> <trace file> [threads]";
+
+// Field numbers of the protos in `perfetto/trace/gpu/gpu_counter_event.proto`
+// and `perfetto/common/gpu_counter_descriptor.proto`.
+const TRACE_PACKET: u32 = 1;
+const PACKET_TIMESTAMP: u32 = 8;
+const PACKET_GPU_COUNTER_EVENT: u32 = 52;
+const PACKET_TIMESTAMP_CLOCK_ID: u32 = 58;
+const EVENT_COUNTER_DESCRIPTOR: u32 = 1;
+const EVENT_COUNTERS: u32 = 2;
+const DESCRIPTOR_SPECS: u32 = 1;
+const SPEC_COUNTER_ID: u32 = 1;
+const SPEC_NAME: u32 = 2;
+const SPEC_GROUPS: u32 = 10;
+const COUNTER_ID: u32 = 1;
+const COUNTER_INT_VALUE: u32 = 2;
+const COUNTER_DOUBLE_VALUE: u32 = 3;
+const GROUP_COMPUTE: u64 = 6;
+const CLOCK_BOOTTIME: u64 = 6;
+
+/// Protobuf encoder for the few messages written here.
+#[derive(Default)]
+struct Proto(Vec<u8>);
+
+impl Proto {
+    fn varint(&mut self, mut v: u64) {
+        while v >= 0x80 {
+            self.0.push(v as u8 | 0x80);
+            v >>= 7;
+        }
+        self.0.push(v as u8);
+    }
+
+    fn uint(&mut self, field: u32, v: u64) -> &mut Self {
+        self.varint((field as u64) << 3);
+        self.varint(v);
+        self
+    }
+
+    fn double(&mut self, field: u32, v: f64) -> &mut Self {
+        self.varint((field as u64) << 3 | 1);
+        self.0.extend_from_slice(&v.to_le_bytes());
+        self
+    }
+
+    fn bytes(&mut self, field: u32, v: &[u8]) -> &mut Self {
+        self.varint((field as u64) << 3 | 2);
+        self.varint(v.len() as u64);
+        self.0.extend_from_slice(v);
+        self
+    }
+
+    fn message(&mut self, field: u32, f: impl FnOnce(&mut Proto)) -> &mut Self {
+        let mut message = Proto::default();
+        f(&mut message);
+        self.bytes(field, &message.0)
+    }
+
+    /// Appends a trace packet carrying a GPU counter event.
+    fn counter_event(&mut self, timestamp: u64, f: impl FnOnce(&mut Proto)) {
+        self.message(TRACE_PACKET, |packet| {
+            packet
+                .uint(PACKET_TIMESTAMP, timestamp)
+                .uint(PACKET_TIMESTAMP_CLOCK_ID, CLOCK_BOOTTIME)
+                .message(PACKET_GPU_COUNTER_EVENT, f);
+        });
+    }
+}
+
+/// What evaluating the images of a config needs.
+struct SpilledConfig<'a> {
+    chip_name: &'a str,
+    counter_availability_image: &'a [u8],
+    metrics: Arc<MetricSet>,
+    /// Counter id of every metric id.
+    counter_ids: Vec<u32>,
+}
+
+struct SpilledImage<'a> {
+    config_id: u32,
+    correlation_ids: Vec<u32>,
+    user_ranges: Vec<(&'a str, u64, u64)>,
+    counter_data_image: &'a [u8],
+}
+
+/// Trace packets of one image.
+#[derive(Default)]
+struct Evaluated {
+    packets: Proto,
+    ranges: usize,
+    /// Ranges whose kernel has no spilled times.
+    unplaced: usize,
+    first_timestamp: Option<u64>,
+}
+
+fn evaluate(
+    image: &SpilledImage,
+    config: &SpilledConfig,
+    evaluator: &MetricEvaluator,
+    kernels: &HashMap<u32, (u64, u64)>,
+) -> Result<Evaluated, CUptiResult> {
+    let ranges = evaluator.evaluate_all_ranges(image.counter_data_image, &config.metrics)?;
+    let times = image
+        .correlation_ids
+        .iter()
+        .map(|id| kernels.get(id).copied())
+        .chain(
+            image
+                .user_ranges
+                .iter()
+                .map(|&(_, start, end)| Some((start, end))),
+        );
+    let mut evaluated = Evaluated::default();
+    for (range, time) in ranges.into_ranges().zip(times) {
+        evaluated.ranges += 1;
+        let (start, end) = match time {
+            Some(time) => time,
+            None => {
+                evaluated.unplaced += 1;
+                continue;
+            }
+        };
+        evaluated.first_timestamp = Some(evaluated.first_timestamp.map_or(start, |t| t.min(start)));
+        let counters: Vec<(u32, f64)> = range
+            .iter()
+            .map(|(id, value)| (config.counter_ids[id], value))
+            .collect();
+        evaluated.packets.counter_event(start, |event| {
+            for (id, _) in &counters {
+                event.message(EVENT_COUNTERS, |counter| {
+                    counter
+                        .uint(COUNTER_ID, *id as u64)
+                        .uint(COUNTER_INT_VALUE, 0);
+                });
+            }
+        });
+        evaluated.packets.counter_event(end, |event| {
+            for (id, value) in &counters {
+                event.message(EVENT_COUNTERS, |counter| {
+                    counter
+                        .uint(COUNTER_ID, *id as u64)
+                        .double(COUNTER_DOUBLE_VALUE, *value);
+                });
+            }
+        });
+    }
+    Ok(evaluated)
+}
+
+fn run(spill_path: &str, trace_path: &str, threads: usize) -> io::Result<()> {
+    let spill = SpillFile::open(spill_path)?;
+    let mut configs: HashMap<u32, SpilledConfig> = HashMap::new();
+    let mut images: Vec<SpilledImage> = Vec::new();
+    let mut kernels: HashMap<u32, (u64, u64)> = HashMap::new();
+    // Counter ids number the metric names in order of first appearance, like the
+    // injection numbers them.
+    let mut counter_names: Vec<&str> = Vec::new();
+    for record in spill.records() {
+        match record? {
+            Record::Config {
+                id,
+                chip_name,
+                counter_availability_image,
+                metrics,
+                ..
+            } => {
+                let counter_ids = metrics
+                    .iter()
+                    .map(|name| match counter_names.iter().position(|n| n == name) {
+                        Some(id) => id as u32,
+                        None => {
+                            counter_names.push(name);
+                            counter_names.len() as u32 - 1
+                        }
+                    })
+                    .collect();
+                let names: Vec<String> = metrics.iter().map(|s| s.to_string()).collect();
+                configs.insert(
+                    id,
+                    SpilledConfig {
+                        chip_name,
+                        counter_availability_image,
+                        metrics: Arc::new(MetricSet::new(&names)),
+                        counter_ids,
+                    },
+                );
+            }
+            Record::Image {
+                config_id,
+                correlation_ids,
+                user_ranges,
+                counter_data_image,
+                ..
+            } => images.push(SpilledImage {
+                config_id,
+                correlation_ids,
+                user_ranges,
+                counter_data_image,
+            }),
+            Record::Kernel {
+                correlation_id,
+                start,
+                end,
+            } => {
+                kernels.insert(correlation_id, (start, end));
+            }
+        }
+    }
+
+    // Each thread evaluates with hosts of its own and takes the next image
+    // when done with one.
+    let next_image = AtomicUsize::new(0);
+    let mut evaluated: Vec<(usize, Evaluated)> = thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads.max(1))
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut evaluators: HashMap<u32, MetricEvaluator> = HashMap::new();
+                    let mut evaluated = Vec::new();
+                    loop {
+                        let index = next_image.fetch_add(1, Ordering::Relaxed);
+                        let image = match images.get(index) {
+                            Some(image) => image,
+                            None => return evaluated,
+                        };
+                        let config = match configs.get(&image.config_id) {
+                            Some(config) => config,
+                            None => {
+                                eprintln!("Image {}: unknown config {}", index, image.config_id);
+                                continue;
+                            }
+                        };
+                        if !evaluators.contains_key(&image.config_id) {
+                            let mut host = ProfilerHost::new();
+                            if let Err(e) = host.setup(
+                                config.chip_name,
+                                config.counter_availability_image.to_vec(),
+                                CUpti_ProfilerType_CUPTI_PROFILER_TYPE_RANGE_PROFILER,
+                            ) {
+                                eprintln!("Image {}: failed to set up host: {:?}", index, e);
+                                continue;
+                            }
+                            evaluators.insert(image.config_id, MetricEvaluator { host });
+                        }
+                        let evaluator = &evaluators[&image.config_id];
+                        match evaluate(image, config, evaluator, &kernels) {
+                            Ok(result) => evaluated.push((index, result)),
+                            Err(e) => eprintln!("Image {}: failed to evaluate: {:?}", index, e),
+                        }
+                    }
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .flat_map(|worker| worker.join().unwrap_or_default())
+            .collect()
+    });
+    evaluated.sort_by_key(|(index, _)| *index);
+
+    let mut trace = Proto::default();
+    let first_timestamp = evaluated
+        .iter()
+        .filter_map(|(_, result)| result.first_timestamp)
+        .min()
+        .unwrap_or(0);
+    trace.counter_event(first_timestamp, |event| {
+        event.message(EVENT_COUNTER_DESCRIPTOR, |desc| {
+            for (id, name) in counter_names.iter().enumerate() {
+                desc.message(DESCRIPTOR_SPECS, |spec| {
+                    spec.uint(SPEC_COUNTER_ID, id as u64)
+                        .bytes(SPEC_NAME, name.as_bytes())
+                        .uint(SPEC_GROUPS, GROUP_COMPUTE);
+                });
+            }
+        });
+    });
+    let (mut ranges, mut unplaced) = (0, 0);
+    for (_, result) in &evaluated {
+        trace.0.extend_from_slice(&result.packets.0);
+        ranges += result.ranges;
+        unplaced += result.unplaced;
+    }
+    fs::write(trace_path, &trace.0)?;
+    eprintln!(
+        "Evaluated {} of {} images, {} ranges ({} without kernel times) into {}",
+        evaluated.len(),
+        images.len(),
+        ranges,
+        unplaced,
+        trace_path
+    );
+    Ok(())
+}
+
+fn main() {
+    let args: Vec<String> = env::args().collect();
+    if args.len() < 3 || args.len() > 4 {
+        eprintln!("{}", USAGE);
+        process::exit(2);
+    }
+    let threads = match args.get(3) {
+        Some(threads) => threads.parse().unwrap_or_else(|_| {
+            eprintln!("{}", USAGE);
+            process::exit(2);
+        }),
+        None => thread::available_parallelism().map_or(1, |n| n.get()),
+    };
+    if let Err(e) = run(&args[1], &args[2], threads) {
+        eprintln!("cupti-spill-eval: {}", e);
+        process::exit(1);
+    }
+}
@@ -0,0 +1,193 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use std::{
+    alloc::{self, Layout},
+    sync::{
+        atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+        OnceLock,
+    },
+};
+
+/// Alignment CUPTI requires for activity buffers.
+const BUFFER_ALIGNMENT: usize = 8;
+
+/// Fixed set of preallocated activity buffers handed out to CUPTI and recycled.
+///
+/// All buffers live in one allocation and are claimed through per-slot atomic
+/// flags, so acquiring and releasing never takes a lock or calls the allocator.
+/// When every buffer is in flight, a standalone buffer is allocated and freed on
+/// release; these exhaustion events are counted.
+pub struct BufferPool {
+    buffer_size: usize,
+    storage: *mut u8,
+    in_use: Box<[AtomicBool]>,
+    next: AtomicUsize,
+    acquired: AtomicU64,
+    exhausted: AtomicU64,
+}
+
+unsafe impl Send for BufferPool {}
+unsafe impl Sync for BufferPool {}
+
+/// Snapshot of buffer pool usage.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct BufferPoolStats {
+    /// Number of buffers handed out.
+    pub acquired: u64,
+    /// Number of requests served outside the pool because it was empty.
+    pub exhausted: u64,
+}
+
+impl BufferPool {
+    /// Preallocates `count` buffers of `buffer_size` bytes.
+    pub fn new(buffer_size: usize, count: usize) -> Self {
+        let buffer_size = buffer_size
+            .max(BUFFER_ALIGNMENT)
+            .next_multiple_of(BUFFER_ALIGNMENT);
+        let storage = match Layout::from_size_align(buffer_size * count, BUFFER_ALIGNMENT) {
+            Ok(layout) if layout.size() > 0 => unsafe { alloc::alloc(layout) },
+            _ => std::ptr::null_mut(),
+        };
+        let count = if storage.is_null() { 0 } else { count };
+        Self {
+            buffer_size,
+            storage,
+            in_use: (0..count).map(|_| AtomicBool::new(false)).collect(),
+            next: AtomicUsize::new(0),
+            acquired: AtomicU64::new(0),
+            exhausted: AtomicU64::new(0),
+        }
+    }
+
+    /// Size in bytes of every buffer handed out.
+    pub fn buffer_size(&self) -> usize {
+        self.buffer_size
+    }
+
+    /// Returns a free buffer, or null if even the fallback allocation failed.
+    pub fn acquire(&self) -> *mut u8 {
+        self.acquired.fetch_add(1, Ordering::Relaxed);
+        let count = self.in_use.len();
+        let start = self.next.fetch_add(1, Ordering::Relaxed);
+        for i in 0..count {
+            let slot = (start + i) % count;
+            if self.in_use[slot]
+                .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed)
+                .is_ok()
+            {
+                return unsafe { self.storage.add(slot * self.buffer_size) };
+            }
+        }
+        self.exhausted.fetch_add(1, Ordering::Relaxed);
+        unsafe { alloc::alloc(self.fallback_layout()) }
+    }
+
+    /// Returns a buffer obtained from `acquire` to the pool.
+    ///
+    /// # Safety
+    ///
+    /// `buffer` must come from `acquire` on this pool and not be used afterwards.
+    pub unsafe fn release(&self, buffer: *mut u8) {
+        if buffer.is_null() {
+            return;
+        }
+        let offset = (buffer as usize).wrapping_sub(self.storage as usize);
+        if !self.storage.is_null() && offset < self.buffer_size * self.in_use.len() {
+            self.in_use[offset / self.buffer_size].store(false, Ordering::Release);
+        } else {
+            unsafe { alloc::dealloc(buffer, self.fallback_layout()) };
+        }
+    }
+
+    /// Returns usage counters since the pool was created.
+    pub fn stats(&self) -> BufferPoolStats {
+        BufferPoolStats {
+            acquired: self.acquired.load(Ordering::Relaxed),
+            exhausted: self.exhausted.load(Ordering::Relaxed),
+        }
+    }
+
+    fn fallback_layout(&self) -> Layout {
+        Layout::from_size_align(self.buffer_size, BUFFER_ALIGNMENT).expect("valid buffer layout")
+    }
+}
+
+impl Drop for BufferPool {
+    fn drop(&mut self) {
+        if let Ok(layout) =
+            Layout::from_size_align(self.buffer_size * self.in_use.len(), BUFFER_ALIGNMENT)
+        {
+            if !self.storage.is_null() {
+                unsafe { alloc::dealloc(self.storage, layout) };
+            }
+        }
+    }
+}
+
+static BUFFER_POOL: OnceLock<BufferPool> = OnceLock::new();
+
+/// Creates the process-wide activity buffer pool. Later calls have no effect.
+pub fn init(buffer_size: usize, count: usize) {
+    let _ = BUFFER_POOL.set(BufferPool::new(buffer_size, count));
+}
+
+/// Returns the process-wide activity buffer pool, if it has been created.
+pub fn get() -> Option<&'static BufferPool> {
+    BUFFER_POOL.get()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_buffers_are_recycled() {
+        let pool = BufferPool::new(1000, 2);
+        assert_eq!(pool.buffer_size(), 1000);
+        let a = pool.acquire();
+        let b = pool.acquire();
+        assert_ne!(a, b);
+        assert_eq!(a as usize % BUFFER_ALIGNMENT, 0);
+        unsafe { pool.release(a) };
+        let c = pool.acquire();
+        assert_eq!(a, c);
+        assert_eq!(pool.stats().exhausted, 0);
+        unsafe {
+            pool.release(b);
+            pool.release(c);
+        }
+    }
+
+    #[test]
+    fn test_exhaustion_falls_back_to_allocation() {
+        let pool = BufferPool::new(64, 1);
+        let a = pool.acquire();
+        let b = pool.acquire();
+        assert!(!b.is_null());
+        assert_ne!(a, b);
+        assert_eq!(
+            pool.stats(),
+            BufferPoolStats {
+                acquired: 2,
+                exhausted: 1
+            }
+        );
+        unsafe {
+            pool.release(b);
+            pool.release(a);
+        }
+        assert_eq!(pool.acquire(), a);
+    }
+}
@@ -12,12 +12,22 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::state::{KernelActivity, KernelLaunch, GLOBAL_STATE};
+use crate::buffer_pool;
+use crate::clock::CLOCK_SYNC;
+use crate::device::{DeviceProperties, FuncAttributes, FuncAttributesKey};
+use crate::emission::emit_kernels;
+use crate::nvtx::{self, NvtxEvent, RangeMode, NVTX_RANGE_CBIDS};
+use crate::overhead::{self, Probe, Timer};
+use crate::session;
+use crate::state::{CtxProfilerData, KernelActivity, KernelLaunch, GLOBAL_STATE, MAX_DEVICES};
 use crate::tracing::trace_time_ns;
 use cupti_profiler::bindings::*;
 use cupti_profiler::{self as profiler, *};
-use libc::c_void;
-use std::{ffi::CStr, panic, ptr};
+use std::{
+    collections::HashMap,
+    ffi::{c_void, CStr},
+    panic, ptr,
+};
 
 /// Callback for CUPTI to request a buffer for storing activity records.
 /// # Safety
@@ -28,9 +38,15 @@ pub unsafe extern "C" fn buffer_requested(
     size: *mut usize,
     _max_num_records: *mut usize,
 ) {
-    let _ = panic::catch_unwind(|| {
-        *size = 16 * 1024;
-        *buffer = libc::malloc(*size) as *mut u8;
+    let _ = panic::catch_unwind(|| match buffer_pool::get() {
+        Some(pool) => {
+            *size = pool.buffer_size();
+            *buffer = pool.acquire();
+        }
+        None => {
+            *size = 0;
+            *buffer = ptr::null_mut();
+        }
     });
 }
 
@@ -48,34 +64,155 @@ pub unsafe extern "C" fn buffer_completed(
     valid_size: usize,
 ) {
     let _ = panic::catch_unwind(|| {
-        if let Ok(mut state) = GLOBAL_STATE.lock() {
-            let mut record: *mut CUpti_Activity = ptr::null_mut();
-            while unsafe { profiler::activity_get_next_record(buffer, valid_size, &mut record) }
-                .is_ok()
-            {
-                let r = &*record;
-                if r.kind == CUpti_ActivityKind_CUPTI_ACTIVITY_KIND_KERNEL {
-                    let k = &*(record as *const CUpti_ActivityKernel4);
-                    if let Some(data) = state.context_data.get_mut(&k.contextId) {
-                        data.kernel_activities.push(KernelActivity {
-                            kernel_name: CStr::from_ptr(k.name).to_string_lossy().to_string(),
-                            grid_size: (k.gridX, k.gridY, k.gridZ),
-                            block_size: (k.blockX, k.blockY, k.blockZ),
-                            registers_per_thread: k.registersPerThread,
-                            dynamic_shared_memory: k.dynamicSharedMemory,
-                            static_shared_memory: k.staticSharedMemory,
-                        });
-                    }
-                }
+        let timer = Timer::start(Probe::BufferCompleted);
+        // Parse the whole buffer before taking any context lock so launches are
+        // only blocked for the time it takes to append the records.
+        let mut activities: HashMap<u32, Vec<KernelActivity>> = HashMap::new();
+        let mut record: *mut CUpti_Activity = ptr::null_mut();
+        let mut num_records = 0;
+        while unsafe { profiler::activity_get_next_record(buffer, valid_size, &mut record) }.is_ok()
+        {
+            num_records += 1;
+            let r = &*record;
+            if r.kind == CUpti_ActivityKind_CUPTI_ACTIVITY_KIND_KERNEL {
+                // Later record versions extend this one, so its fields are valid
+                // whatever version CUPTI produced.
+                let k = &*(record as *const CUpti_ActivityKernel5);
+                activities
+                    .entry(k.contextId)
+                    .or_default()
+                    .push(KernelActivity {
+                        correlation_id: k.correlationId,
+                        kernel_name: CStr::from_ptr(k.name).to_string_lossy().to_string(),
+                        grid_size: (k.gridX, k.gridY, k.gridZ),
+                        block_size: (k.blockX, k.blockY, k.blockZ),
+                        registers_per_thread: k.registersPerThread,
+                        dynamic_shared_memory: k.dynamicSharedMemory,
+                        static_shared_memory: k.staticSharedMemory,
+                        shared_memory_executed: k.sharedMemoryExecuted,
+                        cache_config: k.cacheConfig.config.requested(),
+                        launch_type: k.launchType,
+                        graph_id: k.graphId,
+                        graph_node_id: k.graphNodeId,
+                        start: k.start,
+                        end: k.end,
+                    });
             }
         }
-        libc::free(buffer as *mut c_void);
+        if let Some(pool) = buffer_pool::get() {
+            pool.release(buffer);
+        }
+        overhead::count_activity_records(num_records);
+        CLOCK_SYNC.refresh(trace_time_ns());
+        let config = GLOBAL_STATE.config();
+        for (ctx_id, records) in activities {
+            let completed = match GLOBAL_STATE.context(ctx_id) {
+                Some(handle) => match handle.lock() {
+                    Ok(mut data) => data.add_activities(records),
+                    Err(_) => continue,
+                },
+                None => continue,
+            };
+            emit_kernels(&completed, &config);
+        }
+        drop(timer);
+        overhead::sample_if_due(trace_time_ns());
     });
 }
 
+/// Driver API calls after which buffered ranges are decoded.
+pub const SYNC_POINT_CBIDS: &[CUpti_CallbackId] = &[
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuCtxSynchronize,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuStreamSynchronize,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuStreamSynchronize_ptsz,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuEventSynchronize,
+];
+
+fn is_sync_point(cbid: CUpti_CallbackId) -> bool {
+    SYNC_POINT_CBIDS.contains(&cbid)
+}
+
+/// Driver API calls that launch a single kernel.
+///
+/// The runtime API launch calls (`cudaLaunchKernel`, `cudaLaunchKernelExC`,
+/// `cudaLaunchCooperativeKernel`) are implemented on top of these.
+pub const KERNEL_LAUNCH_CBIDS: &[CUpti_CallbackId] = &[
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernel,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernel_ptsz,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernelEx,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernelEx_ptsz,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchCooperativeKernel,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchCooperativeKernel_ptsz,
+];
+
+/// Driver API calls that launch a CUDA graph, including `cudaGraphLaunch`.
+pub const GRAPH_LAUNCH_CBIDS: &[CUpti_CallbackId] = &[
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuGraphLaunch,
+    CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuGraphLaunch_ptsz,
+];
+
+/// Function and launch configuration of a kernel launch call.
+struct LaunchParams {
+    function: CUfunction,
+    block_size: i32,
+    dynamic_smem: usize,
+}
+
+/// Extracts the launch parameters of a call in `KERNEL_LAUNCH_CBIDS`.
+///
+/// # Safety
+///
+/// `params` must be the `functionParams` of a callback for `cbid`.
+#[allow(nonstandard_style)]
+unsafe fn launch_params(cbid: CUpti_CallbackId, params: *const c_void) -> Option<LaunchParams> {
+    macro_rules! from_dims {
+        ($p:expr) => {{
+            let p = $p;
+            LaunchParams {
+                function: p.f,
+                block_size: (p.blockDimX * p.blockDimY * p.blockDimZ) as i32,
+                dynamic_smem: p.sharedMemBytes as usize,
+            }
+        }};
+    }
+    // `cuLaunchKernelEx` passes the launch configuration in a separate struct.
+    macro_rules! from_config {
+        ($p:expr) => {{
+            let p = $p;
+            let config = p.config.as_ref()?;
+            LaunchParams {
+                function: p.f,
+                block_size: (config.blockDimX * config.blockDimY * config.blockDimZ) as i32,
+                dynamic_smem: config.sharedMemBytes as usize,
+            }
+        }};
+    }
+    Some(match cbid {
+        CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernel => {
+            from_dims!(&*(params as *const cuLaunchKernel_params))
+        }
+        CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernel_ptsz => {
+            from_dims!(&*(params as *const cuLaunchKernel_ptsz_params))
+        }
+        CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchCooperativeKernel => {
+            from_dims!(&*(params as *const cuLaunchCooperativeKernel_params))
+        }
+        CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchCooperativeKernel_ptsz => {
+            from_dims!(&*(params as *const cuLaunchCooperativeKernel_ptsz_params))
+        }
+        CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernelEx => {
+            from_config!(&*(params as *const cuLaunchKernelEx_params))
+        }
+        CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernelEx_ptsz => {
+            from_config!(&*(params as *const cuLaunchKernelEx_ptsz_params))
+        }
+        _ => return None,
+    })
+}
+
 /// Main CUPTI callback handler.
 ///
-/// Intercepts CUDA driver API calls (specifically `cuLaunchKernel`) to manage profiling sessions,
+/// Intercepts CUDA driver API kernel and graph launches to manage profiling sessions,
 /// and handles resource events for context creation/destruction.
 /// # Safety
 ///
@@ -86,205 +223,212 @@ pub unsafe extern "C" fn profiler_callback_handler(
     cbid: CUpti_CallbackId,
     cbdata: *const c_void,
 ) {
+    // Launches in flight while profiling is turned off end here.
+    if (domain == CUpti_CallbackDomain_CUPTI_CB_DOMAIN_DRIVER_API
+        || domain == CUpti_CallbackDomain_CUPTI_CB_DOMAIN_NVTX)
+        && !session::is_profiling()
+    {
+        return;
+    }
     let _ = panic::catch_unwind(|| {
+        let _timer = Timer::start(Probe::Callback);
         let res = profiler::get_last_error();
         if res != CUptiResult_CUPTI_SUCCESS {
             return;
         }
         if domain == CUpti_CallbackDomain_CUPTI_CB_DOMAIN_DRIVER_API
-            && cbid == CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernel
+            && KERNEL_LAUNCH_CBIDS.contains(&cbid)
         {
             let cb_data = &*(cbdata as *const CUpti_CallbackData);
             let ctx = cb_data.context;
-            let params = &*(cb_data.functionParams as *const cuLaunchKernel_params);
             if cb_data.callbackSite == CUpti_ApiCallbackSite_CUPTI_API_ENTER {
-                if let Ok(mut state) = GLOBAL_STATE.lock() {
-                    let metric_names = state.config.metrics.clone();
-                    let active_ctx = state.active_ctx;
-                    match active_ctx {
-                        Some(active_ctx) if active_ctx != ctx => {
-                            let active_ctx_id = unsafe { profiler::get_context_id(active_ctx) };
-                            if let Some(old_data) = state.context_data.get_mut(&active_ctx_id) {
-                                if let Some(rp) = &mut old_data.range_profiler {
-                                    let _ = rp.stop();
-                                    let _ = rp.decode_counter_data();
-                                    if let Some(me) = &old_data.metric_evaluator {
-                                        if let Ok(infos) = me.evaluate_all_ranges(
-                                            &old_data.counter_data_image,
-                                            &metric_names,
-                                        ) {
-                                            old_data.range_info.extend(infos);
-                                        }
-                                    }
-                                    let _ = rp.disable();
-                                }
-                                old_data.range_profiler = None;
-                                old_data.is_active = false;
-                            }
-                            state.active_ctx = None;
+                let params = match launch_params(cbid, cb_data.functionParams) {
+                    Some(params) => params,
+                    None => return,
+                };
+                let ctx_id = unsafe { profiler::get_context_id(ctx) };
+                let (device, handle) = match GLOBAL_STATE.context_with_device(ctx_id) {
+                    Some(entry) => entry,
+                    None => return,
+                };
+                let symbol = if cb_data.symbolName.is_null() {
+                    ""
+                } else {
+                    CStr::from_ptr(cb_data.symbolName).to_str().unwrap_or("")
+                };
+                // Only another context on the same device needs a session switch.
+                let locked = overhead::time(Probe::StateWait, || {
+                    GLOBAL_STATE.lock_active(device, ctx, &handle)
+                });
+                if let Some((mut data, active)) = locked {
+                    let now = trace_time_ns();
+                    // In NVTX mode kernels run inside the profiled ranges instead
+                    // of being ranges of their own.
+                    let per_kernel = data.range_mode == RangeMode::Kernel;
+                    // Filtered out kernels never reach the sampler, so they do not
+                    // count towards its budget.
+                    let sampled = per_kernel
+                        && active
+                        && data.filter.is_selected(params.function, symbol)
+                        && data.sampler.should_sample(symbol, now);
+                    if sampled {
+                        data.prepare_sampled_launch(ctx, ctx_id, symbol);
+                        if data.batch.should_decode(now) {
+                            data.decode_and_submit(ctx_id);
                         }
-                        _ => {}
+                    } else if per_kernel {
+                        data.pause();
                     }
-                    match active_ctx {
-                        Some(active_ctx) if active_ctx != ctx => {
-                            let active_ctx_id = unsafe { profiler::get_context_id(active_ctx) };
-                            if let Some(old_data) = state.context_data.get_mut(&active_ctx_id) {
-                                if let Some(rp) = &mut old_data.range_profiler {
-                                    let _ = rp.stop();
-                                    let _ = rp.decode_counter_data();
-                                    if let Some(me) = &old_data.metric_evaluator {
-                                        if let Ok(infos) = me.evaluate_all_ranges(
-                                            &old_data.counter_data_image,
-                                            &metric_names,
-                                        ) {
-                                            old_data.range_info.extend(infos);
-                                        }
-                                    }
-                                    let _ = rp.disable();
-                                }
-                                old_data.range_profiler = None;
-                                old_data.is_active = false;
-                            }
-                            state.active_ctx = None;
+                    // Ranges can only be turned into metrics with an evaluator, and
+                    // only launches that get one count towards the batch.
+                    let sampled = sampled
+                        && data.is_active
+                        && !data.is_paused
+                        && data.metric_evaluator.is_some();
+                    if sampled {
+                        data.batch.record_range();
+                    }
+                    let key = FuncAttributesKey {
+                        function: params.function,
+                        block_size: params.block_size,
+                        dynamic_smem: params.dynamic_smem,
+                    };
+                    let attributes = data.func_attributes.get_or_query(key, || unsafe {
+                        FuncAttributes::query(key.function, key.block_size, key.dynamic_smem)
+                    });
+                    data.add_launch(KernelLaunch {
+                        correlation_id: cb_data.correlationId,
+                        function: params.function,
+                        timestamp: now,
+                        attributes,
+                        sampled,
+                    });
+                };
+            } else if cb_data.callbackSite == CUpti_ApiCallbackSite_CUPTI_API_EXIT
+                && !cb_data.functionReturnValue.is_null()
+                && *(cb_data.functionReturnValue as *const CUresult) != cudaError_enum_CUDA_SUCCESS
+            {
+                // A failed launch never produces an activity record.
+                let ctx_id = unsafe { profiler::get_context_id(ctx) };
+                if let Some(handle) = GLOBAL_STATE.context(ctx_id) {
+                    if let Ok(mut data) = handle.lock() {
+                        data.discard_launch(cb_data.correlationId);
+                    }
+                }
+            }
+        } else if domain == CUpti_CallbackDomain_CUPTI_CB_DOMAIN_DRIVER_API
+            && GRAPH_LAUNCH_CBIDS.contains(&cbid)
+        {
+            // Graph nodes are not range profiled: kernel replay would serialize
+            // every node. Their activity records complete on their own.
+            let cb_data = &*(cbdata as *const CUpti_CallbackData);
+            if cb_data.callbackSite == CUpti_ApiCallbackSite_CUPTI_API_ENTER {
+                let ctx_id = unsafe { profiler::get_context_id(cb_data.context) };
+                if let Some(handle) = GLOBAL_STATE.context(ctx_id) {
+                    if let Ok(mut data) = handle.lock() {
+                        if data.range_mode == RangeMode::Kernel {
+                            data.pause();
                         }
-                        _ => {}
                     }
-                    let ctx_id = unsafe { profiler::get_context_id(ctx) };
-                    if state.context_data.contains_key(&ctx_id) {
-                        state.active_ctx = Some(ctx);
-                        if let Some(data) = state.context_data.get_mut(&ctx_id) {
-                            if data.range_profiler.is_none() {
-                                let mut rp = RangeProfiler::new(ctx);
-                                let _ = rp.enable();
-                                let _ = rp.set_config(
-                                    &metric_names,
-                                    &mut data.counter_data_image,
-                                    data.max_num_ranges,
-                                    CUpti_ProfilerReplayMode_CUPTI_KernelReplay,
-                                );
-                                let _ = rp.start();
-                                data.range_profiler = Some(rp);
-                                data.is_active = true;
-                            }
-                            if let Some(rp) = &mut data.range_profiler {
-                                let _ = rp.decode_counter_data();
-                                if let Some(me) = &data.metric_evaluator {
-                                    if let Ok(infos) = me.evaluate_all_ranges(
-                                        &data.counter_data_image,
-                                        &metric_names,
-                                    ) {
-                                        data.range_info.extend(infos);
-                                    }
-                                }
-                                let _ =
-                                    rp.initialize_counter_data_image(&mut data.counter_data_image);
-                            }
-                            data.kernel_launches.push(KernelLaunch {
-                                function: params.f,
-                                timestamp: trace_time_ns(),
-                            });
+                }
+            }
+        } else if domain == CUpti_CallbackDomain_CUPTI_CB_DOMAIN_DRIVER_API && is_sync_point(cbid) {
+            let cb_data = &*(cbdata as *const CUpti_CallbackData);
+            if cb_data.callbackSite == CUpti_ApiCallbackSite_CUPTI_API_EXIT {
+                let ctx_id = unsafe { profiler::get_context_id(cb_data.context) };
+                if let Some(handle) = GLOBAL_STATE.context(ctx_id) {
+                    if let Ok(mut data) = handle.lock() {
+                        // An open NVTX range is still collecting.
+                        if data.is_active && data.batch.pending() > 0 && data.user_range.is_none() {
+                            data.decode_and_submit(ctx_id);
                         }
                     }
                 }
             }
+        } else if domain == CUpti_CallbackDomain_CUPTI_CB_DOMAIN_NVTX
+            && NVTX_RANGE_CBIDS.contains(&cbid)
+        {
+            // NVTX calls carry no context; ranges belong to the current one.
+            let mut ctx: CUcontext = ptr::null_mut();
+            if cuCtxGetCurrent(&mut ctx) != cudaError_enum_CUDA_SUCCESS || ctx.is_null() {
+                return;
+            }
+            let event = match nvtx::range_event(cbid, cbdata) {
+                Some(event) => event,
+                None => return,
+            };
+            let ctx_id = unsafe { profiler::get_context_id(ctx) };
+            let (device, handle) = match GLOBAL_STATE.context_with_device(ctx_id) {
+                Some(entry) => entry,
+                None => return,
+            };
+            match event {
+                NvtxEvent::Push(name) => {
+                    if let Some((mut data, active)) = GLOBAL_STATE.lock_active(device, ctx, &handle)
+                    {
+                        data.push_user_range(ctx, ctx_id, name, active);
+                    }
+                }
+                NvtxEvent::Pop => {
+                    if let Ok(mut data) = handle.lock() {
+                        data.pop_user_range(ctx_id);
+                    }
+                }
+            }
         } else if domain == CUpti_CallbackDomain_CUPTI_CB_DOMAIN_RESOURCE {
             if cbid == CUpti_CallbackIdResource_CUPTI_CBID_RESOURCE_CONTEXT_CREATED {
                 let res_data = &*(cbdata as *const CUpti_ResourceData);
                 let ctx = res_data.context;
-                if let Ok(mut state) = GLOBAL_STATE.lock() {
-                    let metric_names = state.config.metrics.clone();
-                    if let Some(active_ctx) = state.active_ctx {
-                        let active_ctx_id = unsafe { profiler::get_context_id(active_ctx) };
-                        if let Some(data) = state.context_data.get_mut(&active_ctx_id) {
-                            if data.is_active {
-                                if let Some(rp) = &mut data.range_profiler {
-                                    let _ = rp.stop();
-                                    let _ = rp.decode_counter_data();
-                                    if let Some(me) = &data.metric_evaluator {
-                                        if let Ok(infos) = me.evaluate_all_ranges(
-                                            &data.counter_data_image,
-                                            &metric_names,
-                                        ) {
-                                            data.range_info.extend(infos);
-                                        }
-                                    }
-                                    let _ = rp.disable();
-                                }
-                                data.range_profiler = None;
-                                data.is_active = false;
-                            }
-                        }
-                        state.active_ctx = None;
-                    }
-                    let device_id = unsafe { profiler::get_device(ctx) }.unwrap_or(0);
-                    let num_sms = profiler::get_device_attribute(
-                        device_id,
-                        CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
-                    )
-                    .unwrap_or(0);
-                    let mut data = Box::new(crate::state::CtxProfilerData {
-                        device_id,
-                        num_sms,
-                        max_num_ranges: 10,
-                        is_active: false,
-                        counter_data_image: Vec::new(),
-                        metric_evaluator: None,
-                        range_profiler: None,
-                        range_info: Vec::new(),
-                        kernel_launches: Vec::new(),
-                        kernel_activities: Vec::new(),
-                    });
-                    if Profiler::initialize().is_ok() {
-                        if let Ok(me) = unsafe { MetricEvaluator::new(ctx) } {
-                            data.metric_evaluator = Some(me);
-                        }
-                        let mut rp = RangeProfiler::new(ctx);
-                        if rp.enable().is_ok()
-                            && rp
-                                .set_config(
-                                    &metric_names,
-                                    &mut data.counter_data_image,
-                                    data.max_num_ranges,
-                                    CUpti_ProfilerReplayMode_CUPTI_KernelReplay,
-                                )
-                                .is_ok()
-                        {
-                            let _ = rp.start();
-                            data.range_profiler = Some(rp);
-                            data.is_active = true;
-                            state.active_ctx = Some(ctx);
-                        }
-                        let ctx_id = unsafe { profiler::get_context_id(ctx) };
-                        state.context_data.insert(ctx_id, data);
-                    } else {
-                        eprintln!("Failed to initialize profiler");
+                let config = GLOBAL_STATE.config();
+                let device_id = unsafe { profiler::get_device(ctx) }.unwrap_or(0);
+                if device_id as usize >= MAX_DEVICES {
+                    eprintln!(
+                        "Device {} is beyond the first {} devices; its kernels are not range profiled",
+                        device_id, MAX_DEVICES
+                    );
+                }
+                GLOBAL_STATE.switch_active_ctx(device_id, ptr::null_mut());
+                let mut data = CtxProfilerData::new(DeviceProperties::query(device_id), &config);
+                // The evaluator is created even in activity-only mode, so that a
+                // session can turn the range profiler on. Contexts on the same chip
+                // share it, and its host is set up off the context creation path.
+                let profiler_ready = Profiler::initialize().is_ok();
+                if profiler_ready {
+                    if let Ok(evaluator) = unsafe { SharedEvaluator::for_context(ctx, device_id) } {
+                        evaluator.setup_in_background();
+                        data.metric_evaluator = Some(evaluator);
                     }
+                    // Starts splitting the metrics into passes in the background.
+                    data.poll_scheduler();
+                } else if !config.activity_only {
+                    eprintln!("Failed to initialize profiler");
+                }
+                // Otherwise the session begins on the first sampled launch. With
+                // multi-pass scheduling, that is the first one after the metrics
+                // are split into groups.
+                let metrics = data.metrics.clone();
+                let started = profiler_ready
+                    && session::is_profiling()
+                    && !config.activity_only
+                    && !data.multi_pass
+                    && data.begin_session(ctx, &metrics);
+                let ctx_id = unsafe { profiler::get_context_id(ctx) };
+                GLOBAL_STATE.insert_context(ctx_id, data);
+                if started {
+                    GLOBAL_STATE.switch_active_ctx(device_id, ctx);
                 }
             } else if cbid == CUpti_CallbackIdResource_CUPTI_CBID_RESOURCE_CONTEXT_DESTROY_STARTING
             {
                 let res_data = &*(cbdata as *const CUpti_ResourceData);
                 let ctx = res_data.context;
                 let ctx_id = unsafe { profiler::get_context_id(ctx) };
-                if let Ok(mut state) = GLOBAL_STATE.lock() {
-                    let metric_names = state.config.metrics.clone();
-                    if let Some(data) = state.context_data.get_mut(&ctx_id) {
-                        if data.is_active {
-                            if let Some(rp) = &mut data.range_profiler {
-                                let _ = rp.stop();
-                                let _ = rp.decode_counter_data();
-                                if let Some(me) = &data.metric_evaluator {
-                                    if let Ok(infos) = me.evaluate_all_ranges(
-                                        &data.counter_data_image,
-                                        &metric_names,
-                                    ) {
-                                        data.range_info.extend(infos);
-                                    }
-                                }
-                                let _ = rp.disable();
-                            }
-                            data.range_profiler = None;
-                            data.is_active = false;
-                        }
+                if let Some((device, handle)) = GLOBAL_STATE.context_with_device(ctx_id) {
+                    if let Ok(mut data) = handle.lock() {
+                        data.end_session(ctx_id);
+                    }
+                    // Free the device for the next context launching on it.
+                    if GLOBAL_STATE.active_ctx(device) == ctx {
+                        GLOBAL_STATE.switch_active_ctx(device, ptr::null_mut());
                     }
                 }
             }
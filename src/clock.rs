@@ -0,0 +1,130 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::tracing::trace_time_ns;
+use cupti_profiler as profiler;
+use std::sync::atomic::{AtomicBool, AtomicI64, AtomicU64, Ordering};
+
+/// Number of clock reads taken per calibration; the tightest one wins.
+const CALIBRATION_SAMPLES: usize = 5;
+
+/// Maps CUPTI timestamps, as found in activity records, onto the trace clock.
+///
+/// The offset between the two clocks is measured by reading the trace clock on
+/// both sides of `cuptiGetTimestamp` and is refreshed periodically to follow drift.
+pub struct ClockSync {
+    offset_ns: AtomicI64,
+    calibrated: AtomicBool,
+    last_calibration_ns: AtomicU64,
+    interval_ns: AtomicU64,
+}
+
+impl ClockSync {
+    const fn new() -> Self {
+        Self {
+            offset_ns: AtomicI64::new(0),
+            calibrated: AtomicBool::new(false),
+            last_calibration_ns: AtomicU64::new(0),
+            interval_ns: AtomicU64::new(0),
+        }
+    }
+
+    /// Measures the clock offset now.
+    pub fn calibrate(&self) {
+        let mut samples = [(0u64, 0u64, 0u64); CALIBRATION_SAMPLES];
+        for sample in samples.iter_mut() {
+            let before = trace_time_ns();
+            let cupti = match profiler::get_timestamp() {
+                Ok(timestamp) => timestamp,
+                Err(_) => return,
+            };
+            *sample = (before, cupti, trace_time_ns());
+        }
+        if let Some(offset) = best_offset(&samples) {
+            self.offset_ns.store(offset, Ordering::Relaxed);
+            self.calibrated.store(true, Ordering::Release);
+            self.last_calibration_ns
+                .store(samples[CALIBRATION_SAMPLES - 1].2, Ordering::Relaxed);
+        }
+    }
+
+    /// Recalibrates if the refresh interval has elapsed since the last calibration.
+    pub fn refresh(&self, now_ns: u64) {
+        let interval = self.interval_ns.load(Ordering::Relaxed);
+        let last = self.last_calibration_ns.load(Ordering::Relaxed);
+        if interval > 0 && now_ns.saturating_sub(last) >= interval {
+            self.calibrate();
+        }
+    }
+
+    /// Converts a CUPTI timestamp to the trace clock, if the offset is known.
+    pub fn to_trace_time(&self, cupti_ns: u64) -> Option<u64> {
+        if cupti_ns == 0 || !self.calibrated.load(Ordering::Acquire) {
+            return None;
+        }
+        let offset = self.offset_ns.load(Ordering::Relaxed);
+        Some((cupti_ns as i64).saturating_add(offset).max(0) as u64)
+    }
+}
+
+/// Computes the trace-minus-CUPTI offset from `(trace_before, cupti, trace_after)`
+/// samples, using the sample with the smallest trace clock window.
+fn best_offset(samples: &[(u64, u64, u64)]) -> Option<i64> {
+    samples
+        .iter()
+        .filter(|(before, _, after)| after >= before)
+        .min_by_key(|(before, _, after)| after - before)
+        .map(|(before, cupti, after)| {
+            let midpoint = before + (after - before) / 2;
+            midpoint as i64 - *cupti as i64
+        })
+}
+
+/// The process-wide clock synchronization.
+pub static CLOCK_SYNC: ClockSync = ClockSync::new();
+
+/// Calibrates the clocks and sets the interval at which they are recalibrated.
+pub fn init(interval_ms: u64) {
+    CLOCK_SYNC
+        .interval_ns
+        .store(interval_ms * 1_000_000, Ordering::Relaxed);
+    CLOCK_SYNC.calibrate();
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_best_offset_uses_tightest_sample() {
+        let samples = [
+            (1_000, 10, 1_100),
+            (2_000, 1_002, 2_004),
+            (3_000, 1_990, 3_050),
+        ];
+        assert_eq!(best_offset(&samples), Some(1_000));
+        assert_eq!(best_offset(&[]), None);
+    }
+
+    #[test]
+    fn test_to_trace_time() {
+        let clock = ClockSync::new();
+        assert_eq!(clock.to_trace_time(500), None);
+        clock.offset_ns.store(-100, Ordering::Relaxed);
+        clock.calibrated.store(true, Ordering::Release);
+        assert_eq!(clock.to_trace_time(500), Some(400));
+        assert_eq!(clock.to_trace_time(50), Some(0));
+        assert_eq!(clock.to_trace_time(0), None);
+    }
+}
@@ -12,8 +12,32 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::metrics::{parse_metrics, DEFAULT_METRICS};
-use std::env;
+use crate::filter::KernelFilter;
+use crate::metrics::{parse_metrics, DEFAULT_METRICS, DEFAULT_PM_METRICS};
+use crate::nvtx::RangeMode;
+use crate::sampling::SamplingPolicy;
+use std::{env, str::FromStr, sync::Arc};
+
+/// Default activity flush period in milliseconds.
+pub const DEFAULT_FLUSH_PERIOD_MS: u32 = 1000;
+
+/// Default number of ranges buffered in a counter data image before decoding.
+pub const DEFAULT_MAX_NUM_RANGES: usize = 32;
+
+/// Default number of counter data images each context rotates through.
+pub const DEFAULT_COUNTER_DATA_IMAGES: usize = 2;
+
+/// Default time budget in milliseconds after which buffered ranges are decoded.
+pub const DEFAULT_DECODE_INTERVAL_MS: u64 = 100;
+
+/// Default size in KiB of each activity buffer handed to CUPTI.
+pub const DEFAULT_ACTIVITY_BUFFER_SIZE_KB: usize = 1024;
+
+/// Default number of preallocated activity buffers.
+pub const DEFAULT_ACTIVITY_BUFFER_COUNT: usize = 8;
+
+/// Default interval in milliseconds at which the CUPTI clock is recalibrated.
+pub const DEFAULT_CLOCK_SYNC_INTERVAL_MS: u64 = 1000;
 
 /// Configuration for the injection library.
 #[derive(Debug, Clone)]
@@ -22,6 +46,57 @@ pub struct Config {
     pub verbose: bool,
     /// List of metrics to be collected.
     pub metrics: Vec<String>,
+    /// Period in milliseconds at which activity buffers are flushed, so kernels are
+    /// emitted while the application runs. Zero leaves flushing to CUPTI.
+    pub flush_period_ms: u32,
+    /// Number of ranges the counter data image can hold; decoding is deferred until
+    /// it is full, a sync point is reached, or `decode_interval_ms` has elapsed.
+    pub max_num_ranges: usize,
+    /// Number of counter data images per context. Ranges are collected into one
+    /// while the others wait for evaluation; one image copies every decoded batch.
+    pub counter_data_images: usize,
+    /// Time budget in milliseconds after which buffered ranges are decoded. Zero
+    /// disables time-based decoding.
+    pub decode_interval_ms: u64,
+    /// Which kernel launches are range profiled.
+    pub sampling: SamplingPolicy,
+    /// Whether metrics are split into single-pass groups that are collected on
+    /// successive launches of each kernel instead of replaying every launch.
+    pub multi_pass: bool,
+    /// Size in bytes of each activity buffer.
+    pub activity_buffer_size: usize,
+    /// Number of activity buffers preallocated and recycled across CUPTI requests.
+    pub activity_buffer_count: usize,
+    /// Interval in milliseconds at which the offset between the CUPTI clock and the
+    /// trace clock is remeasured. Zero calibrates only once at startup.
+    pub clock_sync_interval_ms: u64,
+    /// Whether only activity records are collected. Launches are neither
+    /// intercepted nor range profiled, and kernels carry no counters.
+    pub activity_only: bool,
+    /// Interval in milliseconds over which kernels are aggregated into per-kernel
+    /// summaries instead of being emitted one event per launch. Zero disables.
+    pub aggregate_interval_ms: u64,
+    /// Whether the injection's own overhead is measured and written to the
+    /// overhead data source.
+    pub overhead: bool,
+    /// Whether a summary of the measured overhead is printed to stderr at exit.
+    pub overhead_summary: bool,
+    /// Whether kernels are profiled while no tracing session is running, e.g.
+    /// for verbose output. Otherwise launches are only intercepted during a session.
+    pub always_on: bool,
+    /// Which kernels are range profiled by name; `None` profiles all of them.
+    /// Kernels that are filtered out still appear on the timeline.
+    pub kernel_filter: Option<Arc<KernelFilter>>,
+    /// Whether ranges cover single kernel launches or NVTX ranges.
+    pub range_mode: RangeMode,
+    /// Interval in microseconds at which the performance monitors of every
+    /// device are sampled. Zero disables PM sampling.
+    pub pm_sampling_interval_us: u64,
+    /// Metrics collected by PM sampling.
+    pub pm_metrics: Vec<String>,
+    /// File decoded counter data images are spilled to for offline evaluation
+    /// instead of being evaluated in process.
+    pub spill_path: Option<String>,
 }
 
 impl Default for Config {
@@ -29,6 +104,25 @@ impl Default for Config {
         Self {
             verbose: false,
             metrics: DEFAULT_METRICS.iter().map(|s| s.to_string()).collect(),
+            flush_period_ms: DEFAULT_FLUSH_PERIOD_MS,
+            max_num_ranges: DEFAULT_MAX_NUM_RANGES,
+            counter_data_images: DEFAULT_COUNTER_DATA_IMAGES,
+            decode_interval_ms: DEFAULT_DECODE_INTERVAL_MS,
+            sampling: SamplingPolicy::default(),
+            multi_pass: false,
+            activity_buffer_size: DEFAULT_ACTIVITY_BUFFER_SIZE_KB * 1024,
+            activity_buffer_count: DEFAULT_ACTIVITY_BUFFER_COUNT,
+            clock_sync_interval_ms: DEFAULT_CLOCK_SYNC_INTERVAL_MS,
+            activity_only: false,
+            aggregate_interval_ms: 0,
+            overhead: false,
+            overhead_summary: false,
+            always_on: false,
+            kernel_filter: None,
+            range_mode: RangeMode::default(),
+            pm_sampling_interval_us: 0,
+            pm_metrics: DEFAULT_PM_METRICS.iter().map(|s| s.to_string()).collect(),
+            spill_path: None,
         }
     }
 }
@@ -38,11 +132,234 @@ impl Config {
     ///
     /// - `INJECTION_VERBOSE`: specifices if verbose logging is enabled.
     /// - `INJECTION_METRICS`: semicolon or comma separated list of metrics.
+    /// - `INJECTION_FLUSH_PERIOD_MS`: activity flush period in milliseconds.
+    /// - `INJECTION_MAX_RANGES`: number of ranges buffered before decoding.
+    /// - `INJECTION_COUNTER_DATA_IMAGES`: number of counter data images each context rotates through.
+    /// - `INJECTION_DECODE_INTERVAL_MS`: time budget before buffered ranges are decoded.
+    /// - `INJECTION_SAMPLING`: `all`, `every:<n>`, `first:<k>` or `duty:<active_ms>/<period_ms>`.
+    /// - `INJECTION_MULTI_PASS`: spread metric passes across launches of each kernel.
+    /// - `INJECTION_ACTIVITY_BUFFER_SIZE_KB`: size of each activity buffer in KiB.
+    /// - `INJECTION_ACTIVITY_BUFFER_COUNT`: number of preallocated activity buffers.
+    /// - `INJECTION_CLOCK_SYNC_INTERVAL_MS`: interval at which the CUPTI clock is recalibrated.
+    /// - `INJECTION_ACTIVITY_ONLY`: trace kernels from activity records without the range profiler.
+    /// - `INJECTION_AGGREGATE_INTERVAL_MS`: emit per-kernel summaries over windows of this length.
+    /// - `INJECTION_OVERHEAD`: measure the injection's own overhead.
+    /// - `INJECTION_OVERHEAD_SUMMARY`: print the measured overhead at exit; implies `INJECTION_OVERHEAD`.
+    /// - `INJECTION_ALWAYS_ON`: profile kernels even when no tracing session is running.
+    /// - `INJECTION_KERNEL_INCLUDE`: comma separated kernel name patterns to range profile.
+    /// - `INJECTION_KERNEL_EXCLUDE`: comma separated kernel name patterns not to range profile.
+    /// - `INJECTION_RANGE_MODE`: `kernel`, or `nvtx[:<depth>]` to profile NVTX ranges.
+    /// - `INJECTION_PM_SAMPLING_INTERVAL_US`: sample GPU counters at this interval; implies
+    ///   `INJECTION_ACTIVITY_ONLY`.
+    /// - `INJECTION_PM_METRICS`: semicolon or comma separated list of PM sampling metrics.
+    /// - `INJECTION_SPILL_PATH`: spill counter data images to this file, `%p` replaced by the
+    ///   process id, for `cupti-spill-eval` instead of evaluating them.
     pub fn from_env() -> Self {
         let verbose = env::var("INJECTION_VERBOSE").is_ok();
         let metrics_str = env::var("INJECTION_METRICS").unwrap_or_default();
         let metrics = parse_metrics(&metrics_str);
+        let flush_period_ms =
+            parse_env("INJECTION_FLUSH_PERIOD_MS").unwrap_or(DEFAULT_FLUSH_PERIOD_MS);
+        let max_num_ranges = parse_env("INJECTION_MAX_RANGES")
+            .filter(|&n| n > 0)
+            .unwrap_or(DEFAULT_MAX_NUM_RANGES);
+        let counter_data_images = parse_env("INJECTION_COUNTER_DATA_IMAGES")
+            .filter(|&n| n > 0)
+            .unwrap_or(DEFAULT_COUNTER_DATA_IMAGES);
+        let decode_interval_ms =
+            parse_env("INJECTION_DECODE_INTERVAL_MS").unwrap_or(DEFAULT_DECODE_INTERVAL_MS);
+        let sampling = match env::var("INJECTION_SAMPLING") {
+            Ok(value) => value.parse().unwrap_or_else(|e| {
+                eprintln!("Ignoring INJECTION_SAMPLING: {}", e);
+                SamplingPolicy::default()
+            }),
+            Err(_) => SamplingPolicy::default(),
+        };
+        let multi_pass = env::var("INJECTION_MULTI_PASS").is_ok();
+        let activity_buffer_size = parse_env::<usize>("INJECTION_ACTIVITY_BUFFER_SIZE_KB")
+            .filter(|&n| n > 0)
+            .unwrap_or(DEFAULT_ACTIVITY_BUFFER_SIZE_KB)
+            * 1024;
+        let activity_buffer_count =
+            parse_env("INJECTION_ACTIVITY_BUFFER_COUNT").unwrap_or(DEFAULT_ACTIVITY_BUFFER_COUNT);
+        let clock_sync_interval_ms =
+            parse_env("INJECTION_CLOCK_SYNC_INTERVAL_MS").unwrap_or(DEFAULT_CLOCK_SYNC_INTERVAL_MS);
+        // The range profiler and PM sampling cannot share the counters of a device.
+        let pm_sampling_interval_us = parse_env("INJECTION_PM_SAMPLING_INTERVAL_US").unwrap_or(0);
+        let activity_only =
+            pm_sampling_interval_us > 0 || env::var("INJECTION_ACTIVITY_ONLY").is_ok();
+        let aggregate_interval_ms = parse_env("INJECTION_AGGREGATE_INTERVAL_MS").unwrap_or(0);
+        let overhead_summary = env::var("INJECTION_OVERHEAD_SUMMARY").is_ok();
+        let overhead = overhead_summary || env::var("INJECTION_OVERHEAD").is_ok();
+        let always_on = env::var("INJECTION_ALWAYS_ON").is_ok();
+        let patterns = |name| -> Vec<String> {
+            env::var(name)
+                .unwrap_or_default()
+                .split(',')
+                .map(str::trim)
+                .filter(|p| !p.is_empty())
+                .map(String::from)
+                .collect()
+        };
+        let kernel_filter = KernelFilter::new(
+            &patterns("INJECTION_KERNEL_INCLUDE"),
+            &patterns("INJECTION_KERNEL_EXCLUDE"),
+        )
+        .unwrap_or_else(|e| {
+            eprintln!("Ignoring kernel filter: {}", e);
+            None
+        })
+        .map(Arc::new);
+        let range_mode = match env::var("INJECTION_RANGE_MODE") {
+            Ok(value) => value.parse().unwrap_or_else(|e| {
+                eprintln!("Ignoring INJECTION_RANGE_MODE: {}", e);
+                RangeMode::default()
+            }),
+            Err(_) => RangeMode::default(),
+        };
+        let pm_metrics = match env::var("INJECTION_PM_METRICS") {
+            Ok(value) if !value.trim().is_empty() => parse_metrics(&value),
+            _ => DEFAULT_PM_METRICS.iter().map(|s| s.to_string()).collect(),
+        };
+        let spill_path = env::var("INJECTION_SPILL_PATH")
+            .ok()
+            .filter(|path| !path.is_empty());
+
+        Self {
+            verbose,
+            metrics,
+            flush_period_ms,
+            max_num_ranges,
+            counter_data_images,
+            decode_interval_ms,
+            sampling,
+            multi_pass,
+            activity_buffer_size,
+            activity_buffer_count,
+            clock_sync_interval_ms,
+            activity_only,
+            aggregate_interval_ms,
+            overhead,
+            overhead_summary,
+            always_on,
+            kernel_filter,
+            range_mode,
+            pm_sampling_interval_us,
+            pm_metrics,
+            spill_path,
+        }
+    }
+}
+
+/// Overrides of the environment configuration carried by a tracing session.
+///
+/// Unset fields keep the value from the environment.
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct SessionConfig {
+    pub metrics: Option<Vec<String>>,
+    pub sampling: Option<SamplingPolicy>,
+    pub max_num_ranges: Option<usize>,
+    pub activity_only: Option<bool>,
+    pub range_mode: Option<RangeMode>,
+}
+
+impl SessionConfig {
+    /// Parses whitespace separated `key=value` pairs.
+    ///
+    /// - `metrics`: semicolon or comma separated list of metrics.
+    /// - `sampling`: a policy as accepted by `INJECTION_SAMPLING`.
+    /// - `max_ranges`: number of ranges buffered before decoding.
+    /// - `activity_only`: `true` or `false`.
+    /// - `range_mode`: a mode as accepted by `INJECTION_RANGE_MODE`.
+    pub fn parse(input: &str) -> Result<Self, String> {
+        let mut config = Self::default();
+        for pair in input.split_whitespace() {
+            let (key, value) = pair
+                .split_once('=')
+                .ok_or_else(|| format!("expected key=value, got '{}'", pair))?;
+            match key {
+                "metrics" => config.metrics = Some(parse_metrics(value)),
+                "sampling" => config.sampling = Some(value.parse()?),
+                "max_ranges" => {
+                    config.max_num_ranges = Some(
+                        value
+                            .parse()
+                            .ok()
+                            .filter(|&n| n > 0)
+                            .ok_or_else(|| format!("invalid max_ranges '{}'", value))?,
+                    )
+                }
+                "activity_only" => {
+                    config.activity_only = Some(
+                        value
+                            .parse()
+                            .map_err(|_| format!("invalid activity_only '{}'", value))?,
+                    )
+                }
+                "range_mode" => config.range_mode = Some(value.parse()?),
+                _ => return Err(format!("unknown key '{}'", key)),
+            }
+        }
+        Ok(config)
+    }
+
+    /// Overrides the fields of `self` that are set in `other`.
+    pub fn merge(&mut self, other: &SessionConfig) {
+        if other.metrics.is_some() {
+            self.metrics = other.metrics.clone();
+        }
+        self.sampling = other.sampling.or(self.sampling);
+        self.max_num_ranges = other.max_num_ranges.or(self.max_num_ranges);
+        self.activity_only = other.activity_only.or(self.activity_only);
+        self.range_mode = other.range_mode.or(self.range_mode);
+    }
+
+    /// Returns `base` with the overrides applied.
+    pub fn apply(&self, base: &Config) -> Config {
+        let mut config = base.clone();
+        if let Some(metrics) = &self.metrics {
+            config.metrics = metrics.clone();
+        }
+        config.sampling = self.sampling.unwrap_or(base.sampling);
+        config.max_num_ranges = self.max_num_ranges.unwrap_or(base.max_num_ranges);
+        config.activity_only =
+            base.pm_sampling_interval_us > 0 || self.activity_only.unwrap_or(base.activity_only);
+        config.range_mode = self.range_mode.unwrap_or(base.range_mode);
+        config
+    }
+}
+
+/// Parses a numeric environment variable, returning `None` if unset or malformed.
+fn parse_env<T: FromStr>(name: &str) -> Option<T> {
+    env::var(name).ok().and_then(|v| v.trim().parse().ok())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_session_config_overrides_environment() {
+        let session =
+            SessionConfig::parse("metrics=a;b sampling=every:4\nactivity_only=true").unwrap();
+        let config = session.apply(&Config::default());
+        assert_eq!(config.metrics, ["a", "b"]);
+        assert_eq!(config.sampling, SamplingPolicy::EveryNth(4));
+        assert!(config.activity_only);
+        assert_eq!(config.max_num_ranges, DEFAULT_MAX_NUM_RANGES);
+
+        let mut merged = session.clone();
+        merged.merge(&SessionConfig::parse("activity_only=false max_ranges=8").unwrap());
+        assert_eq!(merged.metrics, session.metrics);
+        assert_eq!(merged.activity_only, Some(false));
+        assert_eq!(merged.max_num_ranges, Some(8));
+    }
 
-        Self { verbose, metrics }
+    #[test]
+    fn test_session_config_rejects_unknown_keys() {
+        assert!(SessionConfig::parse("").unwrap() == SessionConfig::default());
+        assert!(SessionConfig::parse("metric=a").is_err());
+        assert!(SessionConfig::parse("max_ranges=0").is_err());
+        assert!(SessionConfig::parse("sampling").is_err());
     }
 }
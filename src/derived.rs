@@ -0,0 +1,230 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::device::DeviceProperties;
+use crate::state::CompletedKernel;
+use cupti_profiler::bindings::*;
+use std::collections::HashMap;
+
+pub const NUM_DERIVED: usize = 15;
+
+/// Names of the derived metrics, in counter id order.
+pub const NAMES: [&str; NUM_DERIVED] = [
+    "launch__waves_per_multiprocessor",
+    "launch__grid_size",
+    "launch__block_size",
+    "launch__thread_count",
+    "launch__registers_per_thread",
+    "launch__shared_mem_config_size",
+    "launch__shared_mem_per_block_driver",
+    "launch__shared_mem_per_block_dynamic",
+    "launch__shared_mem_per_block_static",
+    "launch__occupancy_limit_shared_mem",
+    "launch__occupancy_limit_warps",
+    "launch__occupancy_limit_blocks",
+    "launch__occupancy_limit_registers",
+    "sm__maximum_warps_avg_per_active_cycle",
+    "sm__maximum_warps_per_active_cycle_pct",
+];
+
+/// Values of the derived metrics, indexed like `NAMES`.
+pub type DerivedValues = [f64; NUM_DERIVED];
+
+/// Entries after which `DerivedCache` starts over, so applications whose grid
+/// sizes never repeat do not grow it without bound.
+const MAX_ENTRIES: usize = 4096;
+
+/// Everything the derived metrics of a launch depend on.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct DerivedKey {
+    pub device_id: CUdevice,
+    pub grid_size: i64,
+    pub block_size: i64,
+    pub registers_per_thread: i32,
+    /// Registers per thread the occupancy limit is computed with.
+    pub num_regs: i32,
+    pub dynamic_smem: i32,
+    pub static_smem: i32,
+    pub shared_mem_config: u32,
+    pub max_active_blocks: i32,
+}
+
+impl DerivedKey {
+    pub fn new(kernel: &CompletedKernel) -> Self {
+        let (activity, attributes) = (&kernel.activity, &kernel.launch.attributes);
+        let (gx, gy, gz) = activity.grid_size;
+        let (bx, by, bz) = activity.block_size;
+        Self {
+            device_id: kernel.device.device_id,
+            grid_size: gx as i64 * gy as i64 * gz as i64,
+            block_size: bx as i64 * by as i64 * bz as i64,
+            registers_per_thread: activity.registers_per_thread as i32,
+            num_regs: attributes.num_regs,
+            dynamic_smem: activity.dynamic_shared_memory,
+            static_smem: activity.static_shared_memory,
+            shared_mem_config: activity.shared_memory_executed,
+            max_active_blocks: attributes.max_active_blocks,
+        }
+    }
+}
+
+/// Computes the launch statistics of `key` on `device`.
+///
+/// The shared memory limit uses the shared memory the driver configured for the
+/// launch, i.e. the carve-out it picked, or the device maximum if unknown.
+pub fn compute(device: &DeviceProperties, key: &DerivedKey) -> DerivedValues {
+    let ratio = |a: i64, b: i64| if b > 0 { a / b } else { 0 };
+    let smem_per_block = key.dynamic_smem as i64 + key.static_smem as i64;
+    let shared_mem_config = match key.shared_mem_config {
+        0 => device.smem_per_sm as i64,
+        size => size as i64,
+    };
+    let warps_per_block = ratio(key.block_size, device.warp_size as i64);
+    let max_warps_sm = ratio(device.max_threads_per_sm as i64, device.warp_size as i64);
+    let max_active_warps = key.max_active_blocks as i64 * warps_per_block;
+    let regs_per_block = key.num_regs as i64 * key.block_size;
+    let waves_per_multiprocessor = if device.num_sms > 0 && key.max_active_blocks > 0 {
+        key.grid_size as f64 / (device.num_sms as i64 * key.max_active_blocks as i64) as f64
+    } else {
+        0.0
+    };
+    let max_active_warps_pct = if max_warps_sm > 0 {
+        100.0 * max_active_warps as f64 / max_warps_sm as f64
+    } else {
+        0.0
+    };
+    let occupancy_limit_shared_mem = if smem_per_block != 0 {
+        shared_mem_config / smem_per_block
+    } else {
+        16
+    };
+    let occupancy_limit_registers = if regs_per_block != 0 {
+        device.regs_per_sm as i64 / regs_per_block
+    } else {
+        16
+    };
+    [
+        waves_per_multiprocessor,
+        key.grid_size as f64,
+        key.block_size as f64,
+        (key.grid_size * key.block_size) as f64,
+        key.registers_per_thread as f64,
+        shared_mem_config as f64,
+        smem_per_block as f64,
+        key.dynamic_smem as f64,
+        key.static_smem as f64,
+        occupancy_limit_shared_mem as f64,
+        ratio(max_warps_sm, warps_per_block) as f64,
+        device.max_blocks_per_sm as f64,
+        occupancy_limit_registers as f64,
+        max_active_warps as f64,
+        max_active_warps_pct,
+    ]
+}
+
+/// Memoizes derived metrics so each launch configuration is computed once.
+#[derive(Default)]
+pub struct DerivedCache {
+    entries: HashMap<DerivedKey, DerivedValues>,
+    /// The last configuration looked up; successive launches usually repeat it.
+    last: Option<(DerivedKey, DerivedValues)>,
+}
+
+impl DerivedCache {
+    /// Returns the derived metrics of `kernel`, computing them on first use of
+    /// its launch configuration.
+    pub fn get(&mut self, kernel: &CompletedKernel) -> DerivedValues {
+        let key = DerivedKey::new(kernel);
+        if let Some((last, values)) = &self.last {
+            if *last == key {
+                return *values;
+            }
+        }
+        let values = match self.entries.get(&key) {
+            Some(values) => *values,
+            None => {
+                if self.entries.len() >= MAX_ENTRIES {
+                    self.entries.clear();
+                }
+                *self
+                    .entries
+                    .entry(key)
+                    .or_insert_with(|| compute(&kernel.device, &key))
+            }
+        };
+        self.last = Some((key, values));
+        values
+    }
+
+    /// Number of launch configurations cached.
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns whether nothing is cached.
+    pub fn is_empty(&self) -> bool {
+        self.entries.is_empty()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn value(values: &DerivedValues, name: &str) -> f64 {
+        values[NAMES.iter().position(|n| *n == name).unwrap()]
+    }
+
+    #[test]
+    fn test_shared_mem_limit_uses_carveout() {
+        let device = DeviceProperties {
+            num_sms: 100,
+            warp_size: 32,
+            max_threads_per_sm: 2048,
+            max_blocks_per_sm: 32,
+            regs_per_sm: 65536,
+            smem_per_sm: 233472,
+            ..Default::default()
+        };
+        let key = DerivedKey {
+            device_id: 0,
+            grid_size: 800,
+            block_size: 256,
+            registers_per_thread: 32,
+            num_regs: 32,
+            dynamic_smem: 16384,
+            static_smem: 0,
+            shared_mem_config: 65536,
+            max_active_blocks: 4,
+        };
+        let values = compute(&device, &key);
+        assert_eq!(value(&values, "launch__shared_mem_config_size"), 65536.0);
+        assert_eq!(value(&values, "launch__occupancy_limit_shared_mem"), 4.0);
+        assert_eq!(value(&values, "launch__waves_per_multiprocessor"), 2.0);
+        assert_eq!(value(&values, "launch__thread_count"), 204800.0);
+        assert_eq!(value(&values, "launch__occupancy_limit_warps"), 8.0);
+        assert_eq!(
+            value(&values, "sm__maximum_warps_per_active_cycle_pct"),
+            50.0
+        );
+        // Without the executed size, the device maximum is assumed.
+        let unknown = DerivedKey {
+            shared_mem_config: 0,
+            ..key
+        };
+        let values = compute(&device, &unknown);
+        assert_eq!(value(&values, "launch__shared_mem_config_size"), 233472.0);
+        assert_eq!(value(&values, "launch__occupancy_limit_shared_mem"), 14.0);
+    }
+}
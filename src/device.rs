@@ -0,0 +1,250 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use cupti_profiler as profiler;
+use cupti_profiler::bindings::*;
+use std::collections::HashMap;
+
+/// Snapshot of the device attributes needed for launch statistics.
+///
+/// These never change for a device, so they are queried once at context creation.
+#[derive(Debug, Clone, Default)]
+pub struct DeviceProperties {
+    pub device_id: CUdevice,
+    pub num_sms: i32,
+    pub warp_size: i32,
+    pub max_threads_per_sm: i32,
+    pub max_blocks_per_sm: i32,
+    pub regs_per_sm: i32,
+    pub smem_per_sm: i32,
+    pub compute_capability: (i32, i32),
+}
+
+impl DeviceProperties {
+    /// Queries all attributes of `device_id` from the driver.
+    pub fn query(device_id: CUdevice) -> Self {
+        let attr = |attr: CUdevice_attribute, default: i32| {
+            profiler::get_device_attribute(device_id, attr).unwrap_or(default)
+        };
+        Self {
+            device_id,
+            num_sms: attr(
+                CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
+                0,
+            ),
+            warp_size: attr(CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_WARP_SIZE, 32),
+            max_threads_per_sm: attr(
+                CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR,
+                0,
+            ),
+            max_blocks_per_sm: attr(
+                CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_BLOCKS_PER_MULTIPROCESSOR,
+                0,
+            ),
+            regs_per_sm: attr(
+                CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_REGISTERS_PER_MULTIPROCESSOR,
+                0,
+            ),
+            smem_per_sm: attr(
+                CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_SHARED_MEMORY_PER_MULTIPROCESSOR,
+                0,
+            ),
+            compute_capability: (
+                attr(
+                    CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR,
+                    0,
+                ),
+                attr(
+                    CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR,
+                    0,
+                ),
+            ),
+        }
+    }
+}
+
+/// Function attributes and occupancy for one launch configuration.
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct FuncAttributes {
+    pub cache_mode: i32,
+    pub num_regs: i32,
+    pub max_active_blocks: i32,
+}
+
+impl FuncAttributes {
+    /// Queries the attributes of `func` launched with the given block and dynamic
+    /// shared memory sizes.
+    ///
+    /// # Safety
+    ///
+    /// The `func` pointer must be a valid CUDA function handle.
+    pub unsafe fn query(func: CUfunction, block_size: i32, dynamic_smem: usize) -> Self {
+        Self {
+            cache_mode: unsafe {
+                profiler::get_func_attribute(
+                    func,
+                    CUfunction_attribute_enum_CU_FUNC_ATTRIBUTE_CACHE_MODE_CA,
+                )
+            }
+            .unwrap_or(0),
+            num_regs: unsafe {
+                profiler::get_func_attribute(
+                    func,
+                    CUfunction_attribute_enum_CU_FUNC_ATTRIBUTE_NUM_REGS,
+                )
+            }
+            .unwrap_or(0),
+            max_active_blocks: unsafe {
+                profiler::occupancy_max_active_blocks_per_multiprocessor(
+                    func,
+                    block_size,
+                    dynamic_smem,
+                )
+            }
+            .unwrap_or(0),
+        }
+    }
+
+    /// Estimates the attributes of a launch whose function was never seen, from
+    /// the values reported in its activity record.
+    ///
+    /// Occupancy is the tightest of the per-SM block, warp, register and shared
+    /// memory limits; allocation granularities are ignored.
+    pub fn estimate(
+        device: &DeviceProperties,
+        cache_mode: i32,
+        num_regs: i32,
+        block_size: i32,
+        smem_per_block: i32,
+    ) -> Self {
+        let warps_per_block = if device.warp_size > 0 {
+            (block_size + device.warp_size - 1) / device.warp_size
+        } else {
+            0
+        };
+        let mut max_active_blocks = device.max_blocks_per_sm;
+        if warps_per_block > 0 && device.warp_size > 0 {
+            let max_warps = device.max_threads_per_sm / device.warp_size;
+            max_active_blocks = max_active_blocks.min(max_warps / warps_per_block);
+        }
+        if num_regs > 0 && block_size > 0 {
+            max_active_blocks = max_active_blocks.min(device.regs_per_sm / (num_regs * block_size));
+        }
+        if smem_per_block > 0 {
+            max_active_blocks = max_active_blocks.min(device.smem_per_sm / smem_per_block);
+        }
+        Self {
+            cache_mode,
+            num_regs,
+            max_active_blocks: max_active_blocks.max(0),
+        }
+    }
+}
+
+/// Key identifying a launch configuration of a function.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct FuncAttributesKey {
+    pub function: CUfunction,
+    pub block_size: i32,
+    pub dynamic_smem: usize,
+}
+
+/// Memoizes `FuncAttributes` so each distinct launch configuration is queried once.
+#[derive(Default)]
+pub struct FuncAttributeCache {
+    entries: HashMap<FuncAttributesKey, FuncAttributes>,
+}
+
+impl FuncAttributeCache {
+    /// Returns the cached attributes for `key`, calling `query` on first use.
+    pub fn get_or_query(
+        &mut self,
+        key: FuncAttributesKey,
+        query: impl FnOnce() -> FuncAttributes,
+    ) -> FuncAttributes {
+        *self.entries.entry(key).or_insert_with(query)
+    }
+
+    /// Number of distinct launch configurations seen.
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns whether no launch configuration has been cached yet.
+    pub fn is_empty(&self) -> bool {
+        self.entries.is_empty()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_func_attribute_cache_queries_once_per_key() {
+        let mut cache = FuncAttributeCache::default();
+        let key = FuncAttributesKey {
+            function: std::ptr::null_mut(),
+            block_size: 128,
+            dynamic_smem: 0,
+        };
+        let mut queries = 0;
+        for _ in 0..3 {
+            let attrs = cache.get_or_query(key, || {
+                queries += 1;
+                FuncAttributes {
+                    cache_mode: 0,
+                    num_regs: 32,
+                    max_active_blocks: 4,
+                }
+            });
+            assert_eq!(attrs.num_regs, 32);
+        }
+        assert_eq!(queries, 1);
+
+        let other = FuncAttributesKey {
+            block_size: 256,
+            ..key
+        };
+        cache.get_or_query(other, FuncAttributes::default);
+        assert_eq!(cache.len(), 2);
+    }
+
+    #[test]
+    fn test_estimate_takes_tightest_limit() {
+        let device = DeviceProperties {
+            warp_size: 32,
+            max_threads_per_sm: 2048,
+            max_blocks_per_sm: 32,
+            regs_per_sm: 65536,
+            smem_per_sm: 102400,
+            ..Default::default()
+        };
+        // Warps limit 256-thread blocks to 8 per SM.
+        assert_eq!(
+            FuncAttributes::estimate(&device, 0, 32, 256, 0).max_active_blocks,
+            8
+        );
+        // 64 registers per thread leave room for 4.
+        assert_eq!(
+            FuncAttributes::estimate(&device, 0, 64, 256, 0).max_active_blocks,
+            4
+        );
+        // 48 KiB of shared memory per block leave room for 2.
+        assert_eq!(
+            FuncAttributes::estimate(&device, 0, 32, 256, 49152).max_active_blocks,
+            2
+        );
+    }
+}
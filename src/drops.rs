@@ -0,0 +1,128 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::emission::{describe_once, DROP_COUNTER_BASE};
+use crate::tracing::{get_data_source, trace_time_ns, GOT_FIRST_DROPS};
+use perfetto_sdk::{
+    data_source::TraceContext,
+    protos::{common::builtin_clock::BuiltinClock, trace::trace_packet::TracePacket},
+};
+use perfetto_sdk_protos_gpu::protos::{
+    common::gpu_counter_descriptor::GpuCounterDescriptorGpuCounterGroup,
+    trace::{
+        gpu::gpu_counter_event::{GpuCounter, GpuCounterEvent},
+        trace_packet::TracePacketExt,
+    },
+};
+use std::sync::{
+    atomic::{AtomicU64, Ordering},
+    Mutex,
+};
+
+/// Why kernels lost their counters.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DropReason {
+    /// The counter data image was full; CUPTI dropped the range.
+    ImageFull,
+    /// The evaluation worker was too far behind, so the image was not evaluated.
+    Backlog,
+    /// The activity record of the launch never arrived, so the kernel is not
+    /// written at all.
+    NoActivity,
+}
+
+const NUM_REASONS: usize = 3;
+
+impl DropReason {
+    pub const ALL: [DropReason; NUM_REASONS] = [
+        DropReason::ImageFull,
+        DropReason::Backlog,
+        DropReason::NoActivity,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            DropReason::ImageFull => "injection.ranges_dropped.image_full",
+            DropReason::Backlog => "injection.ranges_dropped.backlog",
+            DropReason::NoActivity => "injection.kernels_dropped.no_activity",
+        }
+    }
+}
+
+static DROPPED: [AtomicU64; NUM_REASONS] = [const { AtomicU64::new(0) }; NUM_REASONS];
+/// Totals last written to the trace.
+static REPORTED: Mutex<[u64; NUM_REASONS]> = Mutex::new([0; NUM_REASONS]);
+
+/// Counts `ranges` whose kernels are written without counters, or kernels that
+/// are not written, for `reason`.
+pub fn count(reason: DropReason, ranges: usize) {
+    if ranges > 0 {
+        DROPPED[reason as usize].fetch_add(ranges as u64, Ordering::Relaxed);
+    }
+}
+
+/// Returns the number of ranges dropped for `reason` so far.
+pub fn dropped(reason: DropReason) -> u64 {
+    DROPPED[reason as usize].load(Ordering::Relaxed)
+}
+
+/// Writes the drop totals as counters of the GPU counters data source, if they
+/// changed since they were last written.
+pub fn report() {
+    let totals = DropReason::ALL.map(dropped);
+    match REPORTED.lock() {
+        Ok(mut reported) if *reported != totals => *reported = totals,
+        _ => return,
+    }
+    let now = trace_time_ns();
+    get_data_source().trace(|ctx: &mut TraceContext| {
+        describe_once(
+            ctx,
+            now,
+            &GOT_FIRST_DROPS,
+            DROP_COUNTER_BASE,
+            &DropReason::ALL.map(DropReason::name),
+            GpuCounterDescriptorGpuCounterGroup::System,
+        );
+        ctx.add_packet(|packet: &mut TracePacket| {
+            packet
+                .set_timestamp(now)
+                .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
+                .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
+                    for (i, total) in totals.iter().enumerate() {
+                        event.set_counters(|counter: &mut GpuCounter| {
+                            counter
+                                .set_counter_id(DROP_COUNTER_BASE + i as u32)
+                                .set_int_value(*total as i64);
+                        });
+                    }
+                });
+        });
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_count_by_reason() {
+        let before = DropReason::ALL.map(dropped);
+        count(DropReason::Backlog, 3);
+        count(DropReason::ImageFull, 0);
+        assert_eq!(dropped(DropReason::Backlog), before[1] + 3);
+        assert_eq!(dropped(DropReason::ImageFull), before[0]);
+        assert_ne!(DropReason::Backlog.name(), DropReason::ImageFull.name());
+    }
+}
@@ -0,0 +1,809 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::aggregation::{AggregateWindow, KernelKey, KernelStats, AGGREGATOR};
+use crate::clock::CLOCK_SYNC;
+use crate::config::Config;
+use crate::derived::{self, DerivedCache, DerivedValues};
+use crate::drops::DropReason;
+use crate::overhead::{Probe, Timer};
+use crate::spill;
+use crate::state::{CompletedKernel, UserRange};
+use crate::tracing::{
+    get_data_source, get_next_event_id, trace_time_ns, DESCRIBED_COUNTERS, GOT_FIRST_DERIVED,
+};
+
+use cpp_demangle::Symbol;
+use cupti_profiler::bindings::*;
+use cupti_profiler::{MetricSet, RangeInfo};
+use once_cell::sync::Lazy;
+use perfetto_sdk::{
+    data_source::TraceContext,
+    protos::{
+        common::builtin_clock::BuiltinClock,
+        trace::{
+            interned_data::interned_data::InternedData,
+            trace_packet::{TracePacket, TracePacketSequenceFlags},
+        },
+    },
+};
+use perfetto_sdk_protos_gpu::protos::{
+    common::gpu_counter_descriptor::{
+        GpuCounterDescriptor, GpuCounterDescriptorGpuCounterGroup, GpuCounterSpec,
+    },
+    trace::{
+        gpu::{
+            gpu_counter_event::{GpuCounter, GpuCounterEvent},
+            gpu_render_stage_event::{
+                ExtraData, GpuRenderStageEvent, InternedGpuRenderStageSpecification,
+                InternedGpuRenderStageSpecificationRenderStageCategory as RenderStageCategory,
+            },
+        },
+        interned_data::interned_data::InternedDataExt,
+        trace_packet::TracePacketExt,
+    },
+};
+use std::{
+    cell::RefCell,
+    collections::{HashMap, HashSet},
+    sync::{
+        atomic::{AtomicU8, Ordering},
+        Arc, Mutex,
+    },
+};
+
+/// Process identification emitted with every kernel.
+struct ProcessInfo {
+    id: String,
+    name: String,
+}
+
+static PROCESS_INFO: Lazy<ProcessInfo> = Lazy::new(|| ProcessInfo {
+    id: unsafe { libc::getpid() }.to_string(),
+    name: std::fs::read_to_string("/proc/self/comm")
+        .unwrap_or_else(|_| "unknown".to_string())
+        .trim_end_matches('\n')
+        .to_owned(),
+});
+
+/// Number of events written per `trace()` call.
+///
+/// A large backlog, e.g. at exit, is written in bounded chunks, so the buffer
+/// exhausted policy applies to each chunk rather than to one unbounded write.
+pub const EMIT_CHUNK_SIZE: usize = 64;
+
+/// Interning id of the single hardware queue kernels are emitted on.
+const HW_QUEUE_IID: u64 = 1;
+
+/// A kernel name with its interning id and demangled form.
+struct KernelName {
+    iid: u64,
+    demangled: String,
+}
+
+/// Process-wide registry of kernel names.
+///
+/// Each distinct mangled name is demangled once and gets a stable interning id,
+/// so sequences only need to track which ids they have already emitted.
+#[derive(Default)]
+struct KernelNames {
+    names: HashMap<String, Arc<KernelName>>,
+}
+
+impl KernelNames {
+    fn get(&mut self, mangled: &str) -> Arc<KernelName> {
+        if let Some(name) = self.names.get(mangled) {
+            return name.clone();
+        }
+        let name = Arc::new(KernelName {
+            iid: HW_QUEUE_IID + 1 + self.names.len() as u64,
+            demangled: demangle(mangled),
+        });
+        self.names.insert(mangled.to_string(), name.clone());
+        name
+    }
+}
+
+static KERNEL_NAMES: Lazy<Mutex<KernelNames>> = Lazy::new(Default::default);
+
+/// Counter ids on the GPU counter data source. Each kind of counter takes the
+/// ids from its base up to the next one.
+pub const METRIC_COUNTER_BASE: u32 = 0;
+pub const PM_SAMPLING_COUNTER_BASE: u32 = 1 << 15;
+pub const DERIVED_COUNTER_BASE: u32 = (1 << 16) - 64;
+pub const DROP_COUNTER_BASE: u32 = (1 << 16) - 16;
+/// The overhead counters are on their own data source, past all of the above.
+pub const OVERHEAD_COUNTER_BASE: u32 = 1 << 16;
+
+const MAX_COUNTERS: usize = (PM_SAMPLING_COUNTER_BASE - METRIC_COUNTER_BASE) as usize;
+
+const _: () = assert!(derived::NUM_DERIVED as u32 <= DROP_COUNTER_BASE - DERIVED_COUNTER_BASE);
+const _: () = assert!(DropReason::ALL.len() as u32 <= OVERHEAD_COUNTER_BASE - DROP_COUNTER_BASE);
+
+/// Process-wide registry of metric counters.
+///
+/// Each distinct metric name gets a stable counter id on first use, so counters
+/// keep their meaning when a later session configures other metrics, and each
+/// instance only needs to describe the ids it has not seen yet.
+#[derive(Default)]
+struct CounterNames {
+    ids: HashMap<String, u32>,
+    names: Vec<String>,
+}
+
+impl CounterNames {
+    /// Returns the counter id of `name`, or `None` once the ids are exhausted.
+    fn get(&mut self, name: &str) -> Option<u32> {
+        if let Some(id) = self.ids.get(name) {
+            return Some(*id);
+        }
+        if self.names.len() >= MAX_COUNTERS {
+            return None;
+        }
+        let id = METRIC_COUNTER_BASE + self.names.len() as u32;
+        self.ids.insert(name.to_string(), id);
+        self.names.push(name.to_string());
+        Some(id)
+    }
+
+    /// Returns the id of the first counter not yet described on `inst_id` and
+    /// the names from there on, and marks them described.
+    fn undescribed(&self, inst_id: u32) -> (u32, &[String]) {
+        let first = DESCRIBED_COUNTERS
+            .get(inst_id as usize)
+            .map_or(self.names.len(), |described| {
+                described.swap(self.names.len(), Ordering::SeqCst)
+            })
+            .min(self.names.len());
+        (METRIC_COUNTER_BASE + first as u32, &self.names[first..])
+    }
+}
+
+static COUNTER_NAMES: Lazy<Mutex<CounterNames>> = Lazy::new(Default::default);
+
+static DERIVED: Lazy<Mutex<DerivedCache>> = Lazy::new(Default::default);
+
+thread_local! {
+    /// Interning ids already emitted on this thread's sequence, per data source instance.
+    static EMITTED_IIDS: RefCell<HashMap<u32, HashSet<u64>>> = RefCell::new(HashMap::new());
+}
+
+/// Demangles a kernel name, returning it unchanged if it is not a C++ symbol.
+pub fn demangle(mangled: &str) -> String {
+    match Symbol::new(mangled) {
+        Ok(sym) => sym.demangle().unwrap_or_else(|_| mangled.to_string()),
+        Err(_) => mangled.to_string(),
+    }
+}
+
+/// Writes trace packets for a batch of completed kernels.
+///
+/// Called as soon as launches have both their metrics and activity records, so
+/// each batch is written to every active data source instance and then dropped.
+pub fn emit_kernels(kernels: &[CompletedKernel], config: &Config) {
+    if kernels.is_empty() {
+        return;
+    }
+    let _timer = Timer::start(Probe::Emission);
+    if spill::is_spilling() {
+        spill::spill_kernels(kernels);
+    }
+    // In aggregation mode kernels are only folded into per-kernel summaries,
+    // which are written once the window has elapsed.
+    if config.aggregate_interval_ms > 0 {
+        let now = trace_time_ns();
+        let window = match AGGREGATOR.lock() {
+            Ok(mut aggregator) => {
+                kernels.iter().for_each(|kernel| aggregator.add(kernel));
+                aggregator.take_if_due(now, config.aggregate_interval_ms * 1_000_000)
+            }
+            Err(_) => return,
+        };
+        if let Some(window) = window {
+            emit_window(&window, config.verbose);
+        }
+        return;
+    }
+    let counter_ids = CounterIds::new(kernels.iter().filter_map(|kernel| kernel.range.as_ref()));
+    let derived: Vec<DerivedValues> = match DERIVED.lock() {
+        Ok(mut cache) => kernels.iter().map(|kernel| cache.get(kernel)).collect(),
+        Err(_) => return,
+    };
+    for (chunk, derived) in kernels
+        .chunks(EMIT_CHUNK_SIZE)
+        .zip(derived.chunks(EMIT_CHUNK_SIZE))
+    {
+        get_data_source().trace(|ctx: &mut TraceContext| {
+            let inst_id = ctx.instance_index();
+            for (kernel, derived) in chunk.iter().zip(derived) {
+                emit_kernel(ctx, inst_id, kernel, derived, &counter_ids, config.verbose);
+            }
+        });
+    }
+}
+
+/// Counter id of every metric id, for each distinct metric set in a batch.
+///
+/// Ranges of a batch share a handful of metric sets, so names are only looked
+/// up once per set rather than once per range.
+struct CounterIds {
+    sets: Vec<(*const MetricSet, Vec<Option<u32>>)>,
+}
+
+impl CounterIds {
+    fn new<'a>(ranges: impl IntoIterator<Item = &'a RangeInfo>) -> Self {
+        let mut sets: Vec<(*const MetricSet, Vec<Option<u32>>)> = Vec::new();
+        let mut ranges = ranges.into_iter().peekable();
+        if ranges.peek().is_none() {
+            return Self { sets };
+        }
+        let mut counter_names = match COUNTER_NAMES.lock() {
+            Ok(counter_names) => counter_names,
+            Err(_) => return Self { sets },
+        };
+        for range in ranges {
+            let set = Arc::as_ptr(range.metrics());
+            if sets.iter().all(|(s, _)| *s != set) {
+                let ids = range
+                    .metrics()
+                    .names()
+                    .iter()
+                    .map(|name| counter_names.get(name))
+                    .collect();
+                sets.push((set, ids));
+            }
+        }
+        Self { sets }
+    }
+
+    fn get(&self, metrics: &Arc<MetricSet>) -> &[Option<u32>] {
+        let set = Arc::as_ptr(metrics);
+        self.sets
+            .iter()
+            .find(|(s, _)| *s == set)
+            .map(|(_, ids)| ids.as_slice())
+            .unwrap_or(&[])
+    }
+}
+
+/// Writes one render stage event for `kernel_name` on the hardware queue.
+///
+/// Stage and queue names are interned once per sequence; the kernel names are
+/// carried by the stage specification instead of per-event extra data.
+fn add_render_stage_packet(
+    ctx: &mut TraceContext,
+    inst_id: u32,
+    was_cleared: bool,
+    timestamp: u64,
+    mangled: &str,
+    kernel_name: &KernelName,
+    write_event: impl FnOnce(&mut GpuRenderStageEvent),
+) {
+    let intern_kernel = EMITTED_IIDS.with(|emitted| {
+        let mut emitted = emitted.borrow_mut();
+        let emitted = emitted.entry(inst_id).or_default();
+        if was_cleared {
+            emitted.clear();
+        }
+        emitted.insert(kernel_name.iid)
+    });
+    ctx.add_packet(|packet: &mut TracePacket| {
+        let mut sequence_flags: u32 = TracePacketSequenceFlags::SeqNeedsIncrementalState.into();
+        if was_cleared {
+            sequence_flags |= u32::from(TracePacketSequenceFlags::SeqIncrementalStateCleared);
+        }
+        packet
+            .set_timestamp(timestamp)
+            .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
+            .set_sequence_flags(sequence_flags);
+        if was_cleared || intern_kernel {
+            packet.set_interned_data(|interned: &mut InternedData| {
+                if was_cleared {
+                    interned.set_gpu_specifications(
+                        |spec: &mut InternedGpuRenderStageSpecification| {
+                            spec.set_iid(HW_QUEUE_IID).set_name("Queue (0)");
+                        },
+                    );
+                }
+                if intern_kernel {
+                    interned.set_gpu_specifications(
+                        |spec: &mut InternedGpuRenderStageSpecification| {
+                            spec.set_iid(kernel_name.iid)
+                                .set_name(&kernel_name.demangled)
+                                .set_description(mangled)
+                                .set_category(RenderStageCategory::Compute);
+                        },
+                    );
+                }
+            });
+        }
+        packet.set_gpu_render_stage_event(|event: &mut GpuRenderStageEvent| {
+            event
+                .set_event_id(get_next_event_id())
+                .set_hw_queue_iid(HW_QUEUE_IID)
+                .set_stage_iid(kernel_name.iid);
+            write_event(event);
+        });
+    });
+}
+
+/// Writes one render stage event per kernel configuration of an aggregation
+/// window, spanning the window and carrying the summaries as extra data.
+fn emit_window(window: &AggregateWindow, verbose: bool) {
+    let kernel_names: Vec<Arc<KernelName>> = match KERNEL_NAMES.lock() {
+        Ok(mut names) => window
+            .kernels
+            .iter()
+            .map(|(key, _)| names.get(&key.kernel_name))
+            .collect(),
+        Err(_) => return,
+    };
+    let extra_data = |key: &KernelKey, stats: &KernelStats, emit: &mut dyn FnMut(&str, &str)| {
+        emit("process_id", &PROCESS_INFO.id);
+        emit("process_name", &PROCESS_INFO.name);
+        emit("launch_count", &stats.duration.count().to_string());
+        emit("duration_ns.total", &stats.duration.sum().to_string());
+        emit(
+            "launch__grid_size",
+            &format!(
+                "{}x{}x{}",
+                key.grid_size.0, key.grid_size.1, key.grid_size.2
+            ),
+        );
+        emit(
+            "launch__block_size",
+            &format!(
+                "{}x{}x{}",
+                key.block_size.0, key.block_size.1, key.block_size.2
+            ),
+        );
+        let series = std::iter::once(("duration_ns", &stats.duration))
+            .chain(stats.metrics.iter().map(|(name, s)| (name.as_str(), s)));
+        for (name, summary) in series {
+            emit(&format!("{}.mean", name), &summary.mean().to_string());
+            emit(&format!("{}.min", name), &summary.min().to_string());
+            emit(&format!("{}.max", name), &summary.max().to_string());
+            emit(&format!("{}.p50", name), &summary.quantile(0.5).to_string());
+            emit(
+                &format!("{}.p99", name),
+                &summary.quantile(0.99).to_string(),
+            );
+        }
+    };
+    if verbose {
+        for ((key, stats), kernel_name) in window.kernels.iter().zip(&kernel_names) {
+            println!("Kernel Summary: {}", kernel_name.demangled);
+            extra_data(key, stats, &mut |name: &str, value: &str| {
+                println!("{}: {}", name, value);
+            });
+            println!();
+        }
+    }
+    for (kernels, kernel_names) in window
+        .kernels
+        .chunks(EMIT_CHUNK_SIZE)
+        .zip(kernel_names.chunks(EMIT_CHUNK_SIZE))
+    {
+        get_data_source().trace(|ctx: &mut TraceContext| {
+            let inst_id = ctx.instance_index();
+            ctx.with_incremental_state(|ctx: &mut TraceContext, state| {
+                let was_cleared = std::mem::replace(&mut state.was_cleared, false);
+                for (i, ((key, stats), kernel_name)) in kernels.iter().zip(kernel_names).enumerate()
+                {
+                    add_render_stage_packet(
+                        ctx,
+                        inst_id,
+                        was_cleared && i == 0,
+                        window.start,
+                        &key.kernel_name,
+                        kernel_name,
+                        |event: &mut GpuRenderStageEvent| {
+                            event.set_duration(window.end.saturating_sub(window.start));
+                            extra_data(key, stats, &mut |name: &str, value: &str| {
+                                event.set_extra_data(|extra_data: &mut ExtraData| {
+                                    extra_data.set_name(name);
+                                    extra_data.set_value(value);
+                                });
+                            });
+                        },
+                    );
+                }
+            });
+        });
+    }
+}
+
+/// Writes the summaries of the current aggregation window, e.g. at exit.
+pub fn flush_aggregates(config: &Config) {
+    close_window(config, false);
+}
+
+/// Writes the summaries of the current aggregation window if it has elapsed,
+/// so windows also close while no kernels complete.
+pub fn flush_due_aggregates(config: &Config) {
+    close_window(config, true);
+}
+
+fn close_window(config: &Config, due_only: bool) {
+    if config.aggregate_interval_ms == 0 {
+        return;
+    }
+    let now = trace_time_ns();
+    let window = match AGGREGATOR.lock() {
+        Ok(mut aggregator) if due_only => {
+            aggregator.take_if_due(now, config.aggregate_interval_ms * 1_000_000)
+        }
+        Ok(mut aggregator) => aggregator.take(now),
+        Err(_) => return,
+    };
+    if let Some(window) = window {
+        emit_window(&window, config.verbose);
+    }
+}
+
+fn emit_kernel(
+    ctx: &mut TraceContext,
+    inst_id: u32,
+    kernel: &CompletedKernel,
+    derived: &DerivedValues,
+    counter_ids: &CounterIds,
+    verbose: bool,
+) {
+    let CompletedKernel {
+        device,
+        launch,
+        activity,
+        range,
+    } = kernel;
+    // Kernels are placed at their GPU execution interval from the activity record,
+    // mapped onto the trace clock. The launch time is used until the clocks are
+    // calibrated.
+    let timestamp = CLOCK_SYNC
+        .to_trace_time(activity.start)
+        .unwrap_or(launch.timestamp);
+    let duration = activity.end.saturating_sub(activity.start);
+    let kernel_name = match KERNEL_NAMES.lock() {
+        Ok(mut names) => names.get(&activity.kernel_name),
+        Err(_) => return,
+    };
+    let cache_mode = launch.attributes.cache_mode;
+    let (major, minor) = device.compute_capability;
+    // Emit static properties as extra data of the render stage event; numeric
+    // launch statistics are derived counters.
+    let extra_data = |emit: &mut dyn FnMut(&str, &str)| {
+        emit("kernel_type", "Compute");
+        emit("process_id", &PROCESS_INFO.id);
+        emit("process_name", &PROCESS_INFO.name);
+        emit("arch", &format!("CC_{}{}", major, minor));
+        #[allow(nonstandard_style)]
+        match cache_mode as u32 {
+            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_NONE => {
+                emit("launch__func_cache_config", "CachePreferNone")
+            }
+            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_SHARED => {
+                emit("launch__func_cache_config", "CachePreferShared")
+            }
+            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_L1 => {
+                emit("launch__func_cache_config", "CachePreferL1")
+            }
+            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_EQUAL => {
+                emit("launch__func_cache_config", "CachePreferEqual")
+            }
+            _ => emit("launch__func_cache_config", "n/a"),
+        }
+        #[allow(nonstandard_style)]
+        match activity.launch_type as u32 {
+            CUpti_ActivityLaunchType_CUPTI_ACTIVITY_LAUNCH_TYPE_COOPERATIVE_SINGLE_DEVICE
+            | CUpti_ActivityLaunchType_CUPTI_ACTIVITY_LAUNCH_TYPE_COOPERATIVE_MULTI_DEVICE => {
+                emit("launch__type", "Cooperative")
+            }
+            _ => emit("launch__type", "Regular"),
+        }
+        if activity.graph_id != 0 {
+            emit("launch__graph_id", &activity.graph_id.to_string());
+            emit("launch__graph_node_id", &activity.graph_node_id.to_string());
+        }
+        emit("launch__grid_size_x", &activity.grid_size.0.to_string());
+        emit("launch__grid_size_y", &activity.grid_size.1.to_string());
+        emit("launch__grid_size_z", &activity.grid_size.2.to_string());
+        emit("launch__block_size_x", &activity.block_size.0.to_string());
+        emit("launch__block_size_y", &activity.block_size.1.to_string());
+        emit("launch__block_size_z", &activity.block_size.2.to_string());
+    };
+    if verbose {
+        println!("Kernel Name: {}", activity.kernel_name);
+        println!("Kernel Demangled Name: {}", kernel_name.demangled);
+        println!("Timestamp: {}", timestamp);
+        println!("Duration: {}", duration);
+        println!(
+            "-----------------------------------------------------------------------------------"
+        );
+        extra_data(&mut |name: &str, value: &str| {
+            println!("{}: {}", name, value);
+        });
+        for (name, value) in derived::NAMES.iter().zip(derived) {
+            println!("{}: {}", name, value);
+        }
+        if let Some(range) = range {
+            for (id, value) in range.iter() {
+                println!("{}: {}", range.metrics().name(id), value);
+            }
+        }
+        println!(
+            "-----------------------------------------------------------------------------------\n"
+        );
+    }
+    ctx.with_incremental_state(|ctx: &mut TraceContext, state| {
+        let was_cleared = std::mem::replace(&mut state.was_cleared, false);
+        add_render_stage_packet(
+            ctx,
+            inst_id,
+            was_cleared,
+            timestamp,
+            &activity.kernel_name,
+            &kernel_name,
+            |event: &mut GpuRenderStageEvent| {
+                event.set_duration(duration);
+                extra_data(&mut |name: &str, value: &str| {
+                    event.set_extra_data(|extra_data: &mut ExtraData| {
+                        extra_data.set_name(name);
+                        extra_data.set_value(value);
+                    });
+                });
+            },
+        );
+        add_counter_packets(
+            ctx,
+            inst_id,
+            timestamp,
+            timestamp + duration,
+            range.as_ref(),
+            Some(derived),
+            counter_ids,
+        );
+    });
+}
+
+/// Writes the descriptor of counters `first_id..`, one per name in `names`.
+///
+/// Every set of counters on the data source is described on each instance
+/// before its first values.
+pub fn add_counter_descriptor(
+    ctx: &mut TraceContext,
+    timestamp: u64,
+    first_id: u32,
+    names: &[impl AsRef<str>],
+    group: GpuCounterDescriptorGpuCounterGroup,
+) {
+    ctx.add_packet(|packet: &mut TracePacket| {
+        packet
+            .set_timestamp(timestamp)
+            .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
+            .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
+                event.set_counter_descriptor(|desc: &mut GpuCounterDescriptor| {
+                    for (i, name) in names.iter().enumerate() {
+                        desc.set_specs(|spec: &mut GpuCounterSpec| {
+                            spec.set_counter_id(first_id + i as u32);
+                            spec.set_name(name.as_ref());
+                            spec.set_groups(group);
+                        });
+                    }
+                });
+            });
+    });
+}
+
+/// Writes the descriptor of counters `base..` unless the bit of this instance in
+/// `mask` shows they are already described.
+pub fn describe_once(
+    ctx: &mut TraceContext,
+    timestamp: u64,
+    mask: &AtomicU8,
+    base: u32,
+    names: &[impl AsRef<str>],
+    group: GpuCounterDescriptorGpuCounterGroup,
+) {
+    let bit = 1 << ctx.instance_index();
+    if mask.fetch_or(bit, Ordering::SeqCst) & bit == 0 {
+        add_counter_descriptor(ctx, timestamp, base, names, group);
+    }
+}
+
+/// Writes the counters of `range` and the `derived` metrics as a zero sample at
+/// `start` followed by the values at `end`. Metric counters are described on
+/// each data source instance as their names first appear; the derived metrics
+/// with their first values.
+fn add_counter_packets(
+    ctx: &mut TraceContext,
+    inst_id: u32,
+    start: u64,
+    end: u64,
+    range: Option<&RangeInfo>,
+    derived: Option<&DerivedValues>,
+    counter_ids: &CounterIds,
+) {
+    let mut counters: Vec<(u32, f64)> = Vec::new();
+    if let Some(range) = range {
+        if let Ok(counter_names) = COUNTER_NAMES.lock() {
+            let (first_id, names) = counter_names.undescribed(inst_id);
+            if !names.is_empty() {
+                add_counter_descriptor(
+                    ctx,
+                    start,
+                    first_id,
+                    names,
+                    GpuCounterDescriptorGpuCounterGroup::Compute,
+                );
+            }
+        }
+        let ids = counter_ids.get(range.metrics());
+        counters.extend(
+            range
+                .iter()
+                .filter_map(|(id, value)| ids.get(id).copied().flatten().map(|id| (id, value))),
+        );
+    }
+    if let Some(derived) = derived {
+        describe_once(
+            ctx,
+            start,
+            &GOT_FIRST_DERIVED,
+            DERIVED_COUNTER_BASE,
+            &derived::NAMES,
+            GpuCounterDescriptorGpuCounterGroup::Compute,
+        );
+        counters.extend(
+            derived
+                .iter()
+                .enumerate()
+                .map(|(i, value)| (DERIVED_COUNTER_BASE + i as u32, *value)),
+        );
+    }
+    if counters.is_empty() {
+        return;
+    }
+    ctx.add_packet(|packet: &mut TracePacket| {
+        packet
+            .set_timestamp(start)
+            .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
+            .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
+                for (id, _) in &counters {
+                    event.set_counters(|counter: &mut GpuCounter| {
+                        counter.set_counter_id(*id).set_int_value(0);
+                    });
+                }
+            });
+    });
+    ctx.add_packet(|packet: &mut TracePacket| {
+        packet
+            .set_timestamp(end)
+            .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
+            .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
+                for (id, value) in &counters {
+                    event.set_counters(|counter: &mut GpuCounter| {
+                        counter.set_counter_id(*id).set_double_value(*value);
+                    });
+                }
+            });
+    });
+}
+
+/// Writes one render stage event per profiled NVTX range, spanning the host
+/// time between push and pop, with the counters collected over the range.
+pub fn emit_user_ranges(ranges: &[(UserRange, RangeInfo)], config: &Config) {
+    if ranges.is_empty() {
+        return;
+    }
+    let _timer = Timer::start(Probe::Emission);
+    let range_names: Vec<Arc<KernelName>> = match KERNEL_NAMES.lock() {
+        Ok(mut names) => ranges
+            .iter()
+            .map(|(user_range, _)| names.get(&user_range.name))
+            .collect(),
+        Err(_) => return,
+    };
+    let extra_data = |emit: &mut dyn FnMut(&str, &str)| {
+        emit("range_type", "nvtx");
+        emit("process_id", &PROCESS_INFO.id);
+        emit("process_name", &PROCESS_INFO.name);
+    };
+    if config.verbose {
+        for (user_range, range) in ranges {
+            println!("NVTX Range: {}", user_range.name);
+            println!("Timestamp: {}", user_range.start);
+            println!("Duration: {}", user_range.end - user_range.start);
+            for (id, value) in range.iter() {
+                println!("{}: {}", range.metrics().name(id), value);
+            }
+            println!();
+        }
+    }
+    let counter_ids = CounterIds::new(ranges.iter().map(|(_, range)| range));
+    for (ranges, range_names) in ranges
+        .chunks(EMIT_CHUNK_SIZE)
+        .zip(range_names.chunks(EMIT_CHUNK_SIZE))
+    {
+        get_data_source().trace(|ctx: &mut TraceContext| {
+            let inst_id = ctx.instance_index();
+            ctx.with_incremental_state(|ctx: &mut TraceContext, state| {
+                let was_cleared = std::mem::replace(&mut state.was_cleared, false);
+                for (i, ((user_range, range), range_name)) in
+                    ranges.iter().zip(range_names).enumerate()
+                {
+                    add_render_stage_packet(
+                        ctx,
+                        inst_id,
+                        was_cleared && i == 0,
+                        user_range.start,
+                        &user_range.name,
+                        range_name,
+                        |event: &mut GpuRenderStageEvent| {
+                            event.set_duration(user_range.end - user_range.start);
+                            extra_data(&mut |name: &str, value: &str| {
+                                event.set_extra_data(|extra_data: &mut ExtraData| {
+                                    extra_data.set_name(name);
+                                    extra_data.set_value(value);
+                                });
+                            });
+                        },
+                    );
+                    add_counter_packets(
+                        ctx,
+                        inst_id,
+                        user_range.start,
+                        user_range.end,
+                        Some(range),
+                        None,
+                        &counter_ids,
+                    );
+                }
+            });
+        });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_kernel_names_interned_once() {
+        let mut names = KernelNames::default();
+        let a = names.get("kernel_a");
+        let b = names.get("kernel_b");
+        assert_eq!(names.get("kernel_a").iid, a.iid);
+        assert_ne!(a.iid, b.iid);
+        assert!(a.iid > HW_QUEUE_IID && b.iid > HW_QUEUE_IID);
+        assert_eq!(a.demangled, "kernel_a");
+    }
+
+    #[test]
+    fn test_counter_ids_stable_across_metric_sets() {
+        let mut names = CounterNames::default();
+        let first = ["sm__cycles_elapsed.avg", "dram__bytes.sum"].map(|n| names.get(n));
+        // A later session's metrics keep the ids of names already seen.
+        assert_eq!(names.get("dram__bytes.sum"), first[1]);
+        assert_eq!(names.get("l1tex__t_bytes.sum"), Some(2));
+        assert_eq!(first, [Some(0), Some(1)]);
+        assert_eq!(names.names.len(), 3);
+        let (first_id, undescribed) = names.undescribed(7);
+        assert_eq!((first_id, undescribed.len()), (0, 3));
+        names.get("l1tex__t_requests.sum");
+        let (first_id, undescribed) = names.undescribed(7);
+        assert_eq!(
+            (first_id, undescribed),
+            (3, &["l1tex__t_requests.sum".to_string()][..])
+        );
+    }
+}
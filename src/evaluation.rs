@@ -0,0 +1,239 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::drops::{self, DropReason};
+use crate::emission::{emit_kernels, emit_user_ranges, flush_due_aggregates};
+use crate::image_ring::ImageRing;
+use crate::overhead::{self, Probe};
+use crate::spill;
+use crate::state::{UserRange, GLOBAL_STATE};
+use cupti_profiler::{MetricSet, SharedEvaluator};
+use once_cell::sync::Lazy;
+use std::{
+    panic,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        mpsc, Arc, Mutex,
+    },
+    thread,
+    time::Duration,
+};
+
+/// Number of images that may wait for evaluation. Beyond that, images are not
+/// copied and their kernels are written without counters, so a worker that
+/// cannot keep up costs neither memory nor stalls on the launch path.
+const MAX_QUEUED_JOBS: usize = 64;
+
+/// Images submitted and not yet evaluated.
+static QUEUED_JOBS: AtomicUsize = AtomicUsize::new(0);
+
+/// A decoded counter data image waiting for host-side evaluation.
+pub struct EvaluationJob {
+    pub ctx_id: u32,
+    pub evaluator: Arc<SharedEvaluator>,
+    pub counter_data_image: Vec<u8>,
+    pub metrics: Arc<MetricSet>,
+    /// Correlation ids of the launches whose ranges are in the image, in order.
+    pub correlation_ids: Vec<u32>,
+    /// NVTX ranges in the image, after any kernel ranges.
+    pub user_ranges: Vec<UserRange>,
+    /// Where the image goes once evaluated, if it is not a copy.
+    pub recycle: Option<Arc<ImageRing>>,
+}
+
+enum Request {
+    Evaluate(EvaluationJob),
+    Flush(mpsc::Sender<()>),
+}
+
+/// Background thread that evaluates counter data images off the launch path.
+///
+/// Jobs are processed in submission order, so ranges are appended to each context
+/// in the same order as the kernels that produced them.
+pub struct EvaluationWorker {
+    sender: Mutex<mpsc::Sender<Request>>,
+}
+
+static EVALUATION_WORKER: Lazy<EvaluationWorker> = Lazy::new(EvaluationWorker::spawn);
+
+impl EvaluationWorker {
+    fn spawn() -> Self {
+        let (sender, receiver) = mpsc::channel::<Request>();
+        thread::Builder::new()
+            .name("cupti-eval".to_string())
+            .spawn(move || {
+                while let Ok(request) = next_request(&receiver) {
+                    match request {
+                        Request::Evaluate(job) => {
+                            let _ = panic::catch_unwind(panic::AssertUnwindSafe(|| {
+                                evaluate(job);
+                            }));
+                            QUEUED_JOBS.fetch_sub(1, Ordering::Relaxed);
+                        }
+                        Request::Flush(done) => {
+                            let _ = done.send(());
+                        }
+                    }
+                }
+            })
+            .expect("failed to spawn evaluation worker");
+        Self {
+            sender: Mutex::new(sender),
+        }
+    }
+
+    fn send(&self, request: Request) -> bool {
+        match self.sender.lock() {
+            Ok(sender) => sender.send(request).is_ok(),
+            Err(_) => false,
+        }
+    }
+}
+
+/// Waits for the next request. While aggregating, the worker also wakes up every
+/// quarter window to close windows that are due, so summaries keep coming in
+/// phases where no kernels complete.
+fn next_request(receiver: &mpsc::Receiver<Request>) -> Result<Request, mpsc::RecvError> {
+    let interval_ms = GLOBAL_STATE.config().aggregate_interval_ms;
+    if interval_ms == 0 {
+        return receiver.recv();
+    }
+    let timeout = Duration::from_millis(interval_ms.div_ceil(4));
+    loop {
+        match receiver.recv_timeout(timeout) {
+            Ok(request) => return Ok(request),
+            Err(mpsc::RecvTimeoutError::Timeout) => {
+                let _ = panic::catch_unwind(|| flush_due_aggregates(&GLOBAL_STATE.config()));
+            }
+            Err(mpsc::RecvTimeoutError::Disconnected) => return Err(mpsc::RecvError),
+        }
+    }
+}
+
+/// Starts the worker ahead of the first image, e.g. so that aggregation windows
+/// close on time in runs that collect no counters.
+pub fn start() {
+    Lazy::force(&EVALUATION_WORKER);
+}
+
+/// Queues a counter data image for evaluation on the worker thread.
+pub fn submit(job: EvaluationJob) {
+    QUEUED_JOBS.fetch_add(1, Ordering::Relaxed);
+    if !EVALUATION_WORKER.send(Request::Evaluate(job)) {
+        QUEUED_JOBS.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// Returns whether an image submitted now would be evaluated.
+pub fn has_room() -> bool {
+    QUEUED_JOBS.load(Ordering::Relaxed) < MAX_QUEUED_JOBS
+}
+
+/// Snapshots a decoded counter data image and queues it for evaluation.
+///
+/// The caller is free to reinitialize `counter_data_image` as soon as this returns.
+/// While the worker is `MAX_QUEUED_JOBS` behind, the image is dropped and only
+/// its launches are queued, to complete without metrics. When spilling, the
+/// image is written to the spill file instead and its launches complete the same way.
+pub fn submit_snapshot(
+    ctx_id: u32,
+    evaluator: &Option<Arc<SharedEvaluator>>,
+    config_image: &Arc<Vec<u8>>,
+    counter_data_image: &[u8],
+    metrics: &Arc<MetricSet>,
+    correlation_ids: Vec<u32>,
+    user_ranges: Vec<UserRange>,
+) {
+    if let Some(evaluator) = evaluator {
+        let spilled = spill::is_spilling()
+            && spill::spill_image(
+                ctx_id,
+                evaluator,
+                config_image,
+                counter_data_image,
+                metrics,
+                &correlation_ids,
+                &user_ranges,
+            );
+        let counter_data_image = if spilled {
+            Vec::new()
+        } else if has_room() {
+            counter_data_image.to_vec()
+        } else {
+            drops::count(
+                DropReason::Backlog,
+                correlation_ids.len() + user_ranges.len(),
+            );
+            Vec::new()
+        };
+        submit(EvaluationJob {
+            ctx_id,
+            evaluator: evaluator.clone(),
+            counter_data_image,
+            metrics: metrics.clone(),
+            correlation_ids,
+            user_ranges,
+            recycle: None,
+        });
+    }
+}
+
+/// Blocks until all previously submitted jobs have been evaluated and emitted.
+///
+/// Must not be called while holding a context lock.
+pub fn flush() {
+    let (done, wait) = mpsc::channel();
+    if EVALUATION_WORKER.send(Request::Flush(done)) {
+        let _ = wait.recv();
+    }
+}
+
+fn evaluate(mut job: EvaluationJob) {
+    let has_ranges = !job.correlation_ids.is_empty() || !job.user_ranges.is_empty();
+    // Launches of a batch that fails to evaluate or was dropped still complete,
+    // without metrics.
+    let ranges = if job.counter_data_image.is_empty() || !has_ranges {
+        None
+    } else {
+        overhead::time(Probe::Evaluate, || {
+            job.evaluator.get().and_then(|evaluator| {
+                evaluator.evaluate_all_ranges(&job.counter_data_image, &job.metrics)
+            })
+        })
+        .ok()
+    };
+    // The values are copied out, so the context can collect into the image again.
+    if let Some(ring) = &job.recycle {
+        ring.put(std::mem::take(&mut job.counter_data_image));
+    }
+    if !has_ranges {
+        return;
+    }
+    let handle = match GLOBAL_STATE.context(job.ctx_id) {
+        Some(handle) => handle,
+        None => return,
+    };
+    let mut ranges = ranges.into_iter().flat_map(|ranges| ranges.into_ranges());
+    let (completed, user_ranges) = match handle.lock() {
+        Ok(mut data) => (
+            data.add_ranges(&job.correlation_ids, ranges.by_ref()),
+            data.complete_user_ranges(job.user_ranges, ranges),
+        ),
+        Err(_) => return,
+    };
+    let config = GLOBAL_STATE.config();
+    emit_kernels(&completed, &config);
+    emit_user_ranges(&user_ranges, &config);
+    drops::report();
+}
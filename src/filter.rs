@@ -0,0 +1,165 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::emission::demangle;
+use cupti_profiler::bindings::CUfunction;
+use regex::RegexSet;
+use std::{collections::HashMap, sync::Arc};
+
+/// Selects which kernels are range profiled by name.
+///
+/// Include and exclude patterns are compiled into one `RegexSet`, so a name is
+/// matched against all of them in a single pass. A pattern is a glob where `*`
+/// matches any run of characters and `?` any single one, or a regex when
+/// prefixed with `re:`. Globs must match the whole name. Both the mangled and
+/// the demangled name are tried.
+#[derive(Debug)]
+pub struct KernelFilter {
+    set: RegexSet,
+    num_include: usize,
+}
+
+impl KernelFilter {
+    /// Compiles the patterns, returning `None` if there are none.
+    pub fn new(include: &[String], exclude: &[String]) -> Result<Option<Self>, String> {
+        if include.is_empty() && exclude.is_empty() {
+            return Ok(None);
+        }
+        let patterns: Vec<String> = include.iter().chain(exclude).map(|p| to_regex(p)).collect();
+        let set = RegexSet::new(&patterns).map_err(|e| e.to_string())?;
+        Ok(Some(Self {
+            set,
+            num_include: include.len(),
+        }))
+    }
+
+    /// Returns whether a kernel called `name` is selected: it matches an include
+    /// pattern, if there are any, and no exclude pattern.
+    pub fn is_selected(&self, name: &str) -> bool {
+        let mut included = self.num_include == 0;
+        let mut excluded = false;
+        let demangled = demangle(name);
+        for name in [name, demangled.as_str()] {
+            for index in self.set.matches(name).iter() {
+                if index < self.num_include {
+                    included = true;
+                } else {
+                    excluded = true;
+                }
+            }
+        }
+        included && !excluded
+    }
+}
+
+fn to_regex(pattern: &str) -> String {
+    if let Some(regex) = pattern.strip_prefix("re:") {
+        return regex.to_string();
+    }
+    let mut regex = String::from("^");
+    for c in pattern.chars() {
+        match c {
+            '*' => regex.push_str(".*"),
+            '?' => regex.push('.'),
+            c => regex.push_str(&regex::escape(&c.to_string())),
+        }
+    }
+    regex.push('$');
+    regex
+}
+
+/// Caches the filter decision of each function of a context.
+///
+/// The launch callback passes every launch through here, so each function is
+/// only matched once.
+#[derive(Default)]
+pub struct FilterCache {
+    filter: Option<Arc<KernelFilter>>,
+    selected: HashMap<CUfunction, bool>,
+}
+
+impl FilterCache {
+    pub fn new(filter: Option<Arc<KernelFilter>>) -> Self {
+        Self {
+            filter,
+            selected: HashMap::new(),
+        }
+    }
+
+    /// Returns whether launches of `function`, called `symbol`, are range profiled.
+    pub fn is_selected(&mut self, function: CUfunction, symbol: &str) -> bool {
+        match &self.filter {
+            Some(filter) => *self
+                .selected
+                .entry(function)
+                .or_insert_with(|| filter.is_selected(symbol)),
+            None => true,
+        }
+    }
+
+    /// Returns whether the cache applies `filter`.
+    pub fn uses(&self, filter: &Option<Arc<KernelFilter>>) -> bool {
+        match (&self.filter, filter) {
+            (Some(a), Some(b)) => Arc::ptr_eq(a, b),
+            (None, None) => true,
+            _ => false,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn patterns(patterns: &[&str]) -> Vec<String> {
+        patterns.iter().map(|s| s.to_string()).collect()
+    }
+
+    #[test]
+    fn test_include_and_exclude() {
+        let filter = KernelFilter::new(
+            &patterns(&["*gemm*", "re:^_Z9attention"]),
+            &patterns(&["*splitk*"]),
+        )
+        .unwrap()
+        .unwrap();
+        assert!(filter.is_selected("ampere_sgemm_128x64_nn"));
+        assert!(filter.is_selected("_Z9attentionPKfPf"));
+        assert!(!filter.is_selected("ampere_sgemm_splitk_nn"));
+        assert!(!filter.is_selected("_Z6vecAddPKfS0_Pfi"));
+        // Globs also match the demangled name.
+        let filter = KernelFilter::new(&patterns(&["vecAdd(*)"]), &[])
+            .unwrap()
+            .unwrap();
+        assert!(filter.is_selected("_Z6vecAddPKfS0_Pfi"));
+        assert!(KernelFilter::new(&[], &[]).unwrap().is_none());
+        assert!(KernelFilter::new(&patterns(&["re:("]), &[]).is_err());
+    }
+
+    #[test]
+    fn test_cache_matches_each_function_once() {
+        let filter = KernelFilter::new(&[], &patterns(&["skip*"]))
+            .unwrap()
+            .map(Arc::new);
+        let mut cache = FilterCache::new(filter.clone());
+        let function = 0x10 as CUfunction;
+        assert!(!cache.is_selected(function, "skip_me"));
+        // The symbol is not looked at again for a known function.
+        assert!(!cache.is_selected(function, "keep_me"));
+        assert!(cache.is_selected(0x20 as CUfunction, "keep_me"));
+        assert!(cache.uses(&filter));
+        assert!(!cache.uses(&None));
+        assert!(FilterCache::default().is_selected(function, "skip_me"));
+    }
+}
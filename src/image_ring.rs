@@ -0,0 +1,90 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use std::sync::Mutex;
+
+/// Spare counter data images of a context.
+///
+/// A context collects ranges into one image. When it is decoded, a spare takes
+/// its place and the decoded image travels to the evaluation worker, which puts
+/// it back once its ranges are evaluated. Spares are allocated on first use, up
+/// to the configured number of images.
+pub struct ImageRing {
+    spares: Mutex<Spares>,
+}
+
+struct Spares {
+    images: Vec<Vec<u8>>,
+    /// Spares that may still be allocated.
+    unallocated: usize,
+}
+
+impl ImageRing {
+    /// Creates a ring of `num_images` images, counting the one being collected into.
+    pub fn new(num_images: usize) -> Self {
+        Self {
+            spares: Mutex::new(Spares {
+                images: Vec::new(),
+                unallocated: num_images.saturating_sub(1),
+            }),
+        }
+    }
+
+    /// Returns a spare image of `len` bytes, or `None` while every image is in use.
+    ///
+    /// The contents are undefined; the image must be initialized before use.
+    pub fn take(&self, len: usize) -> Option<Vec<u8>> {
+        let mut image = {
+            let mut spares = self.spares.lock().ok()?;
+            match spares.images.pop() {
+                Some(image) => image,
+                None if spares.unallocated > 0 => {
+                    spares.unallocated -= 1;
+                    Vec::new()
+                }
+                None => return None,
+            }
+        };
+        image.resize(len, 0);
+        Some(image)
+    }
+
+    /// Puts back an image handed out by `take`.
+    pub fn put(&self, image: Vec<u8>) {
+        if let Ok(mut spares) = self.spares.lock() {
+            spares.images.push(image);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_spares_are_bounded_and_recycled() {
+        assert!(ImageRing::new(1).take(16).is_none());
+        let ring = ImageRing::new(3);
+        let first = ring.take(16).unwrap();
+        let second = ring.take(16).unwrap();
+        assert!(ring.take(16).is_none());
+        assert_eq!(first.len(), 16);
+        let ptr = second.as_ptr();
+        ring.put(second);
+        // A recycled image keeps its allocation.
+        let recycled = ring.take(8).unwrap();
+        assert_eq!((recycled.as_ptr(), recycled.len()), (ptr, 8));
+        assert!(ring.take(16).is_none());
+    }
+}
@@ -0,0 +1,173 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::state::{KernelActivity, KernelLaunch};
+use cupti_profiler::RangeInfo;
+use std::collections::HashMap;
+
+/// Nanoseconds after its launch that a kernel without an activity record is
+/// given up on. Records normally arrive within the activity flush period, but
+/// CUPTI may drop them or lose a buffer.
+pub const MAX_PENDING_AGE_NS: u64 = 300_000_000_000;
+
+/// The pieces of one kernel collected so far.
+struct PendingKernel {
+    launch: KernelLaunch,
+    activity: Option<KernelActivity>,
+    range: Option<RangeInfo>,
+    range_resolved: bool,
+}
+
+impl PendingKernel {
+    fn is_complete(&self) -> bool {
+        self.activity.is_some() && (!self.launch.sampled || self.range_resolved)
+    }
+}
+
+/// A launch joined with its activity record and, if it was sampled, its range.
+pub struct JoinedKernel {
+    pub launch: KernelLaunch,
+    pub activity: KernelActivity,
+    pub range: Option<RangeInfo>,
+}
+
+/// Joins launches, activity records and ranges by CUPTI correlation id.
+///
+/// Pieces may arrive in any order after the launch, and each kernel is released
+/// as soon as it is complete. Activity records and ranges of launches that were
+/// never recorded are ignored rather than attributed to another kernel.
+#[derive(Default)]
+pub struct KernelJoin {
+    pending: HashMap<u32, PendingKernel>,
+    /// Launch time at which `expire` next looks for kernels to give up on.
+    next_expiry: u64,
+}
+
+impl KernelJoin {
+    /// Records a launch. Must be called before any other piece of the kernel.
+    pub fn add_launch(&mut self, correlation_id: u32, launch: KernelLaunch) {
+        self.pending.insert(
+            correlation_id,
+            PendingKernel {
+                launch,
+                activity: None,
+                range: None,
+                range_resolved: false,
+            },
+        );
+    }
+
+    /// Adds the activity record of a launch.
+    pub fn add_activity(
+        &mut self,
+        correlation_id: u32,
+        activity: KernelActivity,
+    ) -> Option<JoinedKernel> {
+        self.pending.get_mut(&correlation_id)?.activity = Some(activity);
+        self.take_if_complete(correlation_id)
+    }
+
+    /// Adds the range of a sampled launch; `None` if the range was dropped.
+    pub fn add_range(
+        &mut self,
+        correlation_id: u32,
+        range: Option<RangeInfo>,
+    ) -> Option<JoinedKernel> {
+        let pending = self.pending.get_mut(&correlation_id)?;
+        pending.range = range;
+        pending.range_resolved = true;
+        self.take_if_complete(correlation_id)
+    }
+
+    /// Forgets a launch, e.g. because it failed.
+    pub fn remove(&mut self, correlation_id: u32) {
+        self.pending.remove(&correlation_id);
+    }
+
+    /// Number of kernels waiting for a piece.
+    pub fn len(&self) -> usize {
+        self.pending.len()
+    }
+
+    /// Returns whether no kernel is waiting for a piece.
+    pub fn is_empty(&self) -> bool {
+        self.pending.is_empty()
+    }
+
+    /// Forgets launches without an activity record that were launched more than
+    /// `MAX_PENDING_AGE_NS` before `now`, and returns how many there were.
+    ///
+    /// Cheap to call on every launch; the kernels are only scanned once per
+    /// `MAX_PENDING_AGE_NS`.
+    pub fn expire(&mut self, now: u64) -> usize {
+        if now < self.next_expiry {
+            return 0;
+        }
+        self.next_expiry = now.saturating_add(MAX_PENDING_AGE_NS);
+        let cutoff = now.saturating_sub(MAX_PENDING_AGE_NS);
+        self.discard_without_activity(|launch| launch.timestamp < cutoff)
+    }
+
+    /// Forgets every launch without an activity record and returns how many
+    /// there were. Used once activity collection has ended.
+    pub fn discard_unmatched(&mut self) -> usize {
+        self.discard_without_activity(|_| true)
+    }
+
+    fn discard_without_activity(
+        &mut self,
+        mut discard: impl FnMut(&KernelLaunch) -> bool,
+    ) -> usize {
+        let len = self.pending.len();
+        self.pending
+            .retain(|_, pending| pending.activity.is_some() || !discard(&pending.launch));
+        len - self.pending.len()
+    }
+
+    /// Releases kernels that have an activity record but are still waiting for a
+    /// range, in launch order. Used at shutdown when no more ranges will arrive.
+    pub fn drain_unresolved(&mut self) -> Vec<JoinedKernel> {
+        let ids: Vec<u32> = self
+            .pending
+            .iter()
+            .filter(|(_, pending)| pending.activity.is_some())
+            .map(|(id, _)| *id)
+            .collect();
+        let mut drained: Vec<JoinedKernel> = ids
+            .into_iter()
+            .filter_map(|id| {
+                let pending = self.pending.remove(&id)?;
+                Some(JoinedKernel {
+                    launch: pending.launch,
+                    activity: pending.activity?,
+                    range: pending.range,
+                })
+            })
+            .collect();
+        drained.sort_by_key(|kernel| kernel.launch.timestamp);
+        drained
+    }
+
+    fn take_if_complete(&mut self, correlation_id: u32) -> Option<JoinedKernel> {
+        if !self.pending.get(&correlation_id)?.is_complete() {
+            return None;
+        }
+        let pending = self.pending.remove(&correlation_id)?;
+        Some(JoinedKernel {
+            launch: pending.launch,
+            activity: pending.activity?,
+            range: pending.range,
+        })
+    }
+}
@@ -12,253 +12,92 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+pub mod aggregation;
+pub mod batching;
+pub mod buffer_pool;
 pub mod callbacks;
+pub mod clock;
 pub mod config;
+pub mod derived;
+pub mod device;
+pub mod drops;
+pub mod emission;
+pub mod evaluation;
+pub mod filter;
+pub mod image_ring;
+pub mod join;
 pub mod metrics;
+pub mod nvtx;
+pub mod overhead;
+pub mod pm_sampling;
+pub mod sampling;
+pub mod scheduling;
+pub mod session;
+pub mod spill;
 pub mod state;
 pub mod tracing;
 
 use callbacks::{buffer_completed, buffer_requested, profiler_callback_handler};
 use config::Config;
 use state::GLOBAL_STATE;
-use tracing::{get_data_source, get_next_event_id, GOT_FIRST_COUNTERS};
+use tracing::{get_data_source, get_overhead_data_source};
 
-use cpp_demangle::Symbol;
 use cupti_profiler as profiler;
 use cupti_profiler::bindings::*;
-use perfetto_sdk::{
-    data_source::TraceContext,
-    producer::{Backends, Producer, ProducerInitArgsBuilder},
-    protos::{common::builtin_clock::BuiltinClock, trace::trace_packet::TracePacket},
-};
-use perfetto_sdk_protos_gpu::protos::{
-    common::gpu_counter_descriptor::{
-        GpuCounterDescriptor, GpuCounterDescriptorGpuCounterGroup, GpuCounterSpec,
-    },
-    trace::{
-        gpu::{
-            gpu_counter_event::{GpuCounter, GpuCounterEvent},
-            gpu_render_stage_event::{Description, ExtraData, GpuRenderStageEvent, Specifications},
-        },
-        trace_packet::TracePacketExt,
-    },
-};
-use std::{panic, ptr, sync::atomic::Ordering};
+use perfetto_sdk::producer::{Backends, Producer, ProducerInitArgsBuilder};
+use std::{panic, ptr};
 
 extern "C" fn end_execution() {
     let _ = panic::catch_unwind(|| {
-        let _ = profiler::activity_flush_all(0);
-        let process_id = unsafe { libc::getpid() };
-        let process_name = std::fs::read_to_string("/proc/self/comm")
-            .unwrap_or_else(|_| "unknown".to_string())
-            .trim_end_matches('\n')
-            .to_owned();
-        let mut state = match GLOBAL_STATE.lock() {
-            Ok(s) => s,
-            Err(_) => return,
-        };
-        let metric_names = state.config.metrics.clone();
-        for (_, data) in state.context_data.iter_mut() {
-            if data.is_active {
-                if let Some(rp) = &mut data.range_profiler {
-                    let _ = rp.stop();
-                    let _ = rp.decode_counter_data();
-                    if let Some(me) = &data.metric_evaluator {
-                        if let Ok(infos) =
-                            me.evaluate_all_ranges(&data.counter_data_image, &metric_names)
-                        {
-                            data.range_info.extend(infos);
-                        }
-                    }
+        let config = GLOBAL_STATE.config();
+        pm_sampling::stop();
+        session::flush_contexts(&config, false);
+        spill::finish();
+        for (ctx_id, handle) in &GLOBAL_STATE.contexts() {
+            if let Ok(data) = handle.lock() {
+                if data.batch.ranges_dropped() > 0 {
+                    eprintln!(
+                        "Context {}: {} ranges dropped (INJECTION_MAX_RANGES={})",
+                        ctx_id,
+                        data.batch.ranges_dropped(),
+                        data.batch.capacity()
+                    );
                 }
             }
         }
-        get_data_source().trace(|ctx: &mut TraceContext| {
-            let inst_id = ctx.instance_index();
-            for (_, data) in state.context_data.iter() {
-                for (range, (launch, activity)) in data
-                    .range_info
-                    .iter()
-                    .zip(data.kernel_launches.iter().zip(data.kernel_activities.iter()))
-                {
-                    let duration = range.metric_and_values.iter().find(|metric| metric.metric_name == "gpu__time_duration.sum");
-                    if duration.is_none() {
-                        continue;
-                    }
-                    let duration = duration.unwrap();
-                    let demangled = if let Ok(sym) = Symbol::new(&activity.kernel_name) {
-                        sym.demangle().map(|d| d.to_string()).unwrap_or(activity.kernel_name.clone())
-                    } else {
-                        activity.kernel_name.clone()
-                    };
-                    let grid_size = activity.grid_size.0 * activity.grid_size.1 * activity.grid_size.2;
-                    let block_size = activity.block_size.0 * activity.block_size.1 * activity.block_size.2;
-                    let thread_count = grid_size * block_size;
-                    let mut cache_mode = 0;
-                    let _ = unsafe { profiler::get_func_attribute(launch.function, CUfunction_attribute_enum_CU_FUNC_ATTRIBUTE_CACHE_MODE_CA) }.map(|v| cache_mode = v);
-                    let max_active_blocks = unsafe { profiler::occupancy_max_active_blocks_per_multiprocessor(launch.function, block_size, activity.dynamic_shared_memory as usize) }.unwrap_or(0);
-                    let waves_per_multiprocessor = if data.num_sms > 0 && max_active_blocks > 0 { grid_size as f64 / (data.num_sms * max_active_blocks) as f64 } else { 0.0 };
-                    let regs_per_thread = unsafe { profiler::get_func_attribute(launch.function, CUfunction_attribute_enum_CU_FUNC_ATTRIBUTE_NUM_REGS) }.unwrap_or(0);
-                    let smem_per_block = activity.dynamic_shared_memory + activity.static_shared_memory;
-                    let warp_size = profiler::get_device_attribute(data.device_id, CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_WARP_SIZE).unwrap_or(32);
-                    let max_threads_sm = profiler::get_device_attribute(data.device_id, CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR).unwrap_or(0);
-                    let max_blocks_sm = profiler::get_device_attribute(data.device_id, CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_BLOCKS_PER_MULTIPROCESSOR).unwrap_or(0);
-                    let regs_per_sm = profiler::get_device_attribute(data.device_id, CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_REGISTERS_PER_MULTIPROCESSOR).unwrap_or(0);
-                    let smem_per_sm = profiler::get_device_attribute(data.device_id, CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_MAX_SHARED_MEMORY_PER_MULTIPROCESSOR).unwrap_or(0);
-                    let major = profiler::get_device_attribute(data.device_id, CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR).unwrap_or(0);
-                    let minor = profiler::get_device_attribute(data.device_id, CUdevice_attribute_enum_CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR).unwrap_or(0);
-                    let warps_per_block = if warp_size > 0 { block_size / warp_size } else { 0 };
-                    let max_active_warps = max_active_blocks * warps_per_block;
-                    let regs_per_block = (regs_per_thread as i32) * block_size;
-                    let max_warps_sm = if warp_size > 0 { max_threads_sm / warp_size } else { 0 };
-                    let max_active_warps_pct = if max_warps_sm > 0 { 100.0 * max_active_warps as f64 / max_warps_sm as f64 } else { 0.0 };
-                    let occupancy_limit_shared_mem = if smem_per_block != 0 { smem_per_sm / smem_per_block } else { 16 };
-                    let occupancy_limit_warps = if warps_per_block > 0 { max_warps_sm / warps_per_block } else { 0 };
-                    let occupancy_limit_registers = if regs_per_block != 0 { regs_per_sm / regs_per_block } else { 16 };
-                    // Emit static metrics as extra data of the render stage event.
-                    let extra_data = |emit: &mut dyn FnMut(&str, &str)| {
-                        emit("kernel_name", &activity.kernel_name);
-                        emit("kernel_demangled_name", &demangled);
-                        emit("kernel_type", "Compute");
-                        emit("process_id", &process_id.to_string());
-                        emit("process_name", &process_name);
-                        emit("arch", &format!("CC_{}{}", major, minor));
-                        #[allow(nonstandard_style)]
-                        match cache_mode as u32 {
-                            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_NONE => emit("launch__func_cache_config", "CachePreferNone"),
-                            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_SHARED => emit("launch__func_cache_config", "CachePreferShared"),
-                            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_L1 => emit("launch__func_cache_config", "CachePreferL1"),
-                            CUfunc_cache_enum_CU_FUNC_CACHE_PREFER_EQUAL => emit("launch__func_cache_config", "CachePreferEqual"),
-                            _ => emit("launch__func_cache_config", "n/a"),
-                        }
-                        emit("launch__waves_per_multiprocessor", &waves_per_multiprocessor.to_string());
-                        emit("launch__grid_size", &grid_size.to_string());
-                        emit("launch__grid_size_x", &activity.grid_size.0.to_string());
-                        emit("launch__grid_size_y", &activity.grid_size.1.to_string());
-                        emit("launch__grid_size_z", &activity.grid_size.2.to_string());
-                        emit("launch__block_size", &block_size.to_string());
-                        emit("launch__block_size_x", &activity.block_size.0.to_string());
-                        emit("launch__block_size_y", &activity.block_size.1.to_string());
-                        emit("launch__block_size_z", &activity.block_size.2.to_string());
-                        emit("launch__thread_count", &thread_count.to_string());
-                        emit("launch__registers_per_thread", &activity.registers_per_thread.to_string());
-                        // TODO: Take shared mem config and carve-out into account.
-                        emit("launch__shared_mem_config_size", "49152");
-                        emit("launch__shared_mem_per_block_driver", &smem_per_block.to_string());
-                        emit("launch__shared_mem_per_block_dynamic", &activity.dynamic_shared_memory.to_string());
-                        emit("launch__shared_mem_per_block_static", &activity.static_shared_memory.to_string());
-                        emit("launch__occupancy_limit_shared_mem", &occupancy_limit_shared_mem.to_string());
-                        emit("launch__occupancy_limit_warps", &occupancy_limit_warps.to_string());
-                        emit("launch__occupancy_limit_blocks", &max_blocks_sm.to_string());
-                        emit("launch__occupancy_limit_registers", &occupancy_limit_registers.to_string());
-                        emit("sm__maximum_warps_avg_per_active_cycle", &max_active_warps.to_string());
-                        emit("sm__maximum_warps_per_active_cycle_pct", &max_active_warps_pct.to_string());
-                    };
-                    if state.config.verbose {
-                        println!("Range Name: {}", range.range_name);
-                        println!("Timestamp: {}", launch.timestamp);
-                        println!("Duration: {}", duration.value);
-                        println!("-----------------------------------------------------------------------------------");
-                        extra_data(&mut|name: &str, value: &str| {
-                            println!("{}: {}", name, value);
-                        });
-                        for metric in &range.metric_and_values {
-                            println!("{}: {}", metric.metric_name, metric.value);
-                        }
-                        println!("-----------------------------------------------------------------------------------\n");
-                    }
-                    let got_first_counters = GOT_FIRST_COUNTERS.fetch_or(1 << inst_id, Ordering::SeqCst);
-                    ctx.with_incremental_state(|ctx: &mut TraceContext, state| {
-                        let was_cleared = std::mem::replace(&mut state.was_cleared, false);
-                        ctx.add_packet(|packet: &mut TracePacket| {
-                            packet
-                                .set_timestamp(launch.timestamp)
-                                .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
-                                .set_gpu_render_stage_event(|event: &mut GpuRenderStageEvent| {
-                                    event
-                                        .set_event_id(get_next_event_id())
-                                        .set_duration(duration.value as u64)
-                                        .set_hw_queue_id(0)
-                                        .set_stage_id(0);
-                                    extra_data(&mut|name: &str, value: &str| {
-                                        event.set_extra_data(|extra_data: &mut ExtraData| {
-                                            extra_data.set_name(name);
-                                            extra_data.set_value(value);
-                                        });
-                                    });
-                                    if was_cleared {
-                                        event.set_specifications(|specs: &mut Specifications| {
-                                            specs
-                                                .set_hw_queue(|desc: &mut Description| {
-                                                    desc.set_name("Queue (0)");
-                                                })
-                                                .set_stage(|desc: &mut Description| {
-                                                    desc.set_name("Kernel");
-                                                });
-                                        });
-                                    }
-                                });
-                        });
-                        if got_first_counters & (1 << inst_id) == 0 {
-                            ctx.add_packet(|packet: &mut TracePacket| {
-                                packet
-                                    .set_timestamp(launch.timestamp)
-                                    .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
-                                    .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
-                                        event.set_counter_descriptor(|desc: &mut GpuCounterDescriptor| {
-                                            for (i, metric) in range.metric_and_values.iter().enumerate() {
-                                                desc.set_specs(|desc: &mut GpuCounterSpec| {
-                                                    desc.set_counter_id(i as u32);
-                                                    desc.set_name(&metric.metric_name);
-                                                    desc.set_groups(GpuCounterDescriptorGpuCounterGroup::Compute);
-                                                });
-                                            }
-                                        });
-                                    });
-                                });
-                        }
-                        ctx.add_packet(|packet: &mut TracePacket| {
-                            packet
-                                .set_timestamp(launch.timestamp)
-                                .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
-                                .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
-                                    for (i, _metric) in range.metric_and_values.iter().enumerate() {
-                                        event.set_counters(|counter: &mut GpuCounter| {
-                                            counter.set_counter_id(i as u32).set_int_value(0);
-                                        });
-                                    }
-                                });
-                            });
-                        ctx.add_packet(|packet: &mut TracePacket| {
-                            packet
-                                .set_timestamp(launch.timestamp + duration.value as u64)
-                                .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
-                                .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
-                                    for (i, metric) in range.metric_and_values.iter().enumerate() {
-                                        event.set_counters(|counter: &mut GpuCounter| {
-                                            counter.set_counter_id(i as u32).set_double_value(metric.value);
-                                        });
-                                    }
-                                });
-                            });
-                    });
-                }
+        let backlog = drops::dropped(drops::DropReason::Backlog);
+        if backlog > 0 {
+            eprintln!(
+                "{} ranges dropped because metric evaluation fell behind",
+                backlog
+            );
+        }
+        if let Some(pool) = buffer_pool::get() {
+            let stats = pool.stats();
+            if stats.exhausted > 0 {
+                eprintln!(
+                    "Activity buffer pool exhausted {} of {} times (INJECTION_ACTIVITY_BUFFER_COUNT={})",
+                    stats.exhausted, stats.acquired, config.activity_buffer_count
+                );
             }
-        });
+        }
+        let now = tracing::trace_time_ns();
+        overhead::flush(now);
+        if config.overhead_summary {
+            eprint!(
+                "Injection overhead:\n{}",
+                overhead::format_summary(&overhead::snapshot(now))
+            );
+        }
     });
 }
 
-fn register_profiler_callbacks() -> Result<(), CUptiResult> {
+fn register_profiler_callbacks(config: &Config) -> Result<(), CUptiResult> {
     let subscriber =
         unsafe { profiler::subscribe(Some(profiler_callback_handler), ptr::null_mut()) }?;
-    unsafe {
-        profiler::enable_callback(
-            1,
-            subscriber,
-            CUpti_CallbackDomain_CUPTI_CB_DOMAIN_DRIVER_API,
-            CUpti_driver_api_trace_cbid_enum_CUPTI_DRIVER_TRACE_CBID_cuLaunchKernel,
-        )
-    }?;
+    // Context callbacks are always needed to know the device of each context.
+    // Launch callbacks and kernel activity are left to `session`, which turns
+    // them on while a tracing session is running.
     unsafe {
         profiler::enable_callback(
             1,
@@ -276,10 +115,21 @@ fn register_profiler_callbacks() -> Result<(), CUptiResult> {
         )
     }?;
     unsafe { profiler::enable_domain(1, subscriber, CUpti_CallbackDomain_CUPTI_CB_DOMAIN_STATE) }?;
-    profiler::activity_enable(CUpti_ActivityKind_CUPTI_ACTIVITY_KIND_KERNEL)?;
+    clock::init(config.clock_sync_interval_ms);
+    if let Some(path) = &config.spill_path {
+        spill::init(path);
+    }
+    buffer_pool::init(config.activity_buffer_size, config.activity_buffer_count);
     unsafe {
         profiler::activity_register_callbacks(Some(buffer_requested), Some(buffer_completed))
     }?;
+    if config.flush_period_ms > 0 {
+        profiler::activity_flush_period(config.flush_period_ms)?;
+    }
+    if config.aggregate_interval_ms > 0 {
+        evaluation::start();
+    }
+    session::attach(subscriber, config)?;
     unsafe { libc::atexit(end_execution) };
     Ok(())
 }
@@ -294,15 +144,15 @@ pub extern "C" fn InitializeInjection() -> i32 {
         let producer_args = ProducerInitArgsBuilder::new().backends(Backends::SYSTEM);
         Producer::init(producer_args.build());
         let _ = get_data_source();
-        if let Ok(mut state) = GLOBAL_STATE.lock() {
-            if !state.injection_initialized {
-                state.injection_initialized = true;
-                state.config = Config::from_env();
-
-                if let Err(e) = register_profiler_callbacks() {
-                    eprintln!("Failed to register callbacks: {:?}", e);
-                    return 0;
-                }
+        if GLOBAL_STATE.mark_initialized() {
+            GLOBAL_STATE.set_config(Config::from_env());
+            if GLOBAL_STATE.config().overhead {
+                overhead::enable();
+                let _ = get_overhead_data_source();
+            }
+            if let Err(e) = register_profiler_callbacks(&GLOBAL_STATE.config()) {
+                eprintln!("Failed to register callbacks: {:?}", e);
+                return 0;
             }
         }
         1
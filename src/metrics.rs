@@ -41,8 +41,13 @@ pub const DEFAULT_METRICS: &[&str] = &[
     "sm__inst_executed_pipe_fma.avg.pct_of_peak_sustained_active",
     "sm__inst_executed_pipe_fp64.avg.pct_of_peak_sustained_active",
     "sm__inst_executed_pipe_tensor.avg.pct_of_peak_sustained_active",
-    "sm__warps_active.avg.pct_of_peak_sustained_active",
-    "sm__warps_active.avg.per_cycle_active",
+];
+
+/// Default metrics sampled by PM sampling: SM, DRAM and L2 utilization.
+pub const DEFAULT_PM_METRICS: &[&str] = &[
+    "sm__throughput.avg.pct_of_peak_sustained_elapsed",
+    "gpu__dram_throughput.avg.pct_of_peak_sustained_elapsed",
+    "lts__throughput.avg.pct_of_peak_sustained_elapsed",
 ];
 
 /// Parses a comma or semicolon separated string of metrics.
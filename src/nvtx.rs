@@ -0,0 +1,220 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use cupti_profiler::bindings::*;
+use std::{
+    cell::RefCell,
+    collections::HashMap,
+    ffi::{c_void, CStr},
+    os::raw::c_char,
+    str::FromStr,
+};
+
+/// Selects what a range of the range profiler covers.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum RangeMode {
+    /// Every sampled launch is a range of its own, collected with kernel replay.
+    #[default]
+    Kernel,
+    /// NVTX push/pop ranges at nesting `depth`, where 1 is the outermost, are
+    /// collected with user replay. Kernels are not profiled individually.
+    ///
+    /// The depth is counted per thread, like NVTX range stacks, from the pushes
+    /// seen while a session runs; ranges already open when it starts are not
+    /// counted. A context profiles one range at a time, so a range reaching the
+    /// depth while another thread's range is being profiled is not profiled.
+    Nvtx { depth: u32 },
+}
+
+impl RangeMode {
+    pub fn profiler_range(self) -> CUpti_ProfilerRange {
+        match self {
+            RangeMode::Kernel => CUpti_ProfilerRange_CUPTI_AutoRange,
+            RangeMode::Nvtx { .. } => CUpti_ProfilerRange_CUPTI_UserRange,
+        }
+    }
+
+    pub fn replay_mode(self) -> CUpti_ProfilerReplayMode {
+        match self {
+            RangeMode::Kernel => CUpti_ProfilerReplayMode_CUPTI_KernelReplay,
+            RangeMode::Nvtx { .. } => CUpti_ProfilerReplayMode_CUPTI_UserReplay,
+        }
+    }
+}
+
+impl FromStr for RangeMode {
+    type Err = String;
+
+    /// Parses `kernel`, `nvtx` or `nvtx:<depth>`.
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        let s = s.trim();
+        let (kind, arg) = s.split_once(':').unwrap_or((s, ""));
+        match kind.trim() {
+            "" | "kernel" => Ok(Self::Kernel),
+            "nvtx" if arg.trim().is_empty() => Ok(Self::Nvtx { depth: 1 }),
+            "nvtx" => arg
+                .trim()
+                .parse()
+                .ok()
+                .filter(|&depth| depth > 0)
+                .map(|depth| Self::Nvtx { depth })
+                .ok_or_else(|| format!("invalid nvtx depth '{}'", arg)),
+            _ => Err(format!("unknown range mode '{}'", s)),
+        }
+    }
+}
+
+thread_local! {
+    /// NVTX ranges open on this thread, per context id.
+    static DEPTHS: RefCell<HashMap<u32, u32>> = RefCell::new(HashMap::new());
+}
+
+/// Counts a range pushed on this thread while `ctx_id` is current and returns
+/// its depth, where 1 is the outermost.
+pub fn push_depth(ctx_id: u32) -> u32 {
+    DEPTHS.with(|depths| {
+        let mut depths = depths.borrow_mut();
+        let depth = depths.entry(ctx_id).or_default();
+        *depth += 1;
+        *depth
+    })
+}
+
+/// Counts a range popped on this thread while `ctx_id` is current and returns
+/// the depth it had, or 0 if it was pushed before ranges were counted.
+pub fn pop_depth(ctx_id: u32) -> u32 {
+    DEPTHS.with(|depths| match depths.borrow_mut().get_mut(&ctx_id) {
+        Some(depth) if *depth > 0 => {
+            *depth -= 1;
+            *depth + 1
+        }
+        _ => 0,
+    })
+}
+
+/// NVTX calls that open or close a range.
+pub const NVTX_RANGE_CBIDS: &[CUpti_CallbackId] = &[
+    CUpti_nvtx_api_trace_cbid_CUPTI_CBID_NVTX_nvtxRangePushA,
+    CUpti_nvtx_api_trace_cbid_CUPTI_CBID_NVTX_nvtxRangePushEx,
+    CUpti_nvtx_api_trace_cbid_CUPTI_CBID_NVTX_nvtxRangePop,
+];
+
+// Parameter layouts from `generated_nvtx_meta.h` and `nvToolsExt.h`, which
+// the bindings do not include.
+
+#[repr(C)]
+struct NvtxRangePushAParams {
+    message: *const c_char,
+}
+
+#[repr(C)]
+struct NvtxRangePushExParams {
+    event_attrib: *const NvtxEventAttributes,
+}
+
+#[repr(C)]
+struct NvtxEventAttributes {
+    version: u16,
+    size: u16,
+    category: u32,
+    color_type: i32,
+    color: u32,
+    payload_type: i32,
+    reserved0: i32,
+    payload: u64,
+    message_type: i32,
+    message: *const c_void,
+}
+
+const NVTX_MESSAGE_TYPE_ASCII: i32 = 1;
+
+/// An NVTX range event delivered to the CUPTI callback.
+pub enum NvtxEvent {
+    /// A range was pushed; the name is empty unless it is an ASCII message.
+    Push(String),
+    Pop,
+}
+
+/// Decodes the callback data of a call in `NVTX_RANGE_CBIDS`.
+///
+/// # Safety
+///
+/// `cbdata` must be the `CUpti_NvtxData` of a callback for `cbid`.
+#[allow(nonstandard_style)]
+pub unsafe fn range_event(cbid: CUpti_CallbackId, cbdata: *const c_void) -> Option<NvtxEvent> {
+    let data = &*(cbdata as *const CUpti_NvtxData);
+    let message = match cbid {
+        CUpti_nvtx_api_trace_cbid_CUPTI_CBID_NVTX_nvtxRangePushA => {
+            (*(data.functionParams as *const NvtxRangePushAParams)).message
+        }
+        CUpti_nvtx_api_trace_cbid_CUPTI_CBID_NVTX_nvtxRangePushEx => {
+            let attrib = (*(data.functionParams as *const NvtxRangePushExParams)).event_attrib;
+            match attrib.as_ref() {
+                Some(attrib) if attrib.message_type == NVTX_MESSAGE_TYPE_ASCII => {
+                    attrib.message as *const c_char
+                }
+                _ => std::ptr::null(),
+            }
+        }
+        CUpti_nvtx_api_trace_cbid_CUPTI_CBID_NVTX_nvtxRangePop => return Some(NvtxEvent::Pop),
+        _ => return None,
+    };
+    let name = if message.is_null() {
+        String::new()
+    } else {
+        CStr::from_ptr(message).to_string_lossy().into_owned()
+    };
+    Some(NvtxEvent::Push(name))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::mem::offset_of;
+
+    #[test]
+    fn test_parse_range_mode() {
+        assert_eq!("kernel".parse(), Ok(RangeMode::Kernel));
+        assert_eq!("nvtx".parse(), Ok(RangeMode::Nvtx { depth: 1 }));
+        assert_eq!("nvtx:2".parse(), Ok(RangeMode::Nvtx { depth: 2 }));
+        assert!("nvtx:0".parse::<RangeMode>().is_err());
+        assert!("step".parse::<RangeMode>().is_err());
+    }
+
+    #[test]
+    fn test_depth_is_per_thread() {
+        assert_eq!(push_depth(1), 1);
+        assert_eq!(push_depth(1), 2);
+        std::thread::spawn(|| {
+            assert_eq!(push_depth(1), 1);
+            assert_eq!(pop_depth(1), 1);
+            assert_eq!(pop_depth(1), 0);
+        })
+        .join()
+        .unwrap();
+        assert_eq!(push_depth(2), 1);
+        assert_eq!(pop_depth(1), 2);
+        assert_eq!(pop_depth(1), 1);
+        assert_eq!(pop_depth(1), 0);
+    }
+
+    #[test]
+    fn test_event_attributes_layout() {
+        // nvtxEventAttributes_v2 puts the message after a 4 byte pad.
+        assert_eq!(offset_of!(NvtxEventAttributes, payload), 24);
+        assert_eq!(offset_of!(NvtxEventAttributes, message_type), 32);
+        assert_eq!(offset_of!(NvtxEventAttributes, message), 40);
+        assert_eq!(std::mem::size_of::<NvtxEventAttributes>(), 48);
+    }
+}
@@ -0,0 +1,349 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::emission::{describe_once, OVERHEAD_COUNTER_BASE};
+use crate::tracing::{get_overhead_data_source, trace_time_ns, GOT_FIRST_OVERHEAD};
+use perfetto_sdk::{
+    data_source::TraceContext,
+    protos::{common::builtin_clock::BuiltinClock, trace::trace_packet::TracePacket},
+};
+use perfetto_sdk_protos_gpu::protos::{
+    common::gpu_counter_descriptor::GpuCounterDescriptorGpuCounterGroup,
+    trace::{
+        gpu::gpu_counter_event::{GpuCounter, GpuCounterEvent},
+        trace_packet::TracePacketExt,
+    },
+};
+use std::sync::{
+    atomic::{AtomicBool, AtomicU64, Ordering},
+    Mutex,
+};
+
+/// Minimum time between two overhead samples written to the trace.
+const SAMPLE_INTERVAL_NS: u64 = 1_000_000_000;
+
+/// An instrumented part of the injection.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Probe {
+    /// Time inside `profiler_callback_handler`.
+    Callback,
+    /// Time waiting for a context lock on the launch path.
+    StateWait,
+    /// Time in `decode_counter_data`.
+    Decode,
+    /// Time in `evaluate_all_ranges`.
+    Evaluate,
+    /// Time inside `buffer_completed`.
+    BufferCompleted,
+    /// Time writing kernels to the trace.
+    Emission,
+}
+
+const NUM_PROBES: usize = 6;
+
+impl Probe {
+    pub const ALL: [Probe; NUM_PROBES] = [
+        Probe::Callback,
+        Probe::StateWait,
+        Probe::Decode,
+        Probe::Evaluate,
+        Probe::BufferCompleted,
+        Probe::Emission,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Probe::Callback => "callback",
+            Probe::StateWait => "state_wait",
+            Probe::Decode => "decode",
+            Probe::Evaluate => "evaluate",
+            Probe::BufferCompleted => "buffer_completed",
+            Probe::Emission => "emission",
+        }
+    }
+}
+
+struct ProbeCounters {
+    calls: AtomicU64,
+    total_ns: AtomicU64,
+    max_ns: AtomicU64,
+}
+
+impl ProbeCounters {
+    const fn new() -> Self {
+        Self {
+            calls: AtomicU64::new(0),
+            total_ns: AtomicU64::new(0),
+            max_ns: AtomicU64::new(0),
+        }
+    }
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static PROBES: [ProbeCounters; NUM_PROBES] = [
+    ProbeCounters::new(),
+    ProbeCounters::new(),
+    ProbeCounters::new(),
+    ProbeCounters::new(),
+    ProbeCounters::new(),
+    ProbeCounters::new(),
+];
+static ACTIVITY_RECORDS: AtomicU64 = AtomicU64::new(0);
+static LAST_SAMPLE: Mutex<Option<Snapshot>> = Mutex::new(None);
+
+/// Turns on the probes. Until then they cost a single atomic load.
+pub fn enable() {
+    ENABLED.store(true, Ordering::Relaxed);
+    if let Ok(mut last) = LAST_SAMPLE.lock() {
+        *last = Some(snapshot(trace_time_ns()));
+    }
+}
+
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Adds `ns` to the time spent in `probe`.
+pub fn record(probe: Probe, ns: u64) {
+    let counters = &PROBES[probe as usize];
+    counters.calls.fetch_add(1, Ordering::Relaxed);
+    counters.total_ns.fetch_add(ns, Ordering::Relaxed);
+    counters.max_ns.fetch_max(ns, Ordering::Relaxed);
+}
+
+/// Counts activity records processed by `buffer_completed`.
+pub fn count_activity_records(records: u64) {
+    if is_enabled() {
+        ACTIVITY_RECORDS.fetch_add(records, Ordering::Relaxed);
+    }
+}
+
+/// Records the time until it is dropped against a probe.
+pub struct Timer {
+    probe: Probe,
+    start: Option<u64>,
+}
+
+impl Timer {
+    pub fn start(probe: Probe) -> Self {
+        Self {
+            probe,
+            start: is_enabled().then(trace_time_ns),
+        }
+    }
+}
+
+impl Drop for Timer {
+    fn drop(&mut self) {
+        if let Some(start) = self.start {
+            record(self.probe, trace_time_ns().saturating_sub(start));
+        }
+    }
+}
+
+/// Runs `f`, recording its duration against `probe`.
+pub fn time<T>(probe: Probe, f: impl FnOnce() -> T) -> T {
+    let _timer = Timer::start(probe);
+    f()
+}
+
+/// Cumulative probe counters at a point in time.
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct Snapshot {
+    pub time_ns: u64,
+    pub calls: [u64; NUM_PROBES],
+    pub total_ns: [u64; NUM_PROBES],
+    pub max_ns: [u64; NUM_PROBES],
+    pub activity_records: u64,
+}
+
+pub fn snapshot(now: u64) -> Snapshot {
+    let mut snapshot = Snapshot {
+        time_ns: now,
+        activity_records: ACTIVITY_RECORDS.load(Ordering::Relaxed),
+        ..Default::default()
+    };
+    for (i, counters) in PROBES.iter().enumerate() {
+        snapshot.calls[i] = counters.calls.load(Ordering::Relaxed);
+        snapshot.total_ns[i] = counters.total_ns.load(Ordering::Relaxed);
+        snapshot.max_ns[i] = counters.max_ns.load(Ordering::Relaxed);
+    }
+    snapshot
+}
+
+/// Names of the overhead counters, indexed by id minus `OVERHEAD_COUNTER_BASE`.
+///
+/// Every probe has a mean time per call and a time per second of wall clock,
+/// followed by the activity record rate.
+fn counter_names() -> Vec<String> {
+    let mut names = Vec::with_capacity(2 * NUM_PROBES + 1);
+    for probe in Probe::ALL {
+        names.push(format!("injection.{}.mean_ns", probe.name()));
+        names.push(format!("injection.{}.ns_per_s", probe.name()));
+    }
+    names.push("injection.activity_records_per_s".to_string());
+    names
+}
+
+/// Counter values for the interval between two snapshots, in `counter_names` order.
+fn interval_values(previous: &Snapshot, current: &Snapshot) -> Vec<f64> {
+    let elapsed_s = current.time_ns.saturating_sub(previous.time_ns) as f64 / 1e9;
+    let per_second = |delta: u64| {
+        if elapsed_s > 0.0 {
+            delta as f64 / elapsed_s
+        } else {
+            0.0
+        }
+    };
+    let mut values = Vec::with_capacity(2 * NUM_PROBES + 1);
+    for i in 0..NUM_PROBES {
+        let calls = current.calls[i].saturating_sub(previous.calls[i]);
+        let total_ns = current.total_ns[i].saturating_sub(previous.total_ns[i]);
+        values.push(if calls > 0 {
+            total_ns as f64 / calls as f64
+        } else {
+            0.0
+        });
+        values.push(per_second(total_ns));
+    }
+    values.push(per_second(
+        current
+            .activity_records
+            .saturating_sub(previous.activity_records),
+    ));
+    values
+}
+
+/// Writes an overhead sample to the trace if the sample interval has elapsed.
+pub fn sample_if_due(now: u64) {
+    sample(now, SAMPLE_INTERVAL_NS);
+}
+
+/// Writes an overhead sample covering the time since the last one, e.g. at exit.
+pub fn flush(now: u64) {
+    sample(now, 0);
+}
+
+fn sample(now: u64, min_interval_ns: u64) {
+    if !is_enabled() {
+        return;
+    }
+    let mut last = match LAST_SAMPLE.lock() {
+        Ok(last) => last,
+        Err(_) => return,
+    };
+    let previous = last.unwrap_or_default();
+    if previous.time_ns != 0 && now.saturating_sub(previous.time_ns) < min_interval_ns {
+        return;
+    }
+    let current = snapshot(now);
+    if previous.time_ns != 0 {
+        write_sample(now, &interval_values(&previous, &current));
+    }
+    *last = Some(current);
+}
+
+fn write_sample(now: u64, values: &[f64]) {
+    get_overhead_data_source().trace(|ctx: &mut TraceContext| {
+        describe_once(
+            ctx,
+            now,
+            &GOT_FIRST_OVERHEAD,
+            OVERHEAD_COUNTER_BASE,
+            &counter_names(),
+            GpuCounterDescriptorGpuCounterGroup::System,
+        );
+        ctx.add_packet(|packet: &mut TracePacket| {
+            packet
+                .set_timestamp(now)
+                .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
+                .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
+                    for (i, value) in values.iter().enumerate() {
+                        event.set_counters(|counter: &mut GpuCounter| {
+                            counter
+                                .set_counter_id(OVERHEAD_COUNTER_BASE + i as u32)
+                                .set_double_value(*value);
+                        });
+                    }
+                });
+        });
+    });
+}
+
+/// Formats the totals of a snapshot as a table for the exit summary.
+pub fn format_summary(snapshot: &Snapshot) -> String {
+    let mut summary = format!(
+        "{:<18}{:>12}{:>14}{:>12}{:>12}\n",
+        "probe", "calls", "total_ms", "mean_us", "max_us"
+    );
+    for (i, probe) in Probe::ALL.iter().enumerate() {
+        let calls = snapshot.calls[i];
+        let mean_us = if calls > 0 {
+            snapshot.total_ns[i] as f64 / calls as f64 / 1e3
+        } else {
+            0.0
+        };
+        summary.push_str(&format!(
+            "{:<18}{:>12}{:>14.3}{:>12.3}{:>12.3}\n",
+            probe.name(),
+            calls,
+            snapshot.total_ns[i] as f64 / 1e6,
+            mean_us,
+            snapshot.max_ns[i] as f64 / 1e3
+        ));
+    }
+    summary.push_str(&format!(
+        "activity records: {}\n",
+        snapshot.activity_records
+    ));
+    summary
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_interval_values() {
+        let previous = Snapshot {
+            time_ns: 1_000_000_000,
+            ..Default::default()
+        };
+        let mut current = Snapshot {
+            time_ns: 3_000_000_000,
+            activity_records: 500,
+            ..previous
+        };
+        current.calls[Probe::Callback as usize] = 4;
+        current.total_ns[Probe::Callback as usize] = 8_000;
+        let values = interval_values(&previous, &current);
+        assert_eq!(values.len(), counter_names().len());
+        assert_eq!(values[0], 2_000.0);
+        assert_eq!(values[1], 4_000.0);
+        assert_eq!(values[2], 0.0);
+        assert_eq!(values[values.len() - 1], 250.0);
+    }
+
+    #[test]
+    fn test_format_summary_lists_every_probe() {
+        let mut snapshot = Snapshot::default();
+        snapshot.calls[Probe::Decode as usize] = 2;
+        snapshot.total_ns[Probe::Decode as usize] = 3_000;
+        let summary = format_summary(&snapshot);
+        for probe in Probe::ALL {
+            assert!(summary.contains(probe.name()));
+        }
+        assert!(summary.contains("1.500"));
+    }
+}
@@ -0,0 +1,298 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::clock::CLOCK_SYNC;
+use crate::config::Config;
+use crate::emission::{describe_once, EMIT_CHUNK_SIZE, PM_SAMPLING_COUNTER_BASE};
+use crate::state::GLOBAL_STATE;
+use crate::tracing::{get_data_source, GOT_FIRST_PM_COUNTERS};
+use cupti_profiler::bindings::*;
+use cupti_profiler::{MetricEvaluator, MetricSet, PmSampler};
+use perfetto_sdk::{
+    data_source::TraceContext,
+    protos::{common::builtin_clock::BuiltinClock, trace::trace_packet::TracePacket},
+};
+use perfetto_sdk_protos_gpu::protos::{
+    common::gpu_counter_descriptor::GpuCounterDescriptorGpuCounterGroup,
+    trace::{
+        gpu::gpu_counter_event::{GpuCounter, GpuCounterEvent},
+        trace_packet::TracePacketExt,
+    },
+};
+use std::{
+    panic,
+    sync::{
+        mpsc::{self, RecvTimeoutError},
+        Mutex,
+    },
+    thread,
+    time::Duration,
+};
+
+/// Interval in milliseconds at which the hardware buffers are decoded. The
+/// hardware buffer holds the samples in between.
+const POLL_INTERVAL_MS: u64 = 100;
+
+/// Size in bytes of the hardware buffer each device samples into.
+const HARDWARE_BUFFER_SIZE: usize = 64 << 20;
+
+/// Samples a counter data image holds. A full image is written out and decoded
+/// into again, so this only bounds memory.
+const MAX_SAMPLES: usize = 4096;
+
+/// PM sampling of one device.
+struct Device {
+    device_id: CUdevice,
+    sampler: PmSampler,
+    evaluator: MetricEvaluator,
+    counter_data_image: Vec<u8>,
+    overflowed: bool,
+}
+
+impl Device {
+    /// Enables PM sampling on `device_id` and starts sampling.
+    fn start(device_id: CUdevice, config: &Config) -> Result<Self, CUptiResult> {
+        let mut sampler = PmSampler::new(device_id as usize);
+        sampler.enable()?;
+        sampler.set_config(
+            &config.pm_metrics,
+            HARDWARE_BUFFER_SIZE,
+            config.pm_sampling_interval_us * 1000,
+        )?;
+        let evaluator = sampler.create_evaluator()?;
+        let mut counter_data_image = Vec::new();
+        sampler.create_counter_data_image(
+            &config.pm_metrics,
+            MAX_SAMPLES,
+            &mut counter_data_image,
+        )?;
+        sampler.start()?;
+        Ok(Self {
+            device_id,
+            sampler,
+            evaluator,
+            counter_data_image,
+            overflowed: false,
+        })
+    }
+
+    /// Writes the samples collected since the last call to the trace.
+    fn drain(&mut self, metrics: &MetricSet, verbose: bool) -> Result<(), CUptiResult> {
+        loop {
+            let status = self.sampler.decode(&mut self.counter_data_image)?;
+            if status.overflow && !self.overflowed {
+                eprintln!(
+                    "PM sampling buffer of device {} overflowed; samples were lost",
+                    self.device_id
+                );
+                self.overflowed = true;
+            }
+            let image = &self.counter_data_image;
+            let num_samples = self.sampler.num_completed_samples(image)?;
+            let mut timestamps = Vec::with_capacity(num_samples);
+            let mut values = vec![0.0f64; num_samples * metrics.len()];
+            for (i, sample) in values.chunks_exact_mut(metrics.len()).enumerate() {
+                let (_, end) = self.sampler.sample_time(image, i)?;
+                self.evaluator
+                    .evaluate_metrics_for_range(image, metrics, i, sample)?;
+                timestamps.push(CLOCK_SYNC.to_trace_time(end));
+            }
+            if verbose {
+                for (timestamp, sample) in timestamps.iter().zip(values.chunks_exact(metrics.len()))
+                {
+                    println!("PM Sample: device {}", self.device_id);
+                    println!("Timestamp: {:?}", timestamp);
+                    for (name, value) in metrics.names().iter().zip(sample) {
+                        println!("{}: {}", name, value);
+                    }
+                    println!();
+                }
+            }
+            emit_samples(self.device_id, &timestamps, &values, metrics);
+            self.sampler
+                .initialize_counter_data_image(&mut self.counter_data_image)?;
+            if !status.counter_data_full {
+                return Ok(());
+            }
+        }
+    }
+}
+
+/// Writes each sample as counter values at the end of its interval, on the
+/// GPU of `device_id`. Samples without a trace time are skipped.
+fn emit_samples(
+    device_id: CUdevice,
+    timestamps: &[Option<u64>],
+    values: &[f64],
+    metrics: &MetricSet,
+) {
+    if metrics.is_empty() {
+        return;
+    }
+    let samples: Vec<(u64, &[f64])> = timestamps
+        .iter()
+        .zip(values.chunks_exact(metrics.len()))
+        .filter_map(|(timestamp, sample)| timestamp.map(|t| (t, sample)))
+        .collect();
+    for samples in samples.chunks(EMIT_CHUNK_SIZE) {
+        get_data_source().trace(|ctx: &mut TraceContext| {
+            describe_once(
+                ctx,
+                samples[0].0,
+                &GOT_FIRST_PM_COUNTERS,
+                PM_SAMPLING_COUNTER_BASE,
+                metrics.names(),
+                GpuCounterDescriptorGpuCounterGroup::Compute,
+            );
+            for (timestamp, sample) in samples {
+                ctx.add_packet(|packet: &mut TracePacket| {
+                    packet
+                        .set_timestamp(*timestamp)
+                        .set_timestamp_clock_id(BuiltinClock::BuiltinClockBoottime.into())
+                        .set_gpu_counter_event(|event: &mut GpuCounterEvent| {
+                            event.set_gpu_id(device_id);
+                            for (i, value) in sample.iter().enumerate() {
+                                event.set_counters(|counter: &mut GpuCounter| {
+                                    counter
+                                        .set_counter_id(PM_SAMPLING_COUNTER_BASE + i as u32)
+                                        .set_double_value(*value);
+                                });
+                            }
+                        });
+                });
+            }
+        });
+    }
+}
+
+/// Samples every device that has a context until told to stop, then writes
+/// the remaining samples and disables sampling.
+fn run(config: &Config, stopped: mpsc::Receiver<()>) {
+    let metrics = MetricSet::new(&config.pm_metrics);
+    let mut devices: Vec<Device> = Vec::new();
+    let mut failed: Vec<CUdevice> = Vec::new();
+    loop {
+        for (_, handle) in &GLOBAL_STATE.contexts() {
+            let device_id = match handle.lock() {
+                Ok(data) => data.device.device_id,
+                Err(_) => continue,
+            };
+            if devices.iter().any(|d| d.device_id == device_id) || failed.contains(&device_id) {
+                continue;
+            }
+            match Device::start(device_id, config) {
+                Ok(device) => devices.push(device),
+                Err(e) => {
+                    eprintln!(
+                        "Failed to start PM sampling on device {}: {:?}",
+                        device_id, e
+                    );
+                    failed.push(device_id);
+                }
+            }
+        }
+        let stop = !matches!(
+            stopped.recv_timeout(Duration::from_millis(POLL_INTERVAL_MS)),
+            Err(RecvTimeoutError::Timeout)
+        );
+        for device in &mut devices {
+            if stop {
+                let _ = device.sampler.stop();
+            }
+            let result = panic::catch_unwind(panic::AssertUnwindSafe(|| {
+                device.drain(&metrics, config.verbose)
+            }));
+            if let Ok(Err(e)) = result {
+                eprintln!(
+                    "Failed to decode PM samples of device {}: {:?}",
+                    device.device_id, e
+                );
+            }
+        }
+        if stop {
+            return;
+        }
+    }
+}
+
+struct Worker {
+    stop: mpsc::Sender<()>,
+    thread: thread::JoinHandle<()>,
+}
+
+static WORKER: Mutex<Option<Worker>> = Mutex::new(None);
+
+/// Starts sampling the performance monitors of every device with a context,
+/// including devices that get one later, if `config.pm_sampling_interval_us`
+/// is set.
+///
+/// Samples are decoded on a background thread, so kernels are neither replayed
+/// nor serialized.
+pub fn start(config: &Config) {
+    if config.pm_sampling_interval_us == 0 {
+        return;
+    }
+    let mut worker = match WORKER.lock() {
+        Ok(worker) => worker,
+        Err(_) => return,
+    };
+    if worker.is_some() {
+        return;
+    }
+    let (stop, stopped) = mpsc::channel();
+    let config = config.clone();
+    match thread::Builder::new()
+        .name("cupti-pm-sampling".to_string())
+        .spawn(move || run(&config, stopped))
+    {
+        Ok(thread) => *worker = Some(Worker { stop, thread }),
+        Err(e) => eprintln!("Failed to start PM sampling: {}", e),
+    }
+}
+
+/// Stops sampling once the samples collected so far are written to the trace.
+pub fn stop() {
+    let worker = WORKER.lock().ok().and_then(|mut worker| worker.take());
+    if let Some(worker) = worker {
+        let _ = worker.stop.send(());
+        let _ = worker.thread.join();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::config::SessionConfig;
+
+    #[test]
+    fn test_sampling_runs_between_start_and_stop() {
+        start(&Config::default());
+        assert!(WORKER.lock().unwrap().is_none());
+        let config = Config {
+            pm_sampling_interval_us: 100,
+            ..Config::default()
+        };
+        // Range profiling would compete with PM sampling for the counters.
+        assert!(
+            SessionConfig::parse("activity_only=false")
+                .unwrap()
+                .apply(&config)
+                .activity_only
+        );
+        start(&config);
+        assert!(WORKER.lock().unwrap().is_some());
+        stop();
+        assert!(WORKER.lock().unwrap().is_none());
+    }
+}
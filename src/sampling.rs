@@ -0,0 +1,158 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use std::{collections::HashMap, str::FromStr};
+
+/// Selects which kernel launches are range profiled.
+///
+/// Launches that are not sampled still produce a timeline entry from their
+/// activity record, but are never replayed by the range profiler.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum SamplingPolicy {
+    /// Profile every launch.
+    #[default]
+    All,
+    /// Profile one out of every `n` launches, starting with the first.
+    EveryNth(u64),
+    /// Profile the first `k` launches of each distinct kernel.
+    FirstPerKernel(u32),
+    /// Profile launches during the first `active_ns` of every `period_ns`.
+    DutyCycle { active_ns: u64, period_ns: u64 },
+}
+
+impl FromStr for SamplingPolicy {
+    type Err = String;
+
+    /// Parses `all`, `every:<n>`, `first:<k>` or `duty:<active_ms>/<period_ms>`.
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        let s = s.trim();
+        let (kind, arg) = s.split_once(':').unwrap_or((s, ""));
+        let number = |v: &str| {
+            v.trim()
+                .parse::<u64>()
+                .ok()
+                .filter(|&n| n > 0)
+                .ok_or_else(|| format!("invalid sampling argument '{}'", v))
+        };
+        match kind.trim() {
+            "" | "all" => Ok(Self::All),
+            "every" => Ok(Self::EveryNth(number(arg)?)),
+            "first" => Ok(Self::FirstPerKernel(
+                number(arg)?.min(u32::MAX as u64) as u32
+            )),
+            "duty" => {
+                let (active, period) = arg
+                    .split_once('/')
+                    .ok_or_else(|| format!("invalid duty cycle '{}'", arg))?;
+                let active_ns = number(active)? * 1_000_000;
+                let period_ns = number(period)? * 1_000_000;
+                Ok(Self::DutyCycle {
+                    active_ns: active_ns.min(period_ns),
+                    period_ns,
+                })
+            }
+            _ => Err(format!("unknown sampling policy '{}'", s)),
+        }
+    }
+}
+
+/// Applies a `SamplingPolicy` to the launches of one context.
+pub struct Sampler {
+    policy: SamplingPolicy,
+    start_ns: u64,
+    launches: u64,
+    per_kernel: HashMap<String, u32>,
+}
+
+impl Sampler {
+    /// Creates a sampler whose duty cycle starts at `now_ns`.
+    pub fn new(policy: SamplingPolicy, now_ns: u64) -> Self {
+        Self {
+            policy,
+            start_ns: now_ns,
+            launches: 0,
+            per_kernel: HashMap::new(),
+        }
+    }
+
+    /// Returns whether the launch of `symbol` at `now_ns` should be profiled.
+    pub fn should_sample(&mut self, symbol: &str, now_ns: u64) -> bool {
+        let launch = self.launches;
+        self.launches += 1;
+        match self.policy {
+            SamplingPolicy::All => true,
+            SamplingPolicy::EveryNth(n) => launch % n == 0,
+            SamplingPolicy::FirstPerKernel(k) => {
+                if let Some(count) = self.per_kernel.get_mut(symbol) {
+                    *count = count.saturating_add(1);
+                    return *count <= k;
+                }
+                self.per_kernel.insert(symbol.to_string(), 1);
+                k > 0
+            }
+            SamplingPolicy::DutyCycle {
+                active_ns,
+                period_ns,
+            } => now_ns.saturating_sub(self.start_ns) % period_ns < active_ns,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_policies() {
+        assert_eq!("".parse(), Ok(SamplingPolicy::All));
+        assert_eq!("every:4".parse(), Ok(SamplingPolicy::EveryNth(4)));
+        assert_eq!("first:2".parse(), Ok(SamplingPolicy::FirstPerKernel(2)));
+        assert_eq!(
+            "duty:10/100".parse(),
+            Ok(SamplingPolicy::DutyCycle {
+                active_ns: 10_000_000,
+                period_ns: 100_000_000
+            })
+        );
+        assert!("every:0".parse::<SamplingPolicy>().is_err());
+        assert!("duty:10".parse::<SamplingPolicy>().is_err());
+        assert!("sometimes".parse::<SamplingPolicy>().is_err());
+    }
+
+    #[test]
+    fn test_sampling_decisions() {
+        let mut every = Sampler::new(SamplingPolicy::EveryNth(3), 0);
+        let sampled: Vec<bool> = (0..6).map(|_| every.should_sample("k", 0)).collect();
+        assert_eq!(sampled, [true, false, false, true, false, false]);
+
+        let mut first = Sampler::new(SamplingPolicy::FirstPerKernel(2), 0);
+        assert!(first.should_sample("a", 0));
+        assert!(first.should_sample("b", 0));
+        assert!(first.should_sample("a", 0));
+        assert!(!first.should_sample("a", 0));
+        assert!(first.should_sample("b", 0));
+        assert!(!first.should_sample("b", 0));
+
+        let mut duty = Sampler::new(
+            SamplingPolicy::DutyCycle {
+                active_ns: 10,
+                period_ns: 100,
+            },
+            1_000,
+        );
+        assert!(duty.should_sample("k", 1_005));
+        assert!(!duty.should_sample("k", 1_050));
+        assert!(duty.should_sample("k", 1_101));
+    }
+}
@@ -0,0 +1,188 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use cupti_profiler::{MetricSet, RangeInfo};
+use std::{collections::HashMap, sync::Arc};
+
+/// Spreads single-pass metric groups across repeated launches of each kernel.
+///
+/// Every launch collects one group, so a kernel is never replayed more than once.
+/// The group in use is kept as long as the launched kernel still lacks it, which
+/// avoids reconfiguring the range profiler between launches of different kernels.
+/// Results are merged per kernel so every emitted range carries the latest value
+/// of all metrics collected for that kernel so far.
+pub struct MetricScheduler {
+    groups: Vec<Arc<MetricSet>>,
+    /// Id in `metrics` of every metric of each group.
+    group_ids: Vec<Vec<usize>>,
+    metrics: Arc<MetricSet>,
+    current: usize,
+    collected: HashMap<String, Vec<bool>>,
+    merged: HashMap<String, Vec<f64>>,
+}
+
+impl MetricScheduler {
+    /// Creates a scheduler for the given non-empty list of metric groups.
+    pub fn new(groups: Arc<Vec<Vec<String>>>) -> Self {
+        let mut metrics: Vec<String> = Vec::new();
+        for metric in groups.iter().flatten() {
+            if !metrics.contains(metric) {
+                metrics.push(metric.clone());
+            }
+        }
+        let group_ids = groups
+            .iter()
+            .map(|group| {
+                group
+                    .iter()
+                    .filter_map(|m| metrics.iter().position(|n| n == m))
+                    .collect()
+            })
+            .collect();
+        Self {
+            groups: groups
+                .iter()
+                .map(|group| Arc::new(MetricSet::new(group)))
+                .collect(),
+            group_ids,
+            metrics: Arc::new(MetricSet::new(&metrics)),
+            current: 0,
+            collected: HashMap::new(),
+            merged: HashMap::new(),
+        }
+    }
+
+    /// The metrics of group `index`.
+    pub fn group(&self, index: usize) -> &Arc<MetricSet> {
+        &self.groups[index]
+    }
+
+    /// Metrics of the group that was selected last.
+    pub fn current_metrics(&self) -> &Arc<MetricSet> {
+        &self.groups[self.current]
+    }
+
+    /// Selects the group to collect for the next launch of `kernel`.
+    pub fn select(&mut self, kernel: &str) -> usize {
+        let num_groups = self.groups.len();
+        let collected = match self.collected.get_mut(kernel) {
+            Some(collected) => collected,
+            None => self
+                .collected
+                .entry(kernel.to_string())
+                .or_insert_with(|| vec![false; num_groups]),
+        };
+        if collected[self.current] {
+            match collected.iter().position(|&done| !done) {
+                Some(group) => self.current = group,
+                // Full coverage; start over without switching groups.
+                None => collected.iter_mut().for_each(|done| *done = false),
+            }
+        }
+        collected[self.current] = true;
+        self.current
+    }
+
+    /// Merges the metrics of `range` into the values known for `kernel`.
+    ///
+    /// Returns a range with every metric collected for the kernel so far, in the
+    /// order in which the metrics were requested.
+    pub fn merge(&mut self, kernel: &str, range: RangeInfo) -> RangeInfo {
+        let num_metrics = self.metrics.len();
+        let values = match self.merged.get_mut(kernel) {
+            Some(values) => values,
+            None => self
+                .merged
+                .entry(kernel.to_string())
+                .or_insert_with(|| vec![f64::NAN; num_metrics]),
+        };
+        // Ranges of a group map by id; anything else by name.
+        match self
+            .groups
+            .iter()
+            .position(|group| Arc::ptr_eq(group, range.metrics()))
+        {
+            Some(group) => {
+                for (id, value) in range.iter() {
+                    values[self.group_ids[group][id]] = value;
+                }
+            }
+            None => {
+                for (id, value) in range.iter() {
+                    if let Some(index) = self.metrics.id(range.metrics().name(id)) {
+                        values[index] = value;
+                    }
+                }
+            }
+        }
+        RangeInfo::from_values(self.metrics.clone(), values.clone())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn groups(groups: &[&[&str]]) -> Arc<Vec<Vec<String>>> {
+        Arc::new(
+            groups
+                .iter()
+                .map(|g| g.iter().map(|s| s.to_string()).collect())
+                .collect(),
+        )
+    }
+
+    fn range(values: &[(&str, f64)]) -> RangeInfo {
+        let names: Vec<String> = values.iter().map(|(name, _)| name.to_string()).collect();
+        RangeInfo::from_values(
+            Arc::new(MetricSet::new(&names)),
+            values.iter().map(|(_, value)| *value).collect(),
+        )
+    }
+
+    fn named_values(range: &RangeInfo) -> Vec<(&str, f64)> {
+        range
+            .iter()
+            .map(|(id, value)| (range.metrics().name(id), value))
+            .collect()
+    }
+
+    #[test]
+    fn test_select_rotates_per_kernel() {
+        let mut scheduler = MetricScheduler::new(groups(&[&["t", "a"], &["t", "b"], &["t", "c"]]));
+        assert_eq!(scheduler.select("x"), 0);
+        // A new kernel keeps the current group.
+        assert_eq!(scheduler.select("y"), 0);
+        assert_eq!(scheduler.select("x"), 1);
+        assert_eq!(scheduler.select("y"), 1);
+        assert_eq!(scheduler.select("x"), 2);
+        // Full coverage keeps the current group and starts over.
+        assert_eq!(scheduler.select("x"), 2);
+        assert_eq!(scheduler.select("x"), 0);
+        assert_eq!(scheduler.current_metrics().names(), ["t", "a"]);
+    }
+
+    #[test]
+    fn test_merge_keeps_latest_values() {
+        let mut scheduler = MetricScheduler::new(groups(&[&["t", "a"], &["t", "b"]]));
+        let merged = scheduler.merge("x", range(&[("t", 1.0), ("a", 2.0)]));
+        assert_eq!(merged.iter().count(), 2);
+        // Ranges collected with a group's own metric set map by id.
+        let group = scheduler.group(1).clone();
+        let merged = scheduler.merge("x", RangeInfo::from_values(group, vec![3.0, 4.0]));
+        assert_eq!(named_values(&merged), [("t", 3.0), ("a", 2.0), ("b", 4.0)]);
+        let other = scheduler.merge("y", range(&[("t", 5.0), ("b", 6.0)]));
+        assert_eq!(named_values(&other), [("t", 5.0), ("b", 6.0)]);
+    }
+}
@@ -0,0 +1,324 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::callbacks::{GRAPH_LAUNCH_CBIDS, KERNEL_LAUNCH_CBIDS, SYNC_POINT_CBIDS};
+use crate::config::{Config, SessionConfig};
+use crate::drops;
+use crate::emission::{emit_kernels, flush_aggregates};
+use crate::evaluation;
+use crate::nvtx::{RangeMode, NVTX_RANGE_CBIDS};
+use crate::pm_sampling;
+use crate::state::GLOBAL_STATE;
+use cupti_profiler as profiler;
+use cupti_profiler::bindings::*;
+use std::{
+    ptr,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Mutex, MutexGuard,
+    },
+};
+
+/// Whether kernel launches are profiled. This is all a launch callback reads
+/// while nobody is tracing.
+static PROFILING: AtomicBool = AtomicBool::new(false);
+
+static GATE: Mutex<Gate> = Mutex::new(Gate::new());
+
+/// Running tracing sessions and what has been turned on for them.
+struct Gate {
+    /// Running instances of the counters data source, in the order they started.
+    running: Vec<u32>,
+    /// Overrides of every set up instance, running or not.
+    sessions: Vec<(u32, SessionConfig)>,
+    /// Overrides the contexts are currently configured with.
+    applied: SessionConfig,
+    /// Configuration from the environment, which sessions override.
+    base: Option<Arc<Config>>,
+    always_on: bool,
+    /// Set once the callbacks are registered and can be toggled.
+    subscriber: Option<CUpti_SubscriberHandle>,
+    /// Whether kernel activity is enabled in CUPTI.
+    enabled: bool,
+    /// Whether the launch callbacks are enabled in CUPTI.
+    launch_callbacks: bool,
+    /// Whether the NVTX range callbacks are enabled in CUPTI.
+    nvtx_callbacks: bool,
+}
+
+// The subscriber handle is only used while holding the lock.
+unsafe impl Send for Gate {}
+
+impl Gate {
+    const fn new() -> Self {
+        Self {
+            running: Vec::new(),
+            sessions: Vec::new(),
+            applied: SessionConfig {
+                metrics: None,
+                sampling: None,
+                max_num_ranges: None,
+                activity_only: None,
+                range_mode: None,
+            },
+            base: None,
+            always_on: false,
+            subscriber: None,
+            enabled: false,
+            launch_callbacks: false,
+            nvtx_callbacks: false,
+        }
+    }
+
+    /// Overrides of the running sessions; later sessions win.
+    fn overrides(&self) -> SessionConfig {
+        let mut merged = SessionConfig::default();
+        for inst_id in &self.running {
+            if let Some((_, session)) = self.sessions.iter().find(|(id, _)| id == inst_id) {
+                merged.merge(session);
+            }
+        }
+        merged
+    }
+}
+
+fn gate() -> MutexGuard<'static, Gate> {
+    GATE.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+/// Returns whether kernel launches are currently profiled.
+#[inline]
+pub fn is_profiling() -> bool {
+    PROFILING.load(Ordering::Relaxed)
+}
+
+/// Lets the gate toggle the callbacks of `subscriber`, and turns profiling on
+/// if a session is already running or `config.always_on` is set.
+///
+/// `config` is the base that sessions override.
+pub fn attach(subscriber: CUpti_SubscriberHandle, config: &Config) -> Result<(), CUptiResult> {
+    let mut gate = gate();
+    gate.subscriber = Some(subscriber);
+    gate.always_on = config.always_on;
+    gate.base = Some(Arc::new(config.clone()));
+    update(&mut gate)
+}
+
+/// Called when an instance of the counters data source is set up, before it starts.
+pub fn instance_configured(inst_id: u32, session: SessionConfig) {
+    let mut gate = gate();
+    gate.sessions.retain(|(id, _)| *id != inst_id);
+    gate.sessions.push((inst_id, session));
+}
+
+/// Called when an instance of the counters data source starts. Its overrides
+/// are applied to every context.
+pub fn instance_started(inst_id: u32) {
+    let mut gate = gate();
+    gate.running.retain(|&id| id != inst_id);
+    gate.running.push(inst_id);
+    if let Err(e) = update(&mut gate) {
+        eprintln!("Failed to start profiling: {:?}", e);
+    }
+}
+
+/// Called when an instance of the counters data source stops. Stopping the
+/// last one writes out what was collected and turns profiling off.
+pub fn instance_stopped(inst_id: u32) {
+    let mut gate = gate();
+    gate.running.retain(|&id| id != inst_id);
+    gate.sessions.retain(|(id, _)| *id != inst_id);
+    if let Err(e) = update(&mut gate) {
+        eprintln!("Failed to stop profiling: {:?}", e);
+    }
+}
+
+fn update(gate: &mut Gate) -> Result<(), CUptiResult> {
+    let profiling = gate.always_on || !gate.running.is_empty();
+    PROFILING.store(profiling, Ordering::Relaxed);
+    let subscriber = match gate.subscriber {
+        Some(subscriber) => subscriber,
+        None => return Ok(()),
+    };
+    if !profiling && gate.enabled {
+        if gate.launch_callbacks {
+            enable_launch_callbacks(0, subscriber)?;
+            gate.launch_callbacks = false;
+        }
+        if gate.nvtx_callbacks {
+            enable_nvtx_callbacks(0, subscriber)?;
+            gate.nvtx_callbacks = false;
+        }
+        // The instance stays writable until its stop callback returns.
+        pm_sampling::stop();
+        flush_contexts(&GLOBAL_STATE.config(), true);
+        profiler::activity_disable(CUpti_ActivityKind_CUPTI_ACTIVITY_KIND_KERNEL)?;
+        gate.enabled = false;
+    }
+    let overrides = gate.overrides();
+    if overrides != gate.applied {
+        if let Some(base) = &gate.base {
+            reconfigure(overrides.apply(base));
+        }
+        gate.applied = overrides;
+    }
+    if profiling {
+        let config = GLOBAL_STATE.config();
+        let launch_callbacks = !config.activity_only;
+        if launch_callbacks != gate.launch_callbacks {
+            enable_launch_callbacks(launch_callbacks as u32, subscriber)?;
+            gate.launch_callbacks = launch_callbacks;
+        }
+        let nvtx_callbacks = launch_callbacks && config.range_mode != RangeMode::Kernel;
+        if nvtx_callbacks != gate.nvtx_callbacks {
+            enable_nvtx_callbacks(nvtx_callbacks as u32, subscriber)?;
+            gate.nvtx_callbacks = nvtx_callbacks;
+        }
+        if !gate.enabled {
+            profiler::activity_enable(CUpti_ActivityKind_CUPTI_ACTIVITY_KIND_KERNEL)?;
+            pm_sampling::start(&config);
+            gate.enabled = true;
+        }
+    }
+    Ok(())
+}
+
+/// Switches every context to `config`. Running range profiler sessions end here
+/// and begin again with the new metrics on the next sampled launch.
+fn reconfigure(config: Config) {
+    let contexts = GLOBAL_STATE.contexts();
+    GLOBAL_STATE.set_config(config);
+    let config = GLOBAL_STATE.config();
+    let mut devices = Vec::new();
+    for (ctx_id, handle) in &contexts {
+        if let Ok(mut data) = handle.lock() {
+            data.reconfigure(*ctx_id, &config);
+            devices.push(data.device.device_id);
+        }
+    }
+    for device in devices {
+        GLOBAL_STATE.switch_active_ctx(device, ptr::null_mut());
+    }
+}
+
+fn enable_launch_callbacks(
+    enable: u32,
+    subscriber: CUpti_SubscriberHandle,
+) -> Result<(), CUptiResult> {
+    for &cbid in KERNEL_LAUNCH_CBIDS
+        .iter()
+        .chain(GRAPH_LAUNCH_CBIDS)
+        .chain(SYNC_POINT_CBIDS)
+    {
+        unsafe {
+            profiler::enable_callback(
+                enable,
+                subscriber,
+                CUpti_CallbackDomain_CUPTI_CB_DOMAIN_DRIVER_API,
+                cbid,
+            )
+        }?;
+    }
+    Ok(())
+}
+
+/// NVTX callbacks are only delivered if the application loads CUPTI as its NVTX
+/// injection, see `NVTX_INJECTION64_PATH`.
+fn enable_nvtx_callbacks(
+    enable: u32,
+    subscriber: CUpti_SubscriberHandle,
+) -> Result<(), CUptiResult> {
+    for &cbid in NVTX_RANGE_CBIDS {
+        unsafe {
+            profiler::enable_callback(
+                enable,
+                subscriber,
+                CUpti_CallbackDomain_CUPTI_CB_DOMAIN_NVTX,
+                cbid,
+            )
+        }?;
+    }
+    Ok(())
+}
+
+/// Writes every kernel collected so far to the trace.
+///
+/// Activity buffers are flushed and buffered ranges evaluated first. With `end`,
+/// the range profiler of every context is disabled as well; sessions begin again
+/// on the next sampled launch, and launches still without an activity record are
+/// counted as dropped and forgotten.
+pub fn flush_contexts(config: &Config, end: bool) {
+    let _ = profiler::activity_flush_all(0);
+    let contexts = GLOBAL_STATE.contexts();
+    let mut devices = Vec::new();
+    for (ctx_id, handle) in &contexts {
+        if let Ok(mut data) = handle.lock() {
+            if end {
+                data.end_session(*ctx_id);
+                devices.push(data.device.device_id);
+            } else {
+                data.stop_session(*ctx_id);
+            }
+        }
+    }
+    // Sessions are ended already, so this only frees the devices.
+    for device in devices {
+        GLOBAL_STATE.switch_active_ctx(device, ptr::null_mut());
+    }
+    evaluation::flush();
+    // Activity is disabled after an ending flush, so launches whose records are
+    // not in the buffers by now will never get one.
+    if end {
+        let _ = profiler::activity_flush_all(0);
+    }
+    let mut completed = Vec::new();
+    for (_, handle) in &contexts {
+        if let Ok(mut data) = handle.lock() {
+            completed.extend(data.drain_incomplete());
+            if end {
+                data.discard_unmatched();
+            }
+        }
+    }
+    emit_kernels(&completed, config);
+    flush_aggregates(config);
+    drops::report();
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::sampling::SamplingPolicy;
+
+    #[test]
+    fn test_profiling_until_last_instance_stops() {
+        instance_configured(3, SessionConfig::parse("sampling=every:2").unwrap());
+        instance_configured(5, SessionConfig::parse("sampling=every:3").unwrap());
+        instance_started(3);
+        instance_started(5);
+        assert_eq!(
+            gate().overrides().sampling,
+            Some(SamplingPolicy::EveryNth(3))
+        );
+        assert!(is_profiling());
+        instance_stopped(5);
+        assert!(is_profiling());
+        assert_eq!(
+            gate().overrides().sampling,
+            Some(SamplingPolicy::EveryNth(2))
+        );
+        instance_stopped(3);
+        assert!(!is_profiling());
+    }
+}
@@ -0,0 +1,582 @@
+// Copyright (C) 2026 David Reveman.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Spill files: raw counter data images written for offline evaluation.
+//!
+//! A spill file is a 24 byte header followed by records. The header holds a
+//! magic, a version and the number of bytes of complete records, which is
+//! updated after every append, so a file left behind by a crashed process
+//! reads up to its last complete record. Each record is a `u32` kind and a
+//! `u64` payload length, followed by the payload. Integers are little endian;
+//! strings and byte arrays are prefixed with their `u64` length.
+
+use crate::clock::CLOCK_SYNC;
+use crate::state::{CompletedKernel, UserRange};
+use cupti_profiler::{MetricSet, SharedEvaluator};
+use std::{
+    fs::{File, OpenOptions},
+    io, ptr, slice,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Mutex,
+    },
+};
+
+const MAGIC: [u8; 8] = *b"CUPTISPL";
+const VERSION: u32 = 1;
+const HEADER_SIZE: usize = 24;
+const COMMITTED_OFFSET: usize = 16;
+const RECORD_HEADER_SIZE: usize = 12;
+
+/// The file is grown by at least this many bytes at a time.
+const GROW_SIZE: usize = 64 << 20;
+
+const KIND_CONFIG: u32 = 1;
+const KIND_IMAGE: u32 = 2;
+const KIND_KERNEL: u32 = 3;
+
+/// A record of a spill file.
+#[derive(Debug, PartialEq)]
+pub enum Record<'a> {
+    /// What evaluating the images of `id` needs.
+    Config {
+        id: u32,
+        chip_name: &'a str,
+        counter_availability_image: &'a [u8],
+        config_image: &'a [u8],
+        metrics: Vec<&'a str>,
+    },
+    /// A decoded counter data image. Its ranges are those of the launches in
+    /// `correlation_ids`, in order, followed by those of `user_ranges`.
+    Image {
+        config_id: u32,
+        ctx_id: u32,
+        correlation_ids: Vec<u32>,
+        user_ranges: Vec<(&'a str, u64, u64)>,
+        counter_data_image: &'a [u8],
+    },
+    /// Trace times of a range profiled launch.
+    Kernel {
+        correlation_id: u32,
+        start: u64,
+        end: u64,
+    },
+}
+
+#[derive(Default)]
+struct Encoder(Vec<u8>);
+
+impl Encoder {
+    fn u32(&mut self, v: u32) -> &mut Self {
+        self.0.extend_from_slice(&v.to_le_bytes());
+        self
+    }
+
+    fn u64(&mut self, v: u64) -> &mut Self {
+        self.0.extend_from_slice(&v.to_le_bytes());
+        self
+    }
+
+    fn bytes(&mut self, v: &[u8]) -> &mut Self {
+        self.u64(v.len() as u64);
+        self.0.extend_from_slice(v);
+        self
+    }
+}
+
+struct Decoder<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> Decoder<'a> {
+    fn take(&mut self, n: usize) -> io::Result<&'a [u8]> {
+        if n > self.data.len() {
+            return Err(io::Error::new(
+                io::ErrorKind::UnexpectedEof,
+                "truncated record",
+            ));
+        }
+        let (head, tail) = self.data.split_at(n);
+        self.data = tail;
+        Ok(head)
+    }
+
+    fn u32(&mut self) -> io::Result<u32> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> io::Result<u64> {
+        Ok(u64::from_le_bytes(self.take(8)?.try_into().unwrap()))
+    }
+
+    fn bytes(&mut self) -> io::Result<&'a [u8]> {
+        let len = self.u64()? as usize;
+        self.take(len)
+    }
+
+    fn str(&mut self) -> io::Result<&'a str> {
+        std::str::from_utf8(self.bytes()?)
+            .map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))
+    }
+}
+
+/// Appends records to a spill file through a shared mapping of it.
+pub struct SpillWriter {
+    file: File,
+    map: *mut u8,
+    capacity: usize,
+    len: usize,
+    /// Config record id of every config image written so far.
+    configs: Vec<(*const Vec<u8>, u32)>,
+}
+
+// The mapping is only accessed through `&mut self`.
+unsafe impl Send for SpillWriter {}
+
+impl SpillWriter {
+    /// Creates the spill file at `path`, replacing any existing file.
+    pub fn create(path: &str) -> io::Result<Self> {
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(true)
+            .open(path)?;
+        let mut writer = Self {
+            file,
+            map: ptr::null_mut(),
+            capacity: 0,
+            len: HEADER_SIZE,
+            configs: Vec::new(),
+        };
+        writer.reserve(0)?;
+        let header = writer.mapped(0, HEADER_SIZE);
+        header[..8].copy_from_slice(&MAGIC);
+        header[8..12].copy_from_slice(&VERSION.to_le_bytes());
+        writer.commit();
+        Ok(writer)
+    }
+
+    fn mapped(&mut self, offset: usize, len: usize) -> &mut [u8] {
+        assert!(offset + len <= self.capacity);
+        unsafe { slice::from_raw_parts_mut(self.map.add(offset), len) }
+    }
+
+    /// Makes room for `additional` bytes after the last record, growing the
+    /// file and remapping it if needed.
+    fn reserve(&mut self, additional: usize) -> io::Result<()> {
+        let needed = self.len + additional;
+        if needed <= self.capacity {
+            return Ok(());
+        }
+        let capacity = needed.max(self.capacity + GROW_SIZE);
+        self.file.set_len(capacity as u64)?;
+        self.unmap();
+        let map = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                capacity,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                std::os::unix::io::AsRawFd::as_raw_fd(&self.file),
+                0,
+            )
+        };
+        if map == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        self.map = map as *mut u8;
+        self.capacity = capacity;
+        Ok(())
+    }
+
+    fn unmap(&mut self) {
+        if !self.map.is_null() {
+            unsafe { libc::munmap(self.map as *mut libc::c_void, self.capacity) };
+            self.map = ptr::null_mut();
+            self.capacity = 0;
+        }
+    }
+
+    fn commit(&mut self) {
+        let len = (self.len as u64).to_le_bytes();
+        self.mapped(COMMITTED_OFFSET, 8).copy_from_slice(&len);
+    }
+
+    /// Appends a record whose payload is `head` followed by `tail`.
+    fn append(&mut self, kind: u32, head: &[u8], tail: &[u8]) -> io::Result<()> {
+        let payload_len = head.len() + tail.len();
+        self.reserve(RECORD_HEADER_SIZE + payload_len)?;
+        let offset = self.len;
+        let record = self.mapped(offset, RECORD_HEADER_SIZE + payload_len);
+        record[..4].copy_from_slice(&kind.to_le_bytes());
+        record[4..12].copy_from_slice(&(payload_len as u64).to_le_bytes());
+        let (head_out, tail_out) = record[RECORD_HEADER_SIZE..].split_at_mut(head.len());
+        head_out.copy_from_slice(head);
+        tail_out.copy_from_slice(tail);
+        self.len += RECORD_HEADER_SIZE + payload_len;
+        self.commit();
+        Ok(())
+    }
+
+    /// Returns the id of the config record for `config_image`, writing the
+    /// record first if this is the first image collected with it.
+    fn config_id(
+        &mut self,
+        evaluator: &SharedEvaluator,
+        config_image: &Arc<Vec<u8>>,
+        metrics: &MetricSet,
+    ) -> io::Result<u32> {
+        // Config images are shared through `ConfigCache` and never freed, so
+        // their address identifies them.
+        let key = Arc::as_ptr(config_image);
+        if let Some((_, id)) = self.configs.iter().find(|(k, _)| *k == key) {
+            return Ok(*id);
+        }
+        let id = self.configs.len() as u32;
+        let mut head = Encoder::default();
+        head.u32(id)
+            .bytes(evaluator.chip_name().as_bytes())
+            .bytes(evaluator.counter_availability_image())
+            .bytes(config_image)
+            .u32(metrics.len() as u32);
+        for name in metrics.names() {
+            head.bytes(name.as_bytes());
+        }
+        self.append(KIND_CONFIG, &head.0, &[])?;
+        self.configs.push((key, id));
+        Ok(id)
+    }
+
+    /// Appends a decoded counter data image; the image itself is copied once.
+    #[allow(clippy::too_many_arguments)]
+    pub fn append_image(
+        &mut self,
+        ctx_id: u32,
+        evaluator: &SharedEvaluator,
+        config_image: &Arc<Vec<u8>>,
+        counter_data_image: &[u8],
+        metrics: &MetricSet,
+        correlation_ids: &[u32],
+        user_ranges: &[UserRange],
+    ) -> io::Result<()> {
+        let config_id = self.config_id(evaluator, config_image, metrics)?;
+        let mut head = Encoder::default();
+        head.u32(config_id)
+            .u32(ctx_id)
+            .u32(correlation_ids.len() as u32);
+        for &correlation_id in correlation_ids {
+            head.u32(correlation_id);
+        }
+        head.u32(user_ranges.len() as u32);
+        for range in user_ranges {
+            head.bytes(range.name.as_bytes())
+                .u64(range.start)
+                .u64(range.end);
+        }
+        head.u64(counter_data_image.len() as u64);
+        self.append(KIND_IMAGE, &head.0, counter_data_image)
+    }
+
+    /// Appends the trace times of a range profiled launch.
+    pub fn append_kernel(&mut self, correlation_id: u32, start: u64, end: u64) -> io::Result<()> {
+        let mut head = Encoder::default();
+        head.u32(correlation_id).u64(start).u64(end);
+        self.append(KIND_KERNEL, &head.0, &[])
+    }
+
+    /// Shrinks the file to its records and writes the mapping back.
+    pub fn finish(&mut self) -> io::Result<()> {
+        if !self.map.is_null() {
+            unsafe { libc::msync(self.map as *mut libc::c_void, self.len, libc::MS_SYNC) };
+        }
+        self.unmap();
+        self.file.set_len(self.len as u64)
+    }
+}
+
+impl Drop for SpillWriter {
+    fn drop(&mut self) {
+        self.unmap();
+    }
+}
+
+/// A spill file mapped for reading.
+pub struct SpillFile {
+    map: *const u8,
+    size: usize,
+    len: usize,
+}
+
+// The mapping is read-only.
+unsafe impl Send for SpillFile {}
+unsafe impl Sync for SpillFile {}
+
+impl SpillFile {
+    pub fn open(path: &str) -> io::Result<Self> {
+        let file = File::open(path)?;
+        let size = file.metadata()?.len() as usize;
+        let invalid = |msg| io::Error::new(io::ErrorKind::InvalidData, msg);
+        if size < HEADER_SIZE {
+            return Err(invalid("not a spill file"));
+        }
+        let map = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                size,
+                libc::PROT_READ,
+                libc::MAP_SHARED,
+                std::os::unix::io::AsRawFd::as_raw_fd(&file),
+                0,
+            )
+        };
+        if map == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        let mut spill = Self {
+            map: map as *const u8,
+            size,
+            len: size,
+        };
+        let header = &spill.data()[..HEADER_SIZE];
+        if header[..8] != MAGIC || header[8..12] != VERSION.to_le_bytes() {
+            return Err(invalid("not a spill file or unsupported version"));
+        }
+        let committed = u64::from_le_bytes(header[16..24].try_into().unwrap()) as usize;
+        spill.len = committed.clamp(HEADER_SIZE, size);
+        Ok(spill)
+    }
+
+    fn data(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.map, self.len) }
+    }
+
+    /// Returns the records in the order they were written.
+    pub fn records(&self) -> impl Iterator<Item = io::Result<Record<'_>>> {
+        let mut records = Decoder {
+            data: &self.data()[HEADER_SIZE..],
+        };
+        std::iter::from_fn(move || {
+            if records.data.is_empty() {
+                return None;
+            }
+            let record = (|| {
+                let kind = records.u32()?;
+                let len = records.u64()? as usize;
+                decode_record(kind, records.take(len)?)
+            })();
+            if record.is_err() {
+                records.data = &[];
+            }
+            Some(record)
+        })
+    }
+}
+
+impl Drop for SpillFile {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.map as *mut libc::c_void, self.size) };
+    }
+}
+
+fn decode_record(kind: u32, payload: &[u8]) -> io::Result<Record<'_>> {
+    let mut d = Decoder { data: payload };
+    Ok(match kind {
+        KIND_CONFIG => {
+            let id = d.u32()?;
+            let chip_name = d.str()?;
+            let counter_availability_image = d.bytes()?;
+            let config_image = d.bytes()?;
+            let metrics = (0..d.u32()?).map(|_| d.str()).collect::<io::Result<_>>()?;
+            Record::Config {
+                id,
+                chip_name,
+                counter_availability_image,
+                config_image,
+                metrics,
+            }
+        }
+        KIND_IMAGE => {
+            let config_id = d.u32()?;
+            let ctx_id = d.u32()?;
+            let correlation_ids = (0..d.u32()?).map(|_| d.u32()).collect::<io::Result<_>>()?;
+            let user_ranges = (0..d.u32()?)
+                .map(|_| Ok((d.str()?, d.u64()?, d.u64()?)))
+                .collect::<io::Result<_>>()?;
+            Record::Image {
+                config_id,
+                ctx_id,
+                correlation_ids,
+                user_ranges,
+                counter_data_image: d.bytes()?,
+            }
+        }
+        KIND_KERNEL => Record::Kernel {
+            correlation_id: d.u32()?,
+            start: d.u64()?,
+            end: d.u64()?,
+        },
+        _ => {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                format!("unknown record kind {}", kind),
+            ))
+        }
+    })
+}
+
+static SPILLING: AtomicBool = AtomicBool::new(false);
+static WRITER: Mutex<Option<SpillWriter>> = Mutex::new(None);
+
+/// Spills every decoded image to a new file at `path`, with `%p` replaced by
+/// the process id, instead of evaluating it.
+pub fn init(path: &str) {
+    let path = path.replace("%p", &unsafe { libc::getpid() }.to_string());
+    match SpillWriter::create(&path) {
+        Ok(writer) => {
+            if let Ok(mut slot) = WRITER.lock() {
+                *slot = Some(writer);
+                SPILLING.store(true, Ordering::Relaxed);
+            }
+        }
+        Err(e) => eprintln!("Failed to create spill file {}: {}", path, e),
+    }
+}
+
+/// Returns whether decoded images are spilled instead of evaluated.
+#[inline]
+pub fn is_spilling() -> bool {
+    SPILLING.load(Ordering::Relaxed)
+}
+
+/// Spills a decoded image, returning whether it was written.
+pub fn spill_image(
+    ctx_id: u32,
+    evaluator: &SharedEvaluator,
+    config_image: &Arc<Vec<u8>>,
+    counter_data_image: &[u8],
+    metrics: &MetricSet,
+    correlation_ids: &[u32],
+    user_ranges: &[UserRange],
+) -> bool {
+    let mut writer = match WRITER.lock() {
+        Ok(writer) => writer,
+        Err(_) => return false,
+    };
+    let result = match writer.as_mut() {
+        Some(writer) => writer.append_image(
+            ctx_id,
+            evaluator,
+            config_image,
+            counter_data_image,
+            metrics,
+            correlation_ids,
+            user_ranges,
+        ),
+        None => return false,
+    };
+    if let Err(e) = &result {
+        eprintln!("Failed to spill counter data: {}", e);
+    }
+    result.is_ok()
+}
+
+/// Spills the trace times of the range profiled kernels in `kernels`, which
+/// the offline evaluation places their counters at.
+pub fn spill_kernels(kernels: &[CompletedKernel]) {
+    let mut writer = match WRITER.lock() {
+        Ok(writer) => writer,
+        Err(_) => return,
+    };
+    if let Some(writer) = writer.as_mut() {
+        for kernel in kernels.iter().filter(|kernel| kernel.launch.sampled) {
+            let activity = &kernel.activity;
+            let start = CLOCK_SYNC
+                .to_trace_time(activity.start)
+                .unwrap_or(kernel.launch.timestamp);
+            let end = start + activity.end.saturating_sub(activity.start);
+            if writer
+                .append_kernel(kernel.launch.correlation_id, start, end)
+                .is_err()
+            {
+                return;
+            }
+        }
+    }
+}
+
+/// Completes the spill file. Images decoded afterwards are evaluated.
+pub fn finish() {
+    SPILLING.store(false, Ordering::Relaxed);
+    let writer = WRITER.lock().ok().and_then(|mut writer| writer.take());
+    if let Some(mut writer) = writer {
+        if let Err(e) = writer.finish() {
+            eprintln!("Failed to complete spill file: {}", e);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_records_round_trip() {
+        let path = std::env::temp_dir().join(format!("spill-test-{}", std::process::id()));
+        let path = path.to_str().unwrap();
+        let mut writer = SpillWriter::create(path).unwrap();
+        writer.append_kernel(7, 100, 200).unwrap();
+        let image = vec![0xabu8; GROW_SIZE + 1];
+        writer
+            .append(
+                KIND_IMAGE,
+                &{
+                    let mut head = Encoder::default();
+                    head.u32(0).u32(1).u32(1).u32(7).u32(1);
+                    head.bytes(b"step").u64(10).u64(20);
+                    head.u64(image.len() as u64);
+                    head.0
+                },
+                &image,
+            )
+            .unwrap();
+        // Records written before a crash are readable without `finish`.
+        {
+            let spill = SpillFile::open(path).unwrap();
+            assert_eq!(spill.records().count(), 2);
+        }
+        writer.finish().unwrap();
+        let spill = SpillFile::open(path).unwrap();
+        let records: Vec<Record> = spill.records().map(Result::unwrap).collect();
+        assert_eq!(
+            records[0],
+            Record::Kernel {
+                correlation_id: 7,
+                start: 100,
+                end: 200
+            }
+        );
+        assert_eq!(
+            records[1],
+            Record::Image {
+                config_id: 0,
+                ctx_id: 1,
+                correlation_ids: vec![7],
+                user_ranges: vec![("step", 10, 20)],
+                counter_data_image: &image,
+            }
+        );
+        std::fs::remove_file(path).unwrap();
+    }
+}
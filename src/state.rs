@@ -12,28 +12,75 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+use crate::batching::RangeBatch;
 use crate::config::Config;
+use crate::device::{DeviceProperties, FuncAttributeCache, FuncAttributes};
+use crate::drops::{self, DropReason};
+use crate::evaluation::{self, EvaluationJob};
+use crate::filter::FilterCache;
+use crate::image_ring::ImageRing;
+use crate::join::{JoinedKernel, KernelJoin};
+use crate::nvtx::{self, RangeMode};
+use crate::overhead::{self, Probe};
+use crate::sampling::Sampler;
+use crate::scheduling::MetricScheduler;
+use crate::spill;
+use crate::tracing::trace_time_ns;
 use cupti_profiler::bindings::*;
 use cupti_profiler::*;
 use once_cell::sync::Lazy;
-use std::{collections::HashMap, sync::Mutex};
+use std::{
+    collections::HashMap,
+    ffi::CString,
+    ptr,
+    sync::{
+        atomic::{AtomicBool, AtomicPtr, Ordering},
+        Arc, Mutex, MutexGuard, RwLock,
+    },
+    thread::{self, ThreadId},
+};
 
 /// Represents a specific kernel launch event.
 pub struct KernelLaunch {
+    pub correlation_id: u32,
     pub function: CUfunction,
     pub timestamp: u64,
+    pub attributes: FuncAttributes,
+    /// Whether the launch was range profiled and will have a `RangeInfo`.
+    pub sampled: bool,
 }
 
 /// Detailed activity information for a kernel execution.
 ///
 /// Gathered from CUPTI activity records.
 pub struct KernelActivity {
+    pub correlation_id: u32,
     pub kernel_name: String,
     pub grid_size: (i32, i32, i32),
     pub block_size: (i32, i32, i32),
     pub registers_per_thread: u16,
     pub dynamic_shared_memory: i32,
     pub static_shared_memory: i32,
+    /// Shared memory the driver configured per SM for the launch, in bytes;
+    /// zero if unknown.
+    pub shared_memory_executed: u32,
+    /// Requested cache configuration, a `CUfunc_cache` value.
+    pub cache_config: u8,
+    /// A `CUpti_ActivityLaunchType` value, e.g. cooperative.
+    pub launch_type: u8,
+    /// Graph and node the kernel was launched from; zero outside of graphs.
+    pub graph_id: u32,
+    pub graph_node_id: u64,
+    pub start: u64,
+    pub end: u64,
+}
+
+/// An NVTX range profiled as one range of the range profiler.
+pub struct UserRange {
+    pub name: String,
+    /// Trace times of the push and the pop.
+    pub start: u64,
+    pub end: u64,
 }
 
 /// Profiling data associated with a specific CUDA context.
@@ -41,41 +88,950 @@ pub struct KernelActivity {
 /// Handles the lifecycle of the range profiler, metric evaluator, and stores collected
 /// ranges and kernel launch metadata.
 pub struct CtxProfilerData {
-    pub device_id: i32,
-    pub num_sms: i32,
+    pub device: Arc<DeviceProperties>,
+    pub func_attributes: FuncAttributeCache,
     pub max_num_ranges: usize,
     pub is_active: bool,
+    /// Whether the session is stopped because the last launch was not sampled.
+    pub is_paused: bool,
+    /// Whether each launched function passes the kernel filter.
+    pub filter: FilterCache,
+    pub sampler: Sampler,
+    /// Whether metrics are split into single-pass groups; see `build_scheduler`.
+    pub multi_pass: bool,
+    /// Rotates single-pass metric groups across launches when multi-pass
+    /// scheduling is enabled.
+    pub scheduler: Option<MetricScheduler>,
+    /// The configured metrics, compiled once for the lifetime of the context.
+    pub metrics: Arc<MetricSet>,
+    /// Metrics the range profiler is currently configured with.
+    pub active_metrics: Arc<MetricSet>,
+    pub batch: RangeBatch,
+    /// The image ranges are collected into.
     pub counter_data_image: Vec<u8>,
-    pub metric_evaluator: Option<MetricEvaluator>,
+    /// Images that take the place of `counter_data_image` when it is decoded.
+    pub images: Arc<ImageRing>,
+    pub metric_evaluator: Option<Arc<SharedEvaluator>>,
     pub range_profiler: Option<RangeProfiler>,
-    pub range_info: Vec<RangeInfo>,
-    pub kernel_launches: Vec<KernelLaunch>,
-    pub kernel_activities: Vec<KernelActivity>,
+    /// Launches waiting for their activity record or range.
+    pub kernels: KernelJoin,
+    /// Correlation ids of the sampled launches recorded since the last decode, in
+    /// the order their ranges appear in the counter data image.
+    pub range_correlation_ids: Vec<u32>,
+    /// Whether kernels are built from activity records alone, without launches
+    /// being recorded or range profiled.
+    pub activity_only: bool,
+    pub range_mode: RangeMode,
+    /// The NVTX range being profiled, if one is open at the profiled depth, with
+    /// the thread that pushed it.
+    pub user_range: Option<(ThreadId, UserRange)>,
+    /// NVTX ranges recorded since the last decode, in range order.
+    pub user_ranges: Vec<UserRange>,
 }
 
 unsafe impl Send for CtxProfilerData {}
 unsafe impl Sync for CtxProfilerData {}
 
+/// A kernel launch whose metrics and activity record are both available.
+///
+/// Ready to be written to the trace and dropped.
+pub struct CompletedKernel {
+    pub device: Arc<DeviceProperties>,
+    pub launch: KernelLaunch,
+    pub activity: KernelActivity,
+    /// Metrics of the launch; `None` if it was not sampled.
+    pub range: Option<RangeInfo>,
+}
+
+impl CtxProfilerData {
+    /// Creates empty profiling data for a context on the given device.
+    pub fn new(device: DeviceProperties, config: &Config) -> Self {
+        Self {
+            device: Arc::new(device),
+            func_attributes: FuncAttributeCache::default(),
+            max_num_ranges: config.max_num_ranges,
+            is_active: false,
+            is_paused: false,
+            filter: FilterCache::new(config.kernel_filter.clone()),
+            sampler: Sampler::new(config.sampling, trace_time_ns()),
+            multi_pass: config.multi_pass || config.range_mode != RangeMode::Kernel,
+            scheduler: None,
+            metrics: Arc::new(MetricSet::new(&config.metrics)),
+            active_metrics: Arc::new(MetricSet::new(&[])),
+            batch: RangeBatch::new(
+                config.max_num_ranges,
+                config.decode_interval_ms * 1_000_000,
+                trace_time_ns(),
+            ),
+            counter_data_image: Vec::new(),
+            images: Arc::new(ImageRing::new(config.counter_data_images)),
+            metric_evaluator: None,
+            range_profiler: None,
+            kernels: KernelJoin::default(),
+            range_correlation_ids: Vec::new(),
+            activity_only: config.activity_only,
+            range_mode: config.range_mode,
+            user_range: None,
+            user_ranges: Vec::new(),
+        }
+    }
+
+    /// Enables and starts a range profiler session on `ctx` collecting `metrics`.
+    ///
+    /// Returns whether the session was started.
+    pub fn begin_session(&mut self, ctx: CUcontext, metrics: &Arc<MetricSet>) -> bool {
+        let mut rp = RangeProfiler::new(ctx);
+        if rp.enable().is_err()
+            || rp
+                .set_config(
+                    metrics.names(),
+                    &mut self.counter_data_image,
+                    self.max_num_ranges,
+                    self.range_mode.profiler_range(),
+                    self.range_mode.replay_mode(),
+                )
+                .is_err()
+        {
+            return false;
+        }
+        let _ = rp.start();
+        self.range_profiler = Some(rp);
+        self.active_metrics = metrics.clone();
+        self.is_active = true;
+        self.is_paused = false;
+        true
+    }
+
+    /// Reconfigures a running session to collect `metrics`.
+    ///
+    /// Ranges collected with the previous metrics are queued first. The session is
+    /// left paused; `resume` restarts it. If the profiler cannot be reconfigured,
+    /// the session is ended so the next sampled launch begins it again.
+    pub fn switch_metrics(&mut self, ctx_id: u32, metrics: &Arc<MetricSet>) {
+        if !self.is_active || Arc::ptr_eq(&self.active_metrics, metrics) {
+            return;
+        }
+        self.pause();
+        if self.batch.pending() > 0 {
+            self.decode_and_submit(ctx_id);
+        }
+        // The counter data image layout depends on the metrics.
+        self.counter_data_image.clear();
+        if let Some(rp) = &mut self.range_profiler {
+            if rp
+                .set_config(
+                    metrics.names(),
+                    &mut self.counter_data_image,
+                    self.max_num_ranges,
+                    self.range_mode.profiler_range(),
+                    self.range_mode.replay_mode(),
+                )
+                .is_err()
+            {
+                eprintln!("Context {}: failed to switch metric group", ctx_id);
+                self.end_session(ctx_id);
+                return;
+            }
+        }
+        self.active_metrics = metrics.clone();
+    }
+
+    /// Sets up multi-pass scheduling once the evaluator has split the metrics
+    /// into single-pass groups, which it does on a background thread.
+    ///
+    /// Returns whether the context is ready to collect ranges. Multi-pass
+    /// scheduling is turned off for the context if the split fails.
+    pub fn poll_scheduler(&mut self) -> bool {
+        if !self.multi_pass || self.scheduler.is_some() {
+            return true;
+        }
+        let evaluator = match &self.metric_evaluator {
+            Some(evaluator) => evaluator,
+            None => return true,
+        };
+        match evaluator.metric_groups(self.metrics.names()) {
+            Some(Ok(groups)) => self.scheduler = Some(MetricScheduler::new(groups)),
+            Some(Err(e)) => {
+                eprintln!("Failed to split metrics into passes: {:?}", e);
+                self.multi_pass = false;
+            }
+            None => return false,
+        }
+        true
+    }
+
+    /// Switches the context to `config`, e.g. when a tracing session brings its own.
+    ///
+    /// The session is ended, queueing what it collected, and begins again with the
+    /// new configuration on the next sampled launch.
+    pub fn reconfigure(&mut self, ctx_id: u32, config: &Config) {
+        self.end_session(ctx_id);
+        if self.metrics.names() != config.metrics.as_slice() {
+            self.metrics = Arc::new(MetricSet::new(&config.metrics));
+            self.scheduler = None;
+        }
+        // The counter data image layout depends on the metrics and range count.
+        self.counter_data_image.clear();
+        self.images = Arc::new(ImageRing::new(config.counter_data_images));
+        // User replay cannot replay the application, so every range must fit
+        // in a single pass.
+        self.multi_pass = config.multi_pass || config.range_mode != RangeMode::Kernel;
+        if !self.multi_pass {
+            self.scheduler = None;
+        }
+        if !self.filter.uses(&config.kernel_filter) {
+            self.filter = FilterCache::new(config.kernel_filter.clone());
+        }
+        self.sampler = Sampler::new(config.sampling, trace_time_ns());
+        if config.max_num_ranges != self.max_num_ranges {
+            self.max_num_ranges = config.max_num_ranges;
+            self.batch = RangeBatch::new(
+                config.max_num_ranges,
+                config.decode_interval_ms * 1_000_000,
+                trace_time_ns(),
+            );
+        }
+        self.activity_only = config.activity_only;
+        self.range_mode = config.range_mode;
+    }
+
+    /// Makes sure the session is running and collecting the right metrics for a
+    /// sampled launch of `symbol`.
+    ///
+    /// Until the metric groups of multi-pass scheduling are known, launches are
+    /// not profiled, so the launch path never waits for the split.
+    pub fn prepare_sampled_launch(&mut self, ctx: CUcontext, ctx_id: u32, symbol: &str) {
+        if !self.poll_scheduler() {
+            self.pause();
+            return;
+        }
+        let metrics = match &mut self.scheduler {
+            Some(scheduler) => {
+                let group = scheduler.select(symbol);
+                scheduler.group(group).clone()
+            }
+            None => self.metrics.clone(),
+        };
+        if self.range_profiler.is_none() {
+            self.begin_session(ctx, &metrics);
+        } else {
+            self.switch_metrics(ctx_id, &metrics);
+        }
+        self.resume();
+    }
+
+    /// Opens an NVTX range named `name` on `ctx`, pushed by the calling thread.
+    /// Ranges at the profiled depth are sampled like kernels and collect one
+    /// metric group, if `ctx` owns the range profiler of its device (`active`).
+    pub fn push_user_range(&mut self, ctx: CUcontext, ctx_id: u32, name: String, active: bool) {
+        let pushed = nvtx::push_depth(ctx_id);
+        let depth = match self.range_mode {
+            RangeMode::Nvtx { depth } => depth,
+            RangeMode::Kernel => return,
+        };
+        let now = trace_time_ns();
+        if pushed != depth
+            || !active
+            || self.user_range.is_some()
+            || !self.sampler.should_sample(&name, now)
+        {
+            return;
+        }
+        self.prepare_sampled_launch(ctx, ctx_id, &name);
+        if !self.is_active || self.metric_evaluator.is_none() {
+            return;
+        }
+        let c_name = CString::new(name.as_str()).unwrap_or_default();
+        if let Some(rp) = &self.range_profiler {
+            if rp.push_range(&c_name).is_ok() {
+                let range = UserRange {
+                    name,
+                    start: now,
+                    end: now,
+                };
+                self.user_range = Some((thread::current().id(), range));
+            }
+        }
+    }
+
+    /// Closes the innermost NVTX range of the calling thread, queueing buffered
+    /// ranges for evaluation once the batch is due.
+    pub fn pop_user_range(&mut self, ctx_id: u32) {
+        let depth = nvtx::pop_depth(ctx_id);
+        if self.range_mode != (RangeMode::Nvtx { depth }) {
+            return;
+        }
+        let mut range = match self.user_range.take() {
+            Some((owner, range)) if owner == thread::current().id() => range,
+            other => {
+                self.user_range = other;
+                return;
+            }
+        };
+        if let Some(rp) = &self.range_profiler {
+            let _ = rp.pop_range();
+        }
+        let now = trace_time_ns();
+        range.end = now;
+        self.user_ranges.push(range);
+        self.batch.record_range();
+        if self.batch.should_decode(now) {
+            self.stop_session(ctx_id);
+        }
+    }
+
+    /// Pairs the NVTX ranges of a decoded batch with their evaluated ranges.
+    ///
+    /// Ranges collected with a metric group are merged per range name, like
+    /// kernels are.
+    pub fn complete_user_ranges(
+        &mut self,
+        user_ranges: Vec<UserRange>,
+        ranges: impl IntoIterator<Item = RangeInfo>,
+    ) -> Vec<(UserRange, RangeInfo)> {
+        user_ranges
+            .into_iter()
+            .zip(ranges)
+            .map(|(user_range, range)| {
+                let range = match &mut self.scheduler {
+                    Some(scheduler) => scheduler.merge(&user_range.name, range),
+                    None => range,
+                };
+                (user_range, range)
+            })
+            .collect()
+    }
+
+    /// Stops the session so that subsequent launches are not range profiled.
+    ///
+    /// Ranges recorded so far stay in the counter data image until the next decode.
+    pub fn pause(&mut self) {
+        if self.is_active && !self.is_paused {
+            if let Some(rp) = &mut self.range_profiler {
+                let _ = rp.stop();
+            }
+            self.is_paused = true;
+        }
+    }
+
+    /// Restarts a session stopped by `pause`.
+    pub fn resume(&mut self) {
+        if self.is_active && self.is_paused {
+            if let Some(rp) = &self.range_profiler {
+                let _ = rp.start();
+            }
+            self.is_paused = false;
+        }
+    }
+
+    /// Stops the session and queues everything it collected, leaving it enabled.
+    pub fn stop_session(&mut self, ctx_id: u32) {
+        if !self.is_active {
+            return;
+        }
+        self.pause();
+        self.decode_and_submit(ctx_id);
+    }
+
+    /// Decodes the ranges buffered in the counter data image and queues them for evaluation.
+    ///
+    /// The decoded image itself is queued if a spare image from `images` can take
+    /// its place, so collection continues while it is evaluated. Otherwise a copy
+    /// is queued and the image is reinitialized, so the next batch starts empty.
+    pub fn decode_and_submit(&mut self, ctx_id: u32) {
+        let rp = match &mut self.range_profiler {
+            Some(rp) => rp,
+            None => return,
+        };
+        let has_ranges = !self.range_correlation_ids.is_empty() || !self.user_ranges.is_empty();
+        let mut spare = match &self.metric_evaluator {
+            Some(_) if has_ranges && !spill::is_spilling() && evaluation::has_room() => {
+                self.images.take(self.counter_data_image.len())
+            }
+            _ => None,
+        };
+        // The image can only be swapped while the session is stopped.
+        let running = spare.is_some() && self.is_active && !self.is_paused;
+        if running {
+            let _ = rp.stop();
+        }
+        let ranges_dropped =
+            overhead::time(Probe::Decode, || rp.decode_counter_data()).unwrap_or(0);
+        if ranges_dropped > 0 && self.batch.ranges_dropped() == 0 {
+            eprintln!(
+                "Context {}: counter data image full, ranges dropped; consider raising INJECTION_MAX_RANGES",
+                ctx_id
+            );
+        }
+        drops::count(DropReason::ImageFull, ranges_dropped);
+        self.batch.decoded(trace_time_ns(), ranges_dropped);
+        if let Some(mut image) = spare.take() {
+            if rp.initialize_counter_data_image(&mut image).is_ok()
+                && rp.set_counter_data_image(&mut image).is_ok()
+            {
+                spare = Some(std::mem::replace(&mut self.counter_data_image, image));
+            } else {
+                self.images.put(image);
+            }
+        }
+        match (spare, &self.metric_evaluator) {
+            (Some(image), Some(evaluator)) => evaluation::submit(EvaluationJob {
+                ctx_id,
+                evaluator: evaluator.clone(),
+                counter_data_image: image,
+                metrics: self.active_metrics.clone(),
+                correlation_ids: std::mem::take(&mut self.range_correlation_ids),
+                user_ranges: std::mem::take(&mut self.user_ranges),
+                recycle: Some(self.images.clone()),
+            }),
+            _ => {
+                evaluation::submit_snapshot(
+                    ctx_id,
+                    &self.metric_evaluator,
+                    &rp.config_image,
+                    &self.counter_data_image,
+                    &self.active_metrics,
+                    std::mem::take(&mut self.range_correlation_ids),
+                    std::mem::take(&mut self.user_ranges),
+                );
+                let _ = rp.initialize_counter_data_image(&mut self.counter_data_image);
+            }
+        }
+        if running {
+            let _ = rp.start();
+        }
+    }
+
+    /// Stops and disables the range profiler after queueing everything it collected.
+    pub fn end_session(&mut self, ctx_id: u32) {
+        if !self.is_active {
+            return;
+        }
+        self.stop_session(ctx_id);
+        if let Some(rp) = &mut self.range_profiler {
+            let _ = rp.disable();
+        }
+        self.range_profiler = None;
+        self.is_active = false;
+        self.is_paused = false;
+        // A range still open has nothing to be collected into.
+        self.user_range = None;
+    }
+
+    /// Records a launch; `sampled` launches also expect a range.
+    ///
+    /// Earlier launches whose activity record never arrived are given up on and
+    /// counted in `drops`.
+    pub fn add_launch(&mut self, launch: KernelLaunch) {
+        drops::count(
+            DropReason::NoActivity,
+            self.kernels.expire(launch.timestamp),
+        );
+        if launch.sampled {
+            self.range_correlation_ids.push(launch.correlation_id);
+        }
+        self.kernels.add_launch(launch.correlation_id, launch);
+    }
+
+    /// Forgets a launch that did not happen, e.g. because the launch call failed.
+    pub fn discard_launch(&mut self, correlation_id: u32) {
+        self.kernels.remove(correlation_id);
+        self.range_correlation_ids
+            .retain(|&id| id != correlation_id);
+    }
+
+    /// Adds activity records and returns the kernels they complete.
+    ///
+    /// Graph nodes share the correlation id of their graph launch and are never
+    /// range profiled, so they complete from their activity record alone.
+    pub fn add_activities(
+        &mut self,
+        activities: impl IntoIterator<Item = KernelActivity>,
+    ) -> Vec<CompletedKernel> {
+        if self.activity_only {
+            // Launches recorded before switching to activity-only mode are not
+            // joined anymore.
+            return activities
+                .into_iter()
+                .map(|activity| {
+                    if !self.kernels.is_empty() {
+                        self.kernels.remove(activity.correlation_id);
+                    }
+                    self.complete_activity(activity)
+                })
+                .collect();
+        }
+        let mut completed = Vec::new();
+        for activity in activities {
+            if activity.graph_id != 0 {
+                completed.push(self.complete_activity(activity));
+            } else if let Some(kernel) =
+                self.kernels.add_activity(activity.correlation_id, activity)
+            {
+                completed.push(self.complete(kernel));
+            }
+        }
+        completed
+    }
+
+    /// Adds the evaluated ranges of a decoded batch and returns the kernels they
+    /// complete.
+    ///
+    /// `correlation_ids` are the launches of the batch in range order. Launches
+    /// beyond the last range had their range dropped and complete without metrics.
+    pub fn add_ranges(
+        &mut self,
+        correlation_ids: &[u32],
+        ranges: impl IntoIterator<Item = RangeInfo>,
+    ) -> Vec<CompletedKernel> {
+        let mut ranges = ranges.into_iter();
+        let mut completed = Vec::new();
+        for &correlation_id in correlation_ids {
+            if let Some(kernel) = self.kernels.add_range(correlation_id, ranges.next()) {
+                completed.push(self.complete(kernel));
+            }
+        }
+        completed
+    }
+
+    /// Releases every kernel that has its activity record, with or without a range.
+    ///
+    /// Used at shutdown, after all ranges have been evaluated.
+    pub fn drain_incomplete(&mut self) -> Vec<CompletedKernel> {
+        self.kernels
+            .drain_unresolved()
+            .into_iter()
+            .map(|kernel| self.complete(kernel))
+            .collect()
+    }
+
+    /// Forgets launches without an activity record, counting them in `drops`.
+    ///
+    /// Used once activity collection has ended and every buffer was flushed.
+    pub fn discard_unmatched(&mut self) {
+        drops::count(DropReason::NoActivity, self.kernels.discard_unmatched());
+    }
+
+    /// Completes a kernel from its activity record alone.
+    fn complete_activity(&self, activity: KernelActivity) -> CompletedKernel {
+        let block_size = activity.block_size.0 * activity.block_size.1 * activity.block_size.2;
+        let attributes = FuncAttributes::estimate(
+            &self.device,
+            activity.cache_config as i32,
+            activity.registers_per_thread as i32,
+            block_size,
+            activity.dynamic_shared_memory + activity.static_shared_memory,
+        );
+        CompletedKernel {
+            device: self.device.clone(),
+            launch: KernelLaunch {
+                correlation_id: activity.correlation_id,
+                function: ptr::null_mut(),
+                timestamp: trace_time_ns(),
+                attributes,
+                sampled: false,
+            },
+            activity,
+            range: None,
+        }
+    }
+
+    fn complete(&mut self, kernel: JoinedKernel) -> CompletedKernel {
+        let JoinedKernel {
+            launch,
+            activity,
+            range,
+        } = kernel;
+        let range = match (range, &mut self.scheduler) {
+            (Some(range), Some(scheduler)) => Some(scheduler.merge(&activity.kernel_name, range)),
+            (range, _) => range,
+        };
+        CompletedKernel {
+            device: self.device.clone(),
+            launch,
+            activity,
+            range,
+        }
+    }
+}
+
+/// Shared handle to the profiling data of one context.
+///
+/// Each context has its own lock, so launches on different contexts never contend.
+pub type CtxHandle = Arc<Mutex<CtxProfilerData>>;
+
+/// Number of device slots that can each hold an active context.
+///
+/// Devices with larger ordinals have no slot, so their contexts are never range
+/// profiled.
+pub const MAX_DEVICES: usize = 64;
+
+/// Times `lock_active` makes `ctx` active again when other threads keep switching
+/// the device, before giving up on profiling the launch.
+const MAX_SWITCH_ATTEMPTS: usize = 4;
+
 /// Global state shared across the application.
 ///
-/// Manages per-context profiler data, the currently active context, and global configuration.
+/// Per-context profiler data is sharded behind individual locks. The context map
+/// itself is only written when contexts are created, and the active context of
+/// each device is published atomically so the launch fast path takes no global
+/// lock. Every device has its own range profiler session, so launches that
+/// alternate between devices never switch sessions.
 pub struct GlobalState {
-    pub context_data: HashMap<u32, Box<CtxProfilerData>>,
-    pub active_ctx: Option<CUcontext>,
-    pub injection_initialized: bool,
-    pub config: Config,
+    context_data: RwLock<HashMap<u32, (CUdevice, CtxHandle)>>,
+    active_ctx: [AtomicPtr<CUctx_st>; MAX_DEVICES],
+    switch_lock: Mutex<()>,
+    injection_initialized: AtomicBool,
+    config: RwLock<Arc<Config>>,
 }
 
-unsafe impl Send for GlobalState {}
+impl GlobalState {
+    fn new() -> Self {
+        Self {
+            context_data: RwLock::new(HashMap::new()),
+            active_ctx: std::array::from_fn(|_| AtomicPtr::new(ptr::null_mut())),
+            switch_lock: Mutex::new(()),
+            injection_initialized: AtomicBool::new(false),
+            config: RwLock::new(Arc::new(Config::default())),
+        }
+    }
+
+    /// Returns the current configuration.
+    pub fn config(&self) -> Arc<Config> {
+        match self.config.read() {
+            Ok(config) => config.clone(),
+            Err(_) => Arc::new(Config::default()),
+        }
+    }
+
+    /// Replaces the current configuration.
+    pub fn set_config(&self, config: Config) {
+        if let Ok(mut current) = self.config.write() {
+            *current = Arc::new(config);
+        }
+    }
+
+    /// Marks the injection as initialized, returning `false` if it already was.
+    pub fn mark_initialized(&self) -> bool {
+        self.injection_initialized
+            .compare_exchange(false, true, Ordering::SeqCst, Ordering::SeqCst)
+            .is_ok()
+    }
+
+    /// Returns the profiling data of a context, if it is known.
+    pub fn context(&self, ctx_id: u32) -> Option<CtxHandle> {
+        self.context_with_device(ctx_id).map(|(_, handle)| handle)
+    }
+
+    /// Returns the device and profiling data of a context, if it is known.
+    pub fn context_with_device(&self, ctx_id: u32) -> Option<(CUdevice, CtxHandle)> {
+        self.context_data.read().ok()?.get(&ctx_id).cloned()
+    }
+
+    /// Registers the profiling data of a newly created context.
+    pub fn insert_context(&self, ctx_id: u32, data: CtxProfilerData) -> CtxHandle {
+        let device = data.device.device_id;
+        let handle = Arc::new(Mutex::new(data));
+        if let Ok(mut contexts) = self.context_data.write() {
+            contexts.insert(ctx_id, (device, handle.clone()));
+        }
+        handle
+    }
+
+    /// Returns a snapshot of all known contexts.
+    pub fn contexts(&self) -> Vec<(u32, CtxHandle)> {
+        match self.context_data.read() {
+            Ok(contexts) => contexts
+                .iter()
+                .map(|(id, (_, h))| (*id, h.clone()))
+                .collect(),
+            Err(_) => Vec::new(),
+        }
+    }
+
+    /// Returns the context that currently owns the range profiler of `device`.
+    pub fn active_ctx(&self, device: CUdevice) -> CUcontext {
+        self.active_slot(device)
+            .map_or(ptr::null_mut(), |slot| slot.load(Ordering::Acquire))
+    }
+
+    /// Makes `ctx` the context that owns the range profiler of `device`, ending
+    /// the session of the previous one.
+    ///
+    /// Only called when the active context actually changes; concurrent switches
+    /// are serialized so that a session is never ended twice.
+    pub fn switch_active_ctx(&self, device: CUdevice, ctx: CUcontext) {
+        let slot = match self.active_slot(device) {
+            Some(slot) => slot,
+            None => return,
+        };
+        let _guard = self.switch_lock.lock();
+        let previous = self.active_ctx(device);
+        if previous == ctx {
+            return;
+        }
+        if !previous.is_null() {
+            let previous_id = unsafe { get_context_id(previous) };
+            if let Some(handle) = self.context(previous_id) {
+                if let Ok(mut data) = handle.lock() {
+                    data.end_session(previous_id);
+                }
+            }
+        }
+        slot.store(ctx, Ordering::Release);
+    }
+
+    /// Locks `handle`, the data of `ctx` on `device`, with `ctx` owning the range
+    /// profiler of the device.
+    ///
+    /// The active context is checked again under the lock, since another thread
+    /// may switch the device in between. Switching locks the previous context, so
+    /// it is never done while holding this one. Returns whether `ctx` owns the
+    /// range profiler along with the guard; if not, the launch must not begin a
+    /// session.
+    pub fn lock_active<'a>(
+        &self,
+        device: CUdevice,
+        ctx: CUcontext,
+        handle: &'a CtxHandle,
+    ) -> Option<(MutexGuard<'a, CtxProfilerData>, bool)> {
+        for _ in 0..MAX_SWITCH_ATTEMPTS {
+            if self.active_ctx(device) != ctx {
+                self.switch_active_ctx(device, ctx);
+            }
+            let data = handle.lock().ok()?;
+            if self.active_ctx(device) == ctx {
+                return Some((data, true));
+            }
+        }
+        handle.lock().ok().map(|data| (data, false))
+    }
+
+    fn active_slot(&self, device: CUdevice) -> Option<&AtomicPtr<CUctx_st>> {
+        usize::try_from(device)
+            .ok()
+            .and_then(|device| self.active_ctx.get(device))
+    }
+}
 
 /// The singleton global state instance.
-///
-/// Protected by a Mutex to ensure thread-safe access from callback handlers.
-pub static GLOBAL_STATE: Lazy<Mutex<GlobalState>> = Lazy::new(|| {
-    Mutex::new(GlobalState {
-        context_data: HashMap::new(),
-        active_ctx: None,
-        injection_initialized: false,
-        config: Config::default(),
-    })
-});
+pub static GLOBAL_STATE: Lazy<GlobalState> = Lazy::new(GlobalState::new);
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn kernel_activity(correlation_id: u32) -> KernelActivity {
+        KernelActivity {
+            correlation_id,
+            kernel_name: "k".to_string(),
+            grid_size: (1, 1, 1),
+            block_size: (32, 1, 1),
+            registers_per_thread: 16,
+            dynamic_shared_memory: 0,
+            static_shared_memory: 0,
+            shared_memory_executed: 0,
+            cache_config: 0,
+            launch_type: 0,
+            graph_id: 0,
+            graph_node_id: 0,
+            start: 0,
+            end: 100,
+        }
+    }
+
+    fn kernel_launch(correlation_id: u32, sampled: bool) -> KernelLaunch {
+        KernelLaunch {
+            correlation_id,
+            function: std::ptr::null_mut(),
+            timestamp: correlation_id as u64,
+            attributes: FuncAttributes::default(),
+            sampled,
+        }
+    }
+
+    /// Ranges whose single metric value identifies them.
+    fn ranges(values: &[f64]) -> impl Iterator<Item = RangeInfo> {
+        let metrics = Arc::new(MetricSet::new(&["id".to_string()]));
+        RangeValues::new(metrics, values.to_vec()).into_ranges()
+    }
+
+    fn range_id(kernel: &CompletedKernel) -> f64 {
+        kernel.range.as_ref().unwrap().values()[0]
+    }
+
+    #[test]
+    fn test_kernels_complete_in_any_order() {
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &Config::default());
+        data.add_launch(kernel_launch(1, true));
+        data.add_launch(kernel_launch(2, true));
+        assert_eq!(data.range_correlation_ids, [1, 2]);
+
+        // The second kernel's activity arrives first.
+        assert!(data.add_activities([kernel_activity(2)]).is_empty());
+        let ids = std::mem::take(&mut data.range_correlation_ids);
+        let completed = data.add_ranges(&ids, ranges(&[1.0, 2.0]));
+        assert_eq!(completed.len(), 1);
+        assert_eq!(completed[0].launch.correlation_id, 2);
+        assert_eq!(range_id(&completed[0]), 2.0);
+
+        let completed = data.add_activities([kernel_activity(1)]);
+        assert_eq!(completed.len(), 1);
+        assert_eq!(range_id(&completed[0]), 1.0);
+        assert!(data.kernels.is_empty());
+    }
+
+    #[test]
+    fn test_dropped_ranges_do_not_shift_metrics() {
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &Config::default());
+        for id in 1..=3 {
+            data.add_launch(kernel_launch(id, true));
+        }
+        let ids = std::mem::take(&mut data.range_correlation_ids);
+        // Only two ranges fit in the counter data image.
+        assert!(data.add_ranges(&ids, ranges(&[1.0, 2.0])).is_empty());
+        let completed = data.add_activities([kernel_activity(3), kernel_activity(1)]);
+        assert_eq!(completed.len(), 2);
+        assert!(completed[0].range.is_none());
+        assert_eq!(range_id(&completed[1]), 1.0);
+        assert_eq!(data.kernels.len(), 1);
+    }
+
+    #[test]
+    fn test_unsampled_and_unknown_kernels() {
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &Config::default());
+        data.add_launch(kernel_launch(1, false));
+        data.add_launch(kernel_launch(2, true));
+        assert_eq!(data.range_correlation_ids, [2]);
+        // Activity of a launch that was never recorded is ignored.
+        let completed = data.add_activities([kernel_activity(7), kernel_activity(1)]);
+        assert_eq!(completed.len(), 1);
+        assert!(completed[0].range.is_none());
+
+        data.add_activities([kernel_activity(2)]);
+        let drained = data.drain_incomplete();
+        assert_eq!(drained.len(), 1);
+        assert_eq!(drained[0].launch.correlation_id, 2);
+        assert!(data.kernels.is_empty());
+    }
+
+    #[test]
+    fn test_activity_only_completes_without_launch() {
+        let config = Config {
+            activity_only: true,
+            ..Config::default()
+        };
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &config);
+        let completed = data.add_activities([kernel_activity(7)]);
+        assert_eq!(completed.len(), 1);
+        assert_eq!(completed[0].launch.correlation_id, 7);
+        assert!(!completed[0].launch.sampled);
+        assert!(completed[0].range.is_none());
+        assert!(data.kernels.is_empty());
+    }
+
+    #[test]
+    fn test_reconfigure_keeps_pending_kernels() {
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &Config::default());
+        let metrics = data.metrics.clone();
+        data.add_launch(kernel_launch(1, false));
+        let config = Config {
+            metrics: vec!["a".to_string()],
+            max_num_ranges: 8,
+            activity_only: true,
+            ..Config::default()
+        };
+        data.reconfigure(1, &config);
+        assert_eq!(data.metrics.names(), ["a"]);
+        assert!(!Arc::ptr_eq(&data.metrics, &metrics));
+        assert_eq!(data.batch.capacity(), 8);
+        assert!(data.activity_only);
+        assert_eq!(data.add_activities([kernel_activity(1)]).len(), 1);
+        assert!(data.kernels.is_empty());
+    }
+
+    #[test]
+    fn test_multi_pass_waits_for_metric_groups() {
+        let config = Config {
+            metrics: vec!["a".to_string(), "b".to_string()],
+            multi_pass: true,
+            ..Config::default()
+        };
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &config);
+        assert!(data.poll_scheduler());
+        data.metric_evaluator = Some(Arc::new(SharedEvaluator::new(
+            "GA100".to_string(),
+            Vec::new(),
+        )));
+        while !data.poll_scheduler() {
+            thread::yield_now();
+        }
+        assert!(data.multi_pass);
+        assert!(data.scheduler.is_some());
+    }
+
+    #[test]
+    fn test_launches_without_activity_are_purged() {
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &Config::default());
+        let before = drops::dropped(DropReason::NoActivity);
+        // The activity records of the first two launches never arrive.
+        data.add_launch(kernel_launch(1, false));
+        data.add_launch(kernel_launch(2, false));
+        data.add_launch(KernelLaunch {
+            timestamp: crate::join::MAX_PENDING_AGE_NS + 2,
+            ..kernel_launch(3, false)
+        });
+        assert_eq!(data.kernels.len(), 2);
+        assert_eq!(drops::dropped(DropReason::NoActivity), before + 1);
+        data.add_launch(kernel_launch(4, true));
+        data.add_activities([kernel_activity(4)]);
+        data.discard_unmatched();
+        assert_eq!(data.kernels.len(), 1);
+        assert_eq!(drops::dropped(DropReason::NoActivity), before + 3);
+        assert_eq!(data.drain_incomplete().len(), 1);
+    }
+
+    #[test]
+    fn test_graph_nodes_complete_without_launch() {
+        let mut data = CtxProfilerData::new(DeviceProperties::default(), &Config::default());
+        let node = |graph_node_id| KernelActivity {
+            graph_id: 3,
+            graph_node_id,
+            ..kernel_activity(9)
+        };
+        let completed = data.add_activities([node(1), node(2)]);
+        assert_eq!(completed.len(), 2);
+        assert_eq!(completed[1].activity.graph_node_id, 2);
+        assert!(completed.iter().all(|kernel| kernel.range.is_none()));
+        // A regular kernel still waits for its launch.
+        assert!(data.add_activities([kernel_activity(9)]).is_empty());
+    }
+
+    #[test]
+    fn test_devices_have_independent_active_contexts() {
+        let state = GlobalState::new();
+        let ctx_a = 0x10 as CUcontext;
+        let ctx_b = 0x20 as CUcontext;
+        state.switch_active_ctx(0, ctx_a);
+        state.switch_active_ctx(1, ctx_b);
+        assert_eq!(state.active_ctx(0), ctx_a);
+        assert_eq!(state.active_ctx(1), ctx_b);
+        assert!(state.active_ctx(2).is_null());
+        // Devices without a slot never get an active context.
+        state.switch_active_ctx(MAX_DEVICES as CUdevice, ctx_a);
+        assert!(state.active_ctx(MAX_DEVICES as CUdevice).is_null());
+        assert_eq!(state.active_ctx(0), ctx_a);
+
+        let device = DeviceProperties {
+            device_id: 1,
+            ..Default::default()
+        };
+        let handle = state.insert_context(7, CtxProfilerData::new(device, &Config::default()));
+        assert_eq!(state.context_with_device(7).map(|(d, _)| d), Some(1));
+        let ctx_c = 0x30 as CUcontext;
+        let active = |device| state.lock_active(device, ctx_c, &handle).map(|(_, a)| a);
+        assert_eq!(active(2), Some(true));
+        assert_eq!(state.active_ctx(2), ctx_c);
+        assert_eq!(active(MAX_DEVICES as CUdevice), Some(false));
+    }
+}
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+use crate::config::SessionConfig;
+use crate::session;
 use libc::{clock_gettime, timespec};
 use perfetto_sdk::data_source::{
     DataSource, DataSourceArgsBuilder, DataSourceBufferExhaustedPolicy,
@@ -19,7 +21,7 @@ use perfetto_sdk::data_source::{
 use std::{
     env,
     sync::{
-        atomic::{AtomicU64, AtomicU8, Ordering},
+        atomic::{AtomicU64, AtomicU8, AtomicUsize, Ordering},
         OnceLock,
     },
 };
@@ -37,31 +39,93 @@ pub fn get_next_event_id() -> u64 {
     NEXT_EVENT_ID.fetch_add(1, Ordering::SeqCst)
 }
 
-/// Tracks whether the first counters have been received for a given data source instance.
-pub static GOT_FIRST_COUNTERS: AtomicU8 = AtomicU8::new(0);
+/// Number of metric counters whose descriptor has been written, per data source instance.
+pub static DESCRIBED_COUNTERS: [AtomicUsize; 8] = [const { AtomicUsize::new(0) }; 8];
+
+/// Tracks whether the drop counter descriptor has been written for a given data source instance.
+pub static GOT_FIRST_DROPS: AtomicU8 = AtomicU8::new(0);
+
+/// Tracks whether the derived metric descriptor has been written for a given data source instance.
+pub static GOT_FIRST_DERIVED: AtomicU8 = AtomicU8::new(0);
+
+/// Tracks whether the PM sampling counter descriptor has been written for a given data source instance.
+pub static GOT_FIRST_PM_COUNTERS: AtomicU8 = AtomicU8::new(0);
+
+/// Tracks whether the overhead counter descriptor has been written for a given data source instance.
+pub static GOT_FIRST_OVERHEAD: AtomicU8 = AtomicU8::new(0);
 
 static GPU_COUNTERS_DATA_SOURCE: OnceLock<DataSource> = OnceLock::new();
+static OVERHEAD_DATA_SOURCE: OnceLock<DataSource> = OnceLock::new();
 static DATA_SOURCE_NAME: OnceLock<String> = OnceLock::new();
 const DEFAULT_DATA_SOURCE_NAME: &str = "gpu.counters";
 
 /// Returns the data source name, reading from `INJECTION_DATA_SOURCE_NAME` env var or using default.
-fn get_data_source_name() -> &'static str {
+pub fn get_data_source_name() -> &'static str {
     DATA_SOURCE_NAME.get_or_init(|| {
         env::var("INJECTION_DATA_SOURCE_NAME")
             .unwrap_or_else(|_| DEFAULT_DATA_SOURCE_NAME.to_string())
     })
 }
 
+/// Parses a buffer exhausted policy: `drop`, `stall_and_drop` or `stall_and_abort`.
+fn parse_buffer_exhausted_policy(value: &str) -> Option<DataSourceBufferExhaustedPolicy> {
+    match value.trim() {
+        "drop" => Some(DataSourceBufferExhaustedPolicy::Drop),
+        "stall_and_drop" => Some(DataSourceBufferExhaustedPolicy::StallAndDrop),
+        "stall_and_abort" => Some(DataSourceBufferExhaustedPolicy::StallAndAbort),
+        _ => None,
+    }
+}
+
+/// Returns what writers do when the shared memory buffer is full, reading
+/// `INJECTION_BUFFER_EXHAUSTED_POLICY`.
+///
+/// Defaults to stalling for a bounded time and then dropping packets, so a
+/// slow tracing service throttles the application but never aborts it.
+fn buffer_exhausted_policy() -> DataSourceBufferExhaustedPolicy {
+    match env::var("INJECTION_BUFFER_EXHAUSTED_POLICY") {
+        Ok(value) => parse_buffer_exhausted_policy(&value).unwrap_or_else(|| {
+            eprintln!(
+                "Ignoring INJECTION_BUFFER_EXHAUSTED_POLICY: unknown policy '{}'",
+                value
+            );
+            DataSourceBufferExhaustedPolicy::StallAndDrop
+        }),
+        Err(_) => DataSourceBufferExhaustedPolicy::StallAndDrop,
+    }
+}
+
 /// Initializes and retrieves the static Perfetto data source.
 ///
 /// This function is thread-safe and ensures the data source is registered only once.
+/// Kernels are only profiled while an instance of it is running, with the overrides
+/// in the `legacy_config` of its `DataSourceConfig` (see `SessionConfig::parse`).
 /// The data source name can be overridden via the `INJECTION_DATA_SOURCE_NAME` environment variable.
 pub fn get_data_source() -> &'static DataSource<'static> {
     GPU_COUNTERS_DATA_SOURCE.get_or_init(|| {
         let data_source_args = DataSourceArgsBuilder::new()
-            .buffer_exhausted_policy(DataSourceBufferExhaustedPolicy::StallAndAbort)
+            .buffer_exhausted_policy(buffer_exhausted_policy())
+            .on_setup(move |inst_id, data_source_config, _| {
+                let session_config = match legacy_config(data_source_config) {
+                    Some(text) => SessionConfig::parse(text).unwrap_or_else(|e| {
+                        eprintln!("Ignoring data source config: {}", e);
+                        SessionConfig::default()
+                    }),
+                    None => SessionConfig::default(),
+                };
+                session::instance_configured(inst_id, session_config);
+            })
             .on_start(move |inst_id, _| {
-                GOT_FIRST_COUNTERS.fetch_and(!(1 << inst_id), Ordering::SeqCst);
+                if let Some(described) = DESCRIBED_COUNTERS.get(inst_id as usize) {
+                    described.store(0, Ordering::SeqCst);
+                }
+                GOT_FIRST_DROPS.fetch_and(!(1 << inst_id), Ordering::SeqCst);
+                GOT_FIRST_DERIVED.fetch_and(!(1 << inst_id), Ordering::SeqCst);
+                GOT_FIRST_PM_COUNTERS.fetch_and(!(1 << inst_id), Ordering::SeqCst);
+                session::instance_started(inst_id);
+            })
+            .on_stop(move |inst_id, _| {
+                session::instance_stopped(inst_id);
             });
         let mut data_source = DataSource::new();
         data_source
@@ -71,6 +135,73 @@ pub fn get_data_source() -> &'static DataSource<'static> {
     })
 }
 
+/// Initializes and retrieves the data source carrying the injection's own overhead.
+///
+/// It is registered as `<data source name>.overhead`, so it can be enabled next to
+/// the GPU counters without changing what they contain.
+pub fn get_overhead_data_source() -> &'static DataSource<'static> {
+    OVERHEAD_DATA_SOURCE.get_or_init(|| {
+        let data_source_args = DataSourceArgsBuilder::new()
+            .buffer_exhausted_policy(buffer_exhausted_policy())
+            .on_start(move |inst_id, _| {
+                GOT_FIRST_OVERHEAD.fetch_and(!(1 << inst_id), Ordering::SeqCst);
+            });
+        let mut data_source = DataSource::new();
+        data_source
+            .register(
+                &format!("{}.overhead", get_data_source_name()),
+                data_source_args.build(),
+            )
+            .expect("failed to register overhead data source");
+        data_source
+    })
+}
+
+/// Field number of `legacy_config` in the `DataSourceConfig` proto.
+const LEGACY_CONFIG_FIELD: u64 = 1000;
+
+/// Reads a base 128 varint from the front of `buf`.
+fn read_varint(buf: &mut &[u8]) -> Option<u64> {
+    let mut value = 0u64;
+    for shift in (0..64).step_by(7) {
+        let (&byte, rest) = buf.split_first()?;
+        *buf = rest;
+        value |= ((byte & 0x7f) as u64) << shift;
+        if byte & 0x80 == 0 {
+            return Some(value);
+        }
+    }
+    None
+}
+
+/// Returns the `legacy_config` string of a serialized `DataSourceConfig`.
+///
+/// Only skips over the other fields, so nothing else needs to be decoded.
+fn legacy_config(mut buf: &[u8]) -> Option<&str> {
+    while !buf.is_empty() {
+        let key = read_varint(&mut buf)?;
+        let len = match key & 7 {
+            0 => {
+                read_varint(&mut buf)?;
+                0
+            }
+            1 => 8,
+            2 => read_varint(&mut buf)? as usize,
+            5 => 4,
+            _ => return None,
+        };
+        if len > buf.len() {
+            return None;
+        }
+        let (value, rest) = buf.split_at(len);
+        buf = rest;
+        if key >> 3 == LEGACY_CONFIG_FIELD && key & 7 == 2 {
+            return std::str::from_utf8(value).ok();
+        }
+    }
+    None
+}
+
 /// Returns the current timestamp in nanoseconds from the trace clock.
 ///
 /// Uses `CLOCK_BOOTTIME` on Linux and `CLOCK_MONOTONIC` on macOS.
@@ -97,4 +228,29 @@ mod tests {
         assert_eq!(id2, id1 + 1);
         assert!(id1 > 0);
     }
+
+    #[test]
+    fn test_legacy_config() {
+        // name = "gpu.counters", target_buffer = 1, legacy_config = "metrics=a".
+        let mut config = vec![0x0a, 12];
+        config.extend_from_slice(b"gpu.counters");
+        config.extend_from_slice(&[0x10, 1, 0xc2, 0x3e, 9]);
+        config.extend_from_slice(b"metrics=a");
+        assert_eq!(legacy_config(&config), Some("metrics=a"));
+        assert_eq!(legacy_config(&config[..14]), None);
+        assert_eq!(legacy_config(&config[..config.len() - 1]), None);
+    }
+
+    #[test]
+    fn test_parse_buffer_exhausted_policy() {
+        assert!(matches!(
+            parse_buffer_exhausted_policy(" drop"),
+            Some(DataSourceBufferExhaustedPolicy::Drop)
+        ));
+        assert!(matches!(
+            parse_buffer_exhausted_policy("stall_and_abort"),
+            Some(DataSourceBufferExhaustedPolicy::StallAndAbort)
+        ));
+        assert!(parse_buffer_exhausted_policy("abort").is_none());
+    }
 }